@@ -15,6 +15,7 @@
 #include <psapi.h>
 #include <objidl.h>
 #include <gdiplus.h>
+#include <shellapi.h>
 
 #include <stdio.h>
 #include <conio.h>
@@ -25,6 +26,9 @@
 #include <chrono>
 #include <memory>
 #include <exception>
+#include <map>
+#include <string>
+#include <thread>
 
 using namespace std;
 using namespace std::chrono;
@@ -33,6 +37,20 @@ using namespace Gdiplus;
 
 #include <djlenum.hxx>
 #include <djltrace.hxx>
+#include <djl_sched.hxx>
+#include <djl_topo.hxx>
+#include <djl_memtag.hxx>
+#include <djl_arena.hxx>
+#include <djl_framepool.hxx>
+#include <djl_vsink.hxx>
+#include <djl_pixel.hxx>
+#include <djl_resample.hxx>
+#include <djl_compose.hxx>
+#include <djl_caption.hxx>
+#include <djl_readahead.hxx>
+#include <djl_phash.hxx>
+#include <djl_perfctr.hxx>
+#include <djl_status.hxx>
 
 #ifdef USE_WIC_FOR_OPEN
     #include <djl_wic2gdi.hxx>
@@ -44,6 +62,7 @@ using namespace Gdiplus;
 #pragma comment( lib, "mfuuid" )
 #pragma comment( lib, "ole32.lib" )
 #pragma comment( lib, "Gdiplus.lib" )
+#pragma comment( lib, "shell32.lib" )
 
 template <class T> void SafeRelease(T **ppT)
 {
@@ -169,49 +188,145 @@ WCHAR g_input_spec[ MAX_PATH + 1 ] = {0};
 WCHAR g_input_text_file[ MAX_PATH + 1 ] = {0};
 int g_parallelism = 4;
 int g_transition = 0;
+int g_kenburns = 0;   // pan and zoom: percent the image is zoomed by over its time on screen. 0 is off
+int g_burst_distance = -1;  // /u: skip images whose hash is within this many bits of the previous image's. -1 is off
+int g_resample = -1;  // -1 means WIC's scaler, otherwise a CResampler::Filter
+enum FitMode { fitLetterbox, fitCrop, fitBlur };
+FitMode g_fit = fitLetterbox;
 bool g_recurse = false;
 bool g_stats = false;
 bool g_usegpu = true;
 bool g_captions = false;
+enum SinkKind { sinkMF, sinkNull };
+SinkKind g_sink = sinkMF;   // --sink:null runs the whole pipeline but drops frames instead of encoding them
+bool g_decode_only = false; // --decode-only stops each image after the load stage
+WCHAR g_json_file[ MAX_PATH + 1 ] = {0};  // --json:file writes the run's configuration and timings for cvbench
+WCHAR g_jobs_file[ MAX_PATH + 1 ] = {0};  // --jobs:file renders one video per line of file in this process
+int g_job_line = 0;                       // line of the job file being parsed, for errors
+WCHAR g_sort_order = 'r';
+
+// --rendition:WxH[,bitrate]:file adds another video made from the same decoded images
+
+struct Rendition
+{
+    UINT32 width, height;
+    UINT32 bitRate;   // 0 scales the main video's bitrate by the number of pixels
+    WCHAR output[ MAX_PATH + 1 ];
+};
+
+vector<Rendition> g_renditions;
+bool g_pin = false;
+bool g_large_pages = false;
+int g_read_ahead_files = 0;         // /a: files read ahead of the decoders. 0 means each decoder opens its file
+size_t g_read_ahead_mb = 256;       // cap on memory holding files read ahead but not yet decoded
+bool g_counters = false;            // --counters charges thread cycles and bytes to each stage of each image
+size_t g_arena_cache_mb = 1024;     // --arena-cache:MB caps freed buffers kept for reuse
+bool g_arena = true;                // --arena:off allocates every buffer from the heap and frees it right away, for comparison
+bool g_io_map = true;               // --io:map reads inputs through mapped views; --io:read uses ReadFile as before
+WCHAR g_status_file[ MAX_PATH + 1 ] = {0};  // --status:file keeps file up to date with the run's progress as JSON
+int g_status_ms = 1000;                     // --status-ms:N is how often it's rewritten
+int g_fmp4_seconds = 0;                     // --fmp4[:N] writes fragmented MP4 with a fragment at least every N seconds
+vector<int> g_pin_nodes;  // OS node numbers from /n:. Empty means all nodes
 UINT32 g_ms_delay = 1000;
 UINT32 g_ms_transition_effect = 200;  // this is per entrance/exit. So a frame could have 2x total transition time.
 std::mutex g_mtx;
 CDJLTrace tracer;
 
+// Stages of an image's trip through the pipeline, for --counters
+
+enum PipelineStage { stageLoad, stageRotate, stageHash, stageFit, stageCaption, stageFlip, stageRenditions, stageWait, stageFrame, stageCount };
+const char * stageNames[ stageCount ] = { "load", "rotate", "hash", "fit", "caption", "flip", "renditions", "wait", "frame" };
+CStageCounters stageCounters( stageCount );
+CTaskScheduler scheduler;
+CMemoryTags memoryTags;
+CBufferArena arena;
+
+// What to turn down when a tag dominates the memory high-water mark, in MemoryTag order
+
+const char * memoryKnobs[ memTagCount ] = { "-p", "/a: files or MB", "-p", "-p, or /q:l|c|b to decode large images in stripes", "-p",
+                                            "/k or -p", "-p, renditions, or /e with transitions", "inputs per run", "--arena-cache:MB" };
+CResampler resampler;
+CGdipGlyphRasterizer glyphRasterizer( L"Arial", 12.0f, 4.0f );
+CCaptionRenderer captioner( glyphRasterizer );
+
 // Format constants
 
-// "all" here refers to stills loaded and fed to the video stream. 24 instead of 32 for size over speed in processing, but
-// it's actually faster, since 24 is what's natively loaded by the JPG engine via GDI+ and what the MP4 codec expects.
+// g_bpp is the format of stills loaded and fed to the video stream. 24 is the default: it's what's natively loaded by the
+// JPG engine via GDI+ and moves a quarter fewer bytes. --pixel:32 keeps each pixel in an aligned 4-byte word, which some
+// CPUs and resolutions prefer. The pixel kernels are compiled for each format (djl_pixel.hxx) and picked once per call.
+
+UINT32 g_bpp = 24;
 
-const UINT32 ALL_BPP = 24;
-const UINT32 ALL_BYTESPP = ALL_BPP / 8;
+static int PixelBytes() { return g_bpp / 8; }
+static PixelFormat GdipPixelFormat() { return ( 32 == g_bpp ) ? PixelFormat32bppRGB : PixelFormat24bppRGB; }
+static GUID VideoInputFormat() { return ( 32 == g_bpp ) ? MFVideoFormat_RGB32 : MFVideoFormat_RGB24; }
 
 const UINT32 VIDEO_FPS = 24;
 const GUID   VIDEO_ENCODING_FORMAT = MFVideoFormat_H264; // MFVideoFormat_HEVC works, but the results are almost identical
-const GUID   VIDEO_INPUT_FORMAT = MFVideoFormat_RGB24;
 const int    VIDEO_UNITS_PER_MS = 10000;
 
 
 static void Usage()
 {
-    printf( "Usage: cv [input] /o:[outputname] /b:[Bitrate] /d:[Delay] /e:[EffectMS] /f:[0xBBGGRR] /w:[Width] /h:[Height] /i:[textfile] /p:[threads] /t:[1-5]\n" );
+    if ( 0 != g_job_line )
+        printf( "  (line %d of job file %ws)\n\n", g_job_line, g_jobs_file );
+
+    printf( "Usage: cv [input] /o:[outputname] /a:[files,MB] /b:[Bitrate] /d:[Delay] /e:[EffectMS] /f:[0xBBGGRR] /w:[Width] /h:[Height] /i:[textfile] /k:[zoom] /l /m:[l|c|b] /n:[nodes] /p:[threads] /q:[w|l|c|b] /t:[1-5] /u:[bits]\n" );
     printf( "  Create Video from a set of image files\n" );
     printf( "  arguments: [input]  Path with wildcard for input files. e.g. c:\\pics\\*.jpg\n" );
+    printf( "             -a:X,Y   Read up to X files (at most Y MB) ahead of the decoders with overlapped I/O, for slow disks\n" );
+    printf( "                      and network shares. -a alone is 16 files, 256 MB. Default is off\n" );
     printf( "             -b       Bitrate suggestion. Default is 4,000,000 bps\n" );
     printf( "             -d       Delay between each image in milliseconds. Default is 1000\n" );
     printf( "             -e       Milliseconds of transition Effect on enter/exit of a frame. Must be < 0.5 of /d. Default is 200\n" );
     printf( "             -f       Fill color RGB for portions of video a photo doesn't cover. Default is black 0x000000\n" );
     printf( "             -g       Disable use of GPU for rendering. By default, GPU will be used if available\n" );
-    printf( "             -h       Height of the video (images are scaled then center-cropped to fit). Default is 1080\n" );
+    printf( "             -h       Height of the video (images are scaled to fit; see -m). Default is 1080\n" );
     printf( "             -i       Input text file with paths on each line. Alternative to using [input]\n" );
+    printf( "             -k:X     Ken Burns pan and zoom. Each image is decoded once at X percent of the video size and every\n" );
+    printf( "                      frame it's on screen is sampled from it, zooming in or out by X percent. 101-200. Default is 120\n" );
+    printf( "             -l       Large pages for image buffers. Requires the Lock pages in memory privilege. Default is off\n" );
+    printf( "             -m:X     Mode for fitting images in the frame. l = letterbox with the -f fill color, c = scale to fill then\n" );
+    printf( "                      center-crop; only the visible part of each image is decoded, b = letterbox over a blurred, zoomed\n" );
+    printf( "                      copy of the image. Default is l\n" );
+    printf( "             -n:X     NUMA: pin workers to nodes and decode each image next to its frame buffer. X is an optional\n" );
+    printf( "                      node list like 0,1 or 0-3. Default is no pinning; -n alone uses all nodes\n" );
     printf( "             -o       Specifies the output file name. Overwrites existing file.\n" );
     printf( "             -p       Parallelism 1-16. If your images are small, try more. If out of RAM, try less. Default is 4\n" );
+    printf( "             -q:X     Quality of scaling. w = WIC high quality cubic, l = Lanczos3, c = bicubic, b = bilinear.\n" );
+    printf( "                      l, c and b use a multi-threaded resampler instead of WIC, decoding large images in stripes\n" );
+    printf( "                      so memory use doesn't grow with image size. Default is w\n" );
     printf( "             -r       Recurse into subdirectories looking for more images. Default is false\n" );
     printf( "             -s:X     Sort order of input images. Lowercase/Uppercase inverts order. WCUPR (write, create, capture, path, random)\n" );
     printf( "                      Default is random\n" );
     printf( "             -t       Add transitions between frames. Transitions types 1-2. Default none.\n" );
-    printf( "             -w       Width of the video (images are scaled then center-cropped to fit). Default is 1920\n" );
-    printf( "             -z       Stats: show detailed performance information\n" );
+    printf( "             -u:X     Unique images only: skip an image whose perceptual hash is within X of 64 bits of the previous\n" );
+    printf( "                      image's, e.g. the rest of a burst of photos. 0-32. -u alone is 6. Default is off\n" );
+    printf( "             -w       Width of the video (images are scaled to fit; see -m). Default is 1920\n" );
+    printf( "             -z       Stats: show detailed performance information, including what memory was for at its peak\n" );
+    printf( "             --sink:null     Run the whole pipeline but drop frames instead of encoding. No output file is needed\n" );
+    printf( "             --decode-only   Stop each image after it's loaded. Both print images/sec and MB/s\n" );
+    printf( "             --json:file     Write the configuration, stage timings and memory use to file as JSON\n" );
+    printf( "             --status:file   Rewrite file with live progress as JSON: images done, rates, ETA, stage utilization,\n" );
+    printf( "                             memory in use and frames held by the encoder. Replaced atomically each update\n" );
+    printf( "             --status-ms:N   How often the status file is rewritten. 100-60000. Default is 1000\n" );
+    printf( "             --counters      With -z, show CPU cycles, cycles per byte and effective clock rate for each stage\n" );
+    printf( "             --arena:on|off  Recycle big buffers through the arena (the default), or get each from the heap\n" );
+    printf( "                             and free it right away. -z shows page faults and allocator time for comparison\n" );
+    printf( "             --arena-cache:MB  Most freed buffer memory the arena keeps for reuse. 0 frees every buffer.\n" );
+    printf( "                             Default is 1024\n" );
+    printf( "             --io:map|read   How inputs are read for sorting and decoding. map (the default) opens each file\n" );
+    printf( "                             once and reads it through a mapped view; read uses ReadFile calls. -z counts them\n" );
+    printf( "             --fmp4[:N]      Write fragmented MP4, starting a fragment with a key frame at least every N seconds\n" );
+    printf( "                             (default 2), so the file plays while it's written and survives a crash. Windows 8+\n" );
+    printf( "             --pixel:24|32   Pixel format images are composed and encoded in: 24bpp BGR (the default) or\n" );
+    printf( "                             32bpp BGRX, which moves more bytes but keeps each pixel in one aligned word\n" );
+    printf( "             --jobs:file     Render one video per line of file in one process, sharing workers, buffers and\n" );
+    printf( "                             enumerated inputs. Lines take [input] /o and the per-video options; command-line\n" );
+    printf( "                             options are the defaults. -a -l -n -p -z and -- options other than --rendition\n" );
+    printf( "                             apply to the whole run\n" );
+    printf( "             --rendition:WxH[,bitrate]:file   Also write a W x H video to file, made from the same decoded\n" );
+    printf( "                             images. Repeatable. The default bitrate is -b scaled by the number of pixels\n" );
     printf( "  examples:  cv *.jpg /s:p /o:video.mp4 /d:500 /h:1920 /w:1080\n" );
     printf( "             cv *.jpg /s:C /o:video.mp4 /b:5000000 /h:512 /w:512\n" );
     printf( "             cv *.jpg /s:u /o:video.mp4 /b:5000000 /h:512 /w:512 /f:0x1300ac\n" );
@@ -219,6 +334,9 @@ static void Usage()
     printf( "             cv *.jpg /o:video.mp4 /b:4000000 /h:2160 /w:3840 /p:16\n" );
     printf( "             cv d:\\pictures\\slothrust\\*.jpg /o:slothrust.mp4 /d:200\n" );
     printf( "             cv /t:1 d:\\pictures\\slothrust\\*.jpg /o:slothrust.mp4 /d:200\n" );
+    printf( "             cv /k:125 /q:c d:\\pictures\\2020\\*.jpg /o:2020.mp4 /d:4000\n" );
+    printf( "             cv --jobs:jobs.txt /p:8 /q:c\n" );
+    printf( "             cv *.jpg /o:4k.mp4 /w:3840 /h:2160 --rendition:1920x1080:hd.mp4 --rendition:1080x1080:square.mp4\n" );
     printf( "             cv /f:0x33aa44 /h:1500 /w:1000 /o:y:\\shirt.mp4 d:\\shirt\\*.jpg /d:490 /p:6 -z -g\n" );
     printf( "             cv /f:0x33aa44 /h:1500 /w:1000 /o:y:\\shirt.mp4 d:\\shirt\\*.jpg /d:490 /p:16 -z\n" );
     printf( "             cv /f:0x000000 /h:1080 /w:1920 /o:y:\\2020.mp4 d:\\zdrive\\pics\\2020_wow\\*.jpg /d:4000 /t:1 /e:300 /p:8 -z\n" );
@@ -245,7 +363,7 @@ static int StrideInBytes(int width, int bitsPerPixel)
     return (((width * bytesPerPixel) + (AlignmentForStride - 1)) / AlignmentForStride) * AlignmentForStride;
 } //StrideInBytes
 
-HRESULT InitializeSinkWriter( IMFSinkWriter **ppWriter, DWORD *pStreamIndex, WCHAR * pwcOutput )
+HRESULT InitializeSinkWriter( IMFSinkWriter **ppWriter, DWORD *pStreamIndex, const WCHAR * pwcOutput, UINT32 width, UINT32 height, UINT32 bitRate )
 {
     *ppWriter = NULL;
     *pStreamIndex = NULL;
@@ -253,14 +371,14 @@ HRESULT InitializeSinkWriter( IMFSinkWriter **ppWriter, DWORD *pStreamIndex, WCH
     IMFAttributes *pAttr = NULL;
     HRESULT hr = S_OK;
 
-    if ( g_usegpu )
-    {
-        hr = MFCreateAttributes( &pAttr, 1 );
+    if ( g_usegpu || ( 0 != g_fmp4_seconds ) )
+        hr = MFCreateAttributes( &pAttr, 2 );
 
+    if ( SUCCEEDED( hr ) && g_usegpu )
+    {
         // Hardware/GPU won't be used unless this is set. Overall runtime is >25% faster with the GPU
 
-        if ( SUCCEEDED( hr ) )
-            hr = pAttr->SetUINT32( MF_READWRITE_ENABLE_HARDWARE_TRANSFORMS, TRUE );
+        hr = pAttr->SetUINT32( MF_READWRITE_ENABLE_HARDWARE_TRANSFORMS, TRUE );
 
         // The app will run faster (if you have the RAM), but this can lead to tens of gigs of RAM usage.
         // If you turn this on, first increment the attribute count above.
@@ -269,6 +387,12 @@ HRESULT InitializeSinkWriter( IMFSinkWriter **ppWriter, DWORD *pStreamIndex, WCH
         //    hr = pAttr->SetUINT32( MF_SINK_WRITER_DISABLE_THROTTLING, TRUE );
     }
 
+    // Fragmented MP4 writes each fragment's moof and mdat as the video is encoded, so the file plays while it's being
+    // written and up to the last fragment after a crash. Finalize then just flushes the encoder and adds the index.
+
+    if ( SUCCEEDED( hr ) && ( 0 != g_fmp4_seconds ) )
+        hr = pAttr->SetGUID( MF_TRANSCODE_CONTAINERTYPE, MFTranscodeContainerType_FMPEG4 );
+
     IMFSinkWriter * pSinkWriter = NULL;
     if ( SUCCEEDED( hr ) )
         hr = MFCreateSinkWriterFromURL( pwcOutput, NULL, pAttr, &pSinkWriter );
@@ -284,13 +408,13 @@ HRESULT InitializeSinkWriter( IMFSinkWriter **ppWriter, DWORD *pStreamIndex, WCH
         hr = pMediaTypeOut->SetGUID( MF_MT_SUBTYPE, VIDEO_ENCODING_FORMAT );   
 
     if ( SUCCEEDED( hr ) )
-        hr = pMediaTypeOut->SetUINT32( MF_MT_AVG_BITRATE, g_video_bit_rate );
+        hr = pMediaTypeOut->SetUINT32( MF_MT_AVG_BITRATE, bitRate );
 
     if ( SUCCEEDED( hr ) )
         hr = pMediaTypeOut->SetUINT32( MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive );   
 
     if ( SUCCEEDED( hr ) )
-        hr = MFSetAttributeSize( pMediaTypeOut, MF_MT_FRAME_SIZE, g_width, g_height );
+        hr = MFSetAttributeSize( pMediaTypeOut, MF_MT_FRAME_SIZE, width, height );
 
     if ( SUCCEEDED( hr ) )
         hr = MFSetAttributeRatio( pMediaTypeOut, MF_MT_FRAME_RATE, VIDEO_FPS, 1 );   
@@ -299,7 +423,7 @@ HRESULT InitializeSinkWriter( IMFSinkWriter **ppWriter, DWORD *pStreamIndex, WCH
         hr = MFSetAttributeRatio( pMediaTypeOut, MF_MT_PIXEL_ASPECT_RATIO, 1, 1 );
 
     if ( SUCCEEDED( hr ) )
-        hr = pMediaTypeOut->SetUINT32( MF_MT_DEFAULT_STRIDE, StrideInBytes( g_width, ALL_BPP ) );
+        hr = pMediaTypeOut->SetUINT32( MF_MT_DEFAULT_STRIDE, StrideInBytes( width, g_bpp ) );
 
     if ( SUCCEEDED( hr ) )
         hr = pMediaTypeOut->SetUINT32( MF_MT_FIXED_SIZE_SAMPLES, TRUE );
@@ -308,7 +432,7 @@ HRESULT InitializeSinkWriter( IMFSinkWriter **ppWriter, DWORD *pStreamIndex, WCH
         hr = pMediaTypeOut->SetUINT32( MF_MT_ALL_SAMPLES_INDEPENDENT, TRUE );
 
     if ( SUCCEEDED( hr ) )
-        hr = pMediaTypeOut->SetUINT32( MF_MT_SAMPLE_SIZE, g_height * StrideInBytes( g_width, ALL_BPP ) );
+        hr = pMediaTypeOut->SetUINT32( MF_MT_SAMPLE_SIZE, height * StrideInBytes( width, g_bpp ) );
 
     #if false
     if ( VIDEO_ENCODING_FORMAT == MFVideoFormat_H265 )
@@ -336,13 +460,13 @@ HRESULT InitializeSinkWriter( IMFSinkWriter **ppWriter, DWORD *pStreamIndex, WCH
         hr = pMediaTypeIn->SetGUID( MF_MT_MAJOR_TYPE, MFMediaType_Video );   
 
     if ( SUCCEEDED( hr ) )
-        hr = pMediaTypeIn->SetGUID( MF_MT_SUBTYPE, VIDEO_INPUT_FORMAT );     
+        hr = pMediaTypeIn->SetGUID( MF_MT_SUBTYPE, VideoInputFormat() );     
 
     if ( SUCCEEDED( hr ) )
         hr = pMediaTypeIn->SetUINT32( MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive );   
 
     if ( SUCCEEDED( hr ) )
-        hr = MFSetAttributeSize( pMediaTypeIn, MF_MT_FRAME_SIZE, g_width, g_height );
+        hr = MFSetAttributeSize( pMediaTypeIn, MF_MT_FRAME_SIZE, width, height );
 
     if ( SUCCEEDED( hr ) )
         hr = MFSetAttributeRatio( pMediaTypeIn, MF_MT_FRAME_RATE, VIDEO_FPS, 1 );   
@@ -372,163 +496,94 @@ HRESULT InitializeSinkWriter( IMFSinkWriter **ppWriter, DWORD *pStreamIndex, WCH
     return hr;
 } //InitializeSinkWriter
 
-HRESULT WriteFrame( IMFSinkWriter *pWriter, DWORD streamIndex, const LONGLONG& rtStart, LONGLONG & duration, byte * pFrame )
-{
-    int stride = StrideInBytes( g_width, ALL_BPP );
-    const DWORD cbBuffer = stride * g_height;
-
-    // Create a new memory buffer.
-
-    IMFMediaBuffer *pBuffer = NULL;
-    HRESULT hr = MFCreateMemoryBuffer( cbBuffer, &pBuffer ) ;
-                             
-    // Lock the buffer and copy the video frame to the buffer.
-
-    BYTE *pData = NULL;
-    if ( SUCCEEDED( hr ) )
-        hr = pBuffer->Lock( &pData, NULL, NULL );
-
-    if ( SUCCEEDED( hr ) )
-        hr = MFCopyImage( pData, stride, pFrame, stride, g_width * 3, g_height );
-
-    if ( pBuffer )
-        pBuffer->Unlock();
-
-    // Set the data length of the buffer.
-
-    if ( SUCCEEDED( hr ) )
-        hr = pBuffer->SetCurrentLength( cbBuffer );
-
-    // Create a media sample and add the buffer to the sample.
-
-    IMFSample *pSample = NULL;
-
-    if ( SUCCEEDED( hr ) )
-        hr = MFCreateSample( &pSample );
-
-    if ( SUCCEEDED( hr ) )
-        hr = pSample->AddBuffer( pBuffer );
-
-    // Set the time stamp and the duration.
+// One row of a fade: opacity 1 is the original pixel; 0 is black or white. The channel loop unrolls for each pixel format.
 
-    if ( SUCCEEDED( hr ) )
-        hr = pSample->SetSampleTime( rtStart );
-
-    if ( SUCCEEDED( hr ) )
-        hr = pSample->SetSampleDuration( duration );
-
-    // Send the sample to the Sink Writer.
-
-    if ( SUCCEEDED( hr ) )
-        hr = pWriter->WriteSample( streamIndex, pSample );
-
-    if ( SUCCEEDED( hr ) )
-        hr = pWriter->NotifyEndOfSegment( streamIndex );
-
-    SafeRelease( &pSample );
-    SafeRelease( &pBuffer );
-    return hr;
-} //WriteFrame
-
-static byte ** g_aBitFrames = 0;
-static int g_animationFrames = 0;
-
-bool AllocateTransitionFrames( int animationFrames, int bytesPerFrame, int stride )
+template <typename P> static void FadeRowToBlack( byte * prow, const byte * prowFrame, int width, float opacity )
 {
-    static bool allocatedyet = false;
-
-    if ( allocatedyet )
-        return true;
-
-    allocatedyet = true;
-
-    g_animationFrames = animationFrames;
-    g_aBitFrames = new byte * [ animationFrames ];
+    byte * prowEnd = prow + ( P::Bytes * width );
 
-    for ( int i = 0; i < animationFrames; i++ )
-        g_aBitFrames[ i ] = new byte[ bytesPerFrame ];
+    do
+    {
+        for ( int c = 0; c < P::Bytes; c++ )
+            prow[ c ] = (byte) ( (float) prowFrame[ c ] * opacity );
 
-    return false;
-} //AlocateTransitionFrames
+        prow += P::Bytes;
+        prowFrame += P::Bytes;
+    } while ( prow < prowEnd );
+} //FadeRowToBlack
 
-void FreeTransitionFrames()
+template <typename P> static void FadeRowToWhite( byte * prow, const byte * prowFrame, int width, float opacity )
 {
-    if ( 0 != g_aBitFrames )
+    byte * prowEnd = prow + ( P::Bytes * width );
+
+    do
     {
-        for ( int i = 0; i < g_animationFrames; i++ )
-            delete [] g_aBitFrames[ i ];
+        for ( int c = 0; c < P::Bytes; c++ )
+            prow[ c ] = (byte) ( (float) prowFrame[ c ] + ( ( 255 - prowFrame[ c ] ) * opacity ) );
 
-        delete g_aBitFrames;
-    }
-} //FreeAnimationFrames
+        prow += P::Bytes;
+        prowFrame += P::Bytes;
+    } while ( prow < prowEnd );
+} //FadeRowToWhite
 
-HRESULT WriteTransitionFrame( IMFSinkWriter *pWriter, DWORD streamIndex, const LONGLONG& rtStart, LONGLONG & duration, byte * pFrame, int transition, int effect_ms )
+HRESULT WriteTransitionFrame( CVideoSink & sink, CFramePool & pool, const LONGLONG& rtStart, LONGLONG & duration, CFrame * frame, int width, int height,
+                              int transition, int effect_ms )
 {
     // rtStart and duration are in video units -- 10000 per MS
 
     if ( 0 == transition )
-        return WriteFrame( pWriter, streamIndex, rtStart, duration, pFrame );
+        return sink.WriteFrame( frame, rtStart, duration );
 
     float videoFrameTimeMS = 1000.0f / ( (float) VIDEO_FPS / 1.0f );
     int animationIntervalIS = (int) videoFrameTimeMS;
     int animationFrames = (int) ( (float) effect_ms / videoFrameTimeMS );
 
-    int stride = StrideInBytes( g_width, ALL_BPP );
-    int bytesPerFrame = g_height * stride;
+    int stride = StrideInBytes( width, g_bpp );
+    byte * pFrame = frame->Bits();
+
+    // The animation frames come from the pool. Each is submitted twice (fading in and out) without a copy.
+
+    vector<unique_ptr<CFrame, FrameReleaser>> aniFrames( animationFrames );
+
+    for ( int i = 0; i < animationFrames; i++ )
+    {
+        aniFrames[ i ].reset( pool.Acquire( frame->Node() ) );
 
-    AllocateTransitionFrames( animationFrames, bytesPerFrame, stride );
+        if ( NULL == aniFrames[ i ].get() )
+            return E_OUTOFMEMORY;
+    }
 
     LONGLONG animationDuration = effect_ms * VIDEO_UNITS_PER_MS;
     LONGLONG animationDurationPerFrame = animationDuration / animationFrames;
     LONGLONG currentTime = rtStart;
     LONGLONG mainFrameDuration = duration - ( animationDuration * (LONGLONG) 2 );
 
-    unique_ptr<Bitmap> sourceBitmap( new Bitmap( g_width, g_height, stride, PixelFormat24bppRGB, pFrame ) );
+    // Split by row blocks rather than by animation frame so each block of the source is read once for all frames
 
-    if ( 1 == transition )
-    {
-        parallel_for( 0, animationFrames, [&] (int i)
-        {
-            float opacity = (float) ( i + 0.1f ) / (float) animationFrames;
-            byte *p = g_aBitFrames[ i ];
-    
-            for ( int y = 0; y < g_height; y++ )
-            {
-                int row = y * stride;
-                byte * prow = p + row;
-                byte * prowFrame = pFrame + row;
-                byte * prowEnd = prow + ( ALL_BYTESPP * g_width );
-    
-                do
-                {
-                    *prow++ = (byte) ( ( float) ( *prowFrame++ ) * opacity );
-                    *prow++ = (byte) ( ( float) ( *prowFrame++ ) * opacity );
-                    *prow++ = (byte) ( ( float) ( *prowFrame++ ) * opacity );
-                } while ( prow < prowEnd );
-            }
-        } );
-    }
-    else if ( 2 == transition )
+    int rowsPerBlock = CTaskScheduler::RowsPerBlock( stride * animationFrames, height );
+
+    if ( 1 == transition || 2 == transition )
     {
-        parallel_for( 0, animationFrames, [&] (int i)
+        DispatchPixel( PixelBytes(), [&] ( auto pixel )
         {
-            float opacity = 1.0f - (float) i / (float) animationFrames;
-            byte *p = g_aBitFrames[ i ];
-    
-            for ( int y = 0; y < g_height; y++ )
+            scheduler.ForRange( 0, height, rowsPerBlock, [&] ( int yBegin, int yEnd )
             {
-                int row = y * stride;
-                byte * prow = p + row;
-                byte * prowFrame = pFrame + row;
-                byte * prowEnd = prow + ( ALL_BYTESPP * g_width );
-    
-                do
+                for ( int i = 0; i < animationFrames; i++ )
                 {
-                    *prow++ = (byte) ( ( float) ( *prowFrame ) + ( ( 255 - *prowFrame++ ) * opacity ) );
-                    *prow++ = (byte) ( ( float) ( *prowFrame ) + ( ( 255 - *prowFrame++ ) * opacity ) );
-                    *prow++ = (byte) ( ( float) ( *prowFrame ) + ( ( 255 - *prowFrame++ ) * opacity ) );
-                } while ( prow < prowEnd );
-            }
+                    float opacity = ( 1 == transition ) ? ( (float) ( i + 0.1f ) / (float) animationFrames ) : ( 1.0f - (float) i / (float) animationFrames );
+                    byte *p = aniFrames[ i ]->Bits();
+            
+                    for ( int y = yBegin; y < yEnd; y++ )
+                    {
+                        int row = y * stride;
+            
+                        if ( 1 == transition )
+                            FadeRowToBlack<decltype( pixel )>( p + row, pFrame + row, width, opacity );
+                        else
+                            FadeRowToWhite<decltype( pixel )>( p + row, pFrame + row, width, opacity );
+                    }
+                }
+            } );
         } );
     }
 
@@ -536,13 +591,13 @@ HRESULT WriteTransitionFrame( IMFSinkWriter *pWriter, DWORD streamIndex, const L
 
     for ( int i = 0; SUCCEEDED( hr ) && ( i < animationFrames ); i++ )
     {
-        hr = WriteFrame( pWriter, streamIndex, currentTime, animationDurationPerFrame, g_aBitFrames[ i ] );
+        hr = sink.WriteFrame( aniFrames[ i ].get(), currentTime, animationDurationPerFrame );
         currentTime += animationDurationPerFrame;
     }
 
     if ( SUCCEEDED( hr ) )
     {
-        hr = WriteFrame( pWriter, streamIndex, currentTime, mainFrameDuration, pFrame );
+        hr = sink.WriteFrame( frame, currentTime, mainFrameDuration );
         currentTime += mainFrameDuration;
     }
 
@@ -550,7 +605,7 @@ HRESULT WriteTransitionFrame( IMFSinkWriter *pWriter, DWORD streamIndex, const L
     {
         for ( int f = animationFrames - 1; SUCCEEDED( hr ) && ( f >= 0 ); f-- )
         {
-            hr = WriteFrame( pWriter, streamIndex, currentTime, animationDurationPerFrame, g_aBitFrames[ f ] );
+            hr = sink.WriteFrame( aniFrames[ f ].get(), currentTime, animationDurationPerFrame );
             currentTime += animationDurationPerFrame;
         }
     }
@@ -558,6 +613,70 @@ HRESULT WriteTransitionFrame( IMFSinkWriter *pWriter, DWORD streamIndex, const L
     return hr;
 } //WriteTransitionFrame
 
+// Where the pan and zoom viewport is in the canvas at t, 0 to 1 through the image's time on screen.
+// Even images zoom in and odd ones zoom out. The zoomed-in end drifts toward a corner that changes every other image.
+
+static void KenBurnsViewport( int image, double t, int cw, int ch, double & x, double & y, double & vw, double & vh )
+{
+    t = t * t * ( 3.0 - 2.0 * t ); // ease in and out
+    double z = ( image & 1 ) ? ( 1.0 - t ) : t;
+    double scale = 1.0 + ( ( g_kenburns / 100.0 ) - 1.0 ) * z;
+
+    vw = cw / scale;
+    vh = ch / scale;
+
+    int corner = ( image / 2 ) % 4;
+    x = ( cw - vw ) * ( ( corner & 1 ) ? 0.9 : 0.1 );
+    y = ( ch - vh ) * ( ( corner & 2 ) ? 0.9 : 0.1 );
+} //KenBurnsViewport
+
+void DrawCaption( byte * frame, int width, int height, int stride, const WCHAR * pwcPath );
+
+HRESULT WriteKenBurnsFrames( CVideoSink & sink, CFramePool & pool, LONGLONG rtStart, LONGLONG duration, const byte * canvas, int cw, int ch,
+                             int canvasStride, int image, int node, const WCHAR * pwcPath, LONGLONG & synthTime, LONGLONG & synthFrames )
+{
+    // The canvas was decoded once at the zoomed-in size. Each video frame is sampled from it into a pooled frame and
+    // submitted right away, so frames stream to the encoder and only a few are in memory at a time.
+
+    int frames = __max( 1, (int) ( ( duration * VIDEO_FPS ) / ( 1000 * VIDEO_UNITS_PER_MS ) ) );
+    LONGLONG frameDuration = duration / frames;
+    int stride = StrideInBytes( g_width, g_bpp );
+    CPerfTime perf;
+    HRESULT hr = S_OK;
+
+    for ( int i = 0; SUCCEEDED( hr ) && ( i < frames ); i++ )
+    {
+        LONGLONG start = perf.TimeNow();
+        unique_ptr<CFrame, FrameReleaser> frame( pool.Acquire( node ) );
+        if ( NULL == frame.get() )
+            return E_OUTOFMEMORY;
+
+        double x, y, vw, vh;
+        KenBurnsViewport( image, ( 1 == frames ) ? 0.0 : (double) i / (double) ( frames - 1 ), cw, ch, x, y, vw, vh );
+
+        // Video frames are bottom-up. Writing rows with a negative stride saves a FlipY pass per frame.
+
+        byte * bottomRow = frame->Bits() + (size_t) ( g_height - 1 ) * stride;
+        DispatchPixel( PixelBytes(), [&] ( auto pixel )
+        {
+            resampler.Viewport<decltype( pixel )>( canvas, cw, ch, canvasStride, x, y, vw, vh, bottomRow, g_width, g_height, -stride );
+        } );
+
+        if ( g_captions )
+            DrawCaption( bottomRow, g_width, g_height, -stride, pwcPath );
+
+        synthTime += perf.Since( start );
+
+        // the last frame absorbs the rounding so images stay on the same timeline as without pan and zoom
+
+        LONGLONG thisDuration = ( i == ( frames - 1 ) ) ? ( duration - frameDuration * i ) : frameDuration;
+        hr = sink.WriteFrame( frame.get(), rtStart + frameDuration * i, thisDuration );
+    }
+
+    synthFrames += frames;
+    return hr;
+} //WriteKenBurnsFrames
+
 void ComputeEventualSize( int & targetw, int & targeth, Bitmap & frame, Bitmap & b, bool invertWH )
 {
     int w = frame.GetWidth();
@@ -576,9 +695,19 @@ void ComputeEventualSize( int & targetw, int & targeth, Bitmap & frame, Bitmap &
     targetw = w;
     targeth = h;
 
+    if ( fitCrop == g_fit )
+    {
+        // Cover the frame; FitBitmapInFrame crops what overflows
+
+        if ( (double) bw / (double) bh > (double) w / (double) h )
+            targetw = (int) ceil( ( (double) h / (double) bh ) * (double) bw );
+        else
+            targeth = (int) ceil( ( (double) w / (double) bw ) * (double) bh );
+    }
+
     // Fit the bitmap such that when centered no data is lost, assuming black/fillcolor bars in places not used.
 
-    if ( ( bw > w ) || ( bh > h ) )
+    else if ( ( bw > w ) || ( bh > h ) )
     {
         if ( bw > w )
         {
@@ -637,25 +766,40 @@ void ComputeEventualSize( int & targetw, int & targeth, Bitmap & frame, Bitmap &
     }
 } //ComputeEventualSize
 
+static CResampler::Filter ResampleFilter()
+{
+    // GDI+ used to do this scaling with HighQualityBicubic, so that's what the WIC setting maps to
+
+    return ( -1 == g_resample ) ? CResampler::filterBicubic : (CResampler::Filter) g_resample;
+} //ResampleFilter
+
 #ifndef USE_WIC_FOR_OPEN
 
 Bitmap * ResizeBitmap( Bitmap * pb, int targetW, int targetH )
 {
-    Rect rectT( 0, 0, targetW, targetH );
-    Bitmap * newBitmap = new Bitmap( targetW, targetH, PixelFormat24bppRGB );
-    unique_ptr<Graphics> g( Graphics::FromImage( newBitmap ) );
+    // GDI+ DrawImage was very slow here and must internally have a lock, as it blocked all other threads.
+    // CResampler is lock-free and spreads the rows over the scheduler.
 
-    // The default is InterpolationModeBilinear. It's not InterpolationModeDefault :)
+    Bitmap * newBitmap = new Bitmap( targetW, targetH, GdipPixelFormat() );
 
-    g->SetCompositingMode( CompositingMode::CompositingModeSourceCopy );
-    g->SetCompositingQuality( CompositingQuality::CompositingQualityHighQuality );
-    g->SetInterpolationMode( InterpolationMode::InterpolationModeHighQualityBicubic );
-    g->SetPixelOffsetMode( PixelOffsetMode::PixelOffsetModeHighQuality );
+    Rect rectNew( 0, 0, targetW, targetH );
+    BitmapData bdNew;
+    newBitmap->LockBits( &rectNew, ImageLockModeWrite, GdipPixelFormat(), &bdNew );
 
-    // This is very slow and must internally have a lock, as it blocks all other threads.
-    // Much of the runtime of the app will be here (if not using WIC)
+    // Reading anything but the bitmap's own format makes GDI+ convert it here
+
+    Rect rectOld( 0, 0, pb->GetWidth(), pb->GetHeight() );
+    BitmapData bdOld;
+    pb->LockBits( &rectOld, ImageLockModeRead, GdipPixelFormat(), &bdOld );
+
+    DispatchPixel( PixelBytes(), [&] ( auto pixel )
+    {
+        resampler.Resample<decltype( pixel )>( (byte *) bdOld.Scan0, pb->GetWidth(), pb->GetHeight(), bdOld.Stride,
+                                               (byte *) bdNew.Scan0, targetW, targetH, bdNew.Stride, ResampleFilter() );
+    } );
 
-    g->DrawImage( pb, rectT, 0, 0, pb->GetWidth(), pb->GetHeight(), UnitPixel, NULL, NULL );
+    pb->UnlockBits( &bdOld );
+    newBitmap->UnlockBits( &bdNew );
 
     return newBitmap;
 } //ResizeBitmap
@@ -681,44 +825,48 @@ static int ExifRotateValue( Image & img )
 
 Bitmap * Rotate90( Bitmap & before )
 {
-    Bitmap * after = new Bitmap( before.GetHeight(), before.GetWidth(), PixelFormat24bppRGB );
+    Bitmap * after = new Bitmap( before.GetHeight(), before.GetWidth(), GdipPixelFormat() );
 
     Rect rectAfter( 0, 0, after->GetWidth(), after->GetHeight() );
     BitmapData bdAfter;
-    after->LockBits( &rectAfter, ImageLockModeWrite, PixelFormat24bppRGB, &bdAfter );
+    after->LockBits( &rectAfter, ImageLockModeWrite, GdipPixelFormat(), &bdAfter );
     int strideAfter = abs( bdAfter.Stride );
 
-    if ( strideAfter != StrideInBytes( after->GetWidth(), ALL_BPP ) )
+    if ( strideAfter != StrideInBytes( after->GetWidth(), g_bpp ) )
         printf( "stride After not expected\n" );
 
     Rect rectBefore( 0, 0, before.GetWidth(), before.GetHeight() );
     BitmapData bdBefore;
 
-    // The native pixel format is 24bppRGB. Reading anything else is much slower.
+    // Reading anything but the format the pipeline runs in makes GDI+ convert it, which is much slower.
 
-    before.LockBits( &rectBefore, ImageLockModeRead, PixelFormat24bppRGB, &bdBefore );
+    before.LockBits( &rectBefore, ImageLockModeRead, GdipPixelFormat(), &bdBefore );
     int strideBefore = abs( bdBefore.Stride );
 
-    if ( strideBefore != StrideInBytes( before.GetWidth(), ALL_BPP ) )
+    if ( strideBefore != StrideInBytes( before.GetWidth(), g_bpp ) )
         printf( "stride Before not expected\n" );
 
     byte * pixelAfterBase = (byte *) bdAfter.Scan0 + strideAfter;
     byte * pixelBeforeBase = (byte *) bdBefore.Scan0;
     int beforeHeight = before.GetHeight();
+    int pixelBytes = PixelBytes();
 
     //for ( int y = 0; y < beforeHeight; y++ )
-    parallel_for( 0, int( beforeHeight ), [&] ( int y )
+    scheduler.ForRange( 0, beforeHeight, CTaskScheduler::RowsPerBlock( strideBefore, beforeHeight ), [&] ( int yBegin, int yEnd )
     {
-        byte * pixelBefore = pixelBeforeBase + ( y * strideBefore );
-        byte * pixelAfter = pixelAfterBase - ( ( y + 1 ) * ALL_BYTESPP );
-        byte * pixelBeforeEnd = pixelBefore + strideBefore;
-
-        do
+        for ( int y = yBegin; y < yEnd; y++ )
         {
-            memcpy( pixelAfter, pixelBefore, ALL_BYTESPP );
-            pixelAfter += strideAfter;
-            pixelBefore += ALL_BYTESPP;
-        } while ( pixelBefore < pixelBeforeEnd );
+            byte * pixelBefore = pixelBeforeBase + ( y * strideBefore );
+            byte * pixelAfter = pixelAfterBase - ( ( y + 1 ) * pixelBytes );
+            byte * pixelBeforeEnd = pixelBefore + strideBefore;
+    
+            do
+            {
+                memcpy( pixelAfter, pixelBefore, pixelBytes );
+                pixelAfter += strideAfter;
+                pixelBefore += pixelBytes;
+            } while ( pixelBefore < pixelBeforeEnd );
+        }
     } );
 
     before.UnlockBits( &bdBefore );
@@ -753,7 +901,9 @@ static void ExifRotate( Image & img, int val, bool flipY )
 
 #endif // USE_WIC_FOR_OPEN
 
-void DrawCaption( Bitmap & frame, const WCHAR * pwcPath )
+// frame is the top row of the caption's view of the frame; stride is negative for bottom-up frames
+
+void DrawCaption( byte * frame, int width, int height, int stride, const WCHAR * pwcPath )
 {
     vector<WCHAR> caption( 1 + wcslen( pwcPath ) );
     wcscpy( caption.data(), pwcPath );
@@ -769,34 +919,41 @@ void DrawCaption( Bitmap & frame, const WCHAR * pwcPath )
         if ( L'-' == *p )
             *p = ' ';
 
-    FontFamily fontFamily( L"Arial" );
-    Font font( &fontFamily, 12, FontStyleBold, UnitPoint );
+    // Glyphs are rasterized once and cached; each frame just blends them in. White outline, black fill.
+
+    captioner.Draw( frame, width, height, stride, caption.data(), 0xffffff, 0x000000 );
+} //DrawCaption
 
-    StringFormat stringFormat;
-    stringFormat.SetAlignment( StringAlignmentCenter );
-    stringFormat.SetLineAlignment( StringAlignmentCenter );
+// Perceptual hash of a decoded image: the part of the canvas it was decoded into, or the decoded bitmap
 
-    RectF rect;
-    Unit unit;
-    frame.GetBounds( &rect, &unit );
+bool HashDecodedImage( bool placed, const byte * canvas, int canvasStride, const Rect & placedRect, Bitmap * bitmap, uint64_t & hash )
+{
+    if ( placed )
+    {
+        DispatchPixel( PixelBytes(), [&] ( auto pixel )
+        {
+            hash = CPerceptualHash::DHash<decltype( pixel )>( canvas + (size_t) placedRect.Y * canvasStride + (size_t) placedRect.X * PixelBytes(),
+                                                              placedRect.Width, placedRect.Height, canvasStride );
+        } );
+        return true;
+    }
 
-    RectF rectLower( rect.GetLeft(), rect.GetBottom() * 3.0 / 4.0, rect.GetRight(), rect.GetBottom() / 4.0 );
+    if ( NULL == bitmap )
+        return false;
 
-    Graphics graphics( & frame );
-    graphics.SetSmoothingMode( SmoothingModeAntiAlias );
-    graphics.SetInterpolationMode( InterpolationModeHighQualityBicubic );
+    Rect rect( 0, 0, bitmap->GetWidth(), bitmap->GetHeight() );
+    BitmapData bd;
 
-    GraphicsPath path;
-    path.AddString( caption.data(), wcslen( caption.data() ), &fontFamily, FontStyleRegular, 12, rectLower, &stringFormat );
-    Pen pen( Color( 255, 255, 255 ), 4 );
-    pen.SetLineJoin( LineJoinRound );
-    graphics.DrawPath( &pen, &path);
-    SolidBrush brush( Color( 0, 0, 0 ) );
-    graphics.FillPath( &brush, &path );
+    if ( Ok != bitmap->LockBits( &rect, ImageLockModeRead, GdipPixelFormat(), &bd ) )
+        return false;
 
-//    SolidBrush solidBrush( Color( 255, 255, 127, 127 ) );
-//    graphics.DrawString( caption.data(), -1, &font, rectLower, &stringFormat, &solidBrush );
-} //DrawCaption
+    DispatchPixel( PixelBytes(), [&] ( auto pixel )
+    {
+        hash = CPerceptualHash::DHash<decltype( pixel )>( (const byte *) bd.Scan0, rect.Width, rect.Height, bd.Stride );
+    } );
+    bitmap->UnlockBits( &bd );
+    return true;
+} //HashDecodedImage
 
 void FitBitmapInFrame( Bitmap & frame, Bitmap & b )
 {
@@ -806,83 +963,61 @@ void FitBitmapInFrame( Bitmap & frame, Bitmap & b )
     int bw = b.GetWidth();
     int bh = b.GetHeight();
 
-    if ( bw == w && bh == h )
-    {
-        Rect rect( 0, 0, w, h );
-        BitmapData bdFrame;
-        frame.LockBits( &rect, ImageLockModeWrite, PixelFormat24bppRGB, &bdFrame );
+    int targetw = w;
+    int targeth = h;
 
-        BitmapData bdb;
-        b.LockBits( &rect, ImageLockModeRead, PixelFormat24bppRGB, &bdb );
+    if ( ( fitCrop != g_fit ) && ( bw != w || bh != h ) )
+        ComputeEventualSize( targetw, targeth, frame, b, false );
 
-        int stride = abs( bdb.Stride );
-        int bytes = h * stride;
+    //printf( "w %d, h %d, bw %d, bh %d, targetw %d, targeth %d\n", w, h, bw, bh, targetw, targeth );
 
-        memcpy( bdFrame.Scan0, bdb.Scan0, bytes );
+    // No GDI+ Graphics here: only the bars get the fill color and the image rows are copied (or resampled) in place
 
-        frame.UnlockBits( &bdFrame );
-        b.UnlockBits( &bdb );
-    }
-    else
-    {
-        int targetw = w;
-        int targeth = h;
-    
-        ComputeEventualSize( targetw, targeth, frame, b, false );
-    
-        //printf( "w %d, h %d, bw %d, bh %d, targetw %d, targeth %d\n", w, h, bw, bh, targetw, targeth );
-    
-        unique_ptr<Graphics> g( Graphics::FromImage( &frame ) );
-    
-        int dstX = ( w - targetw ) / 2;
-        int dstY = ( h - targeth ) / 2;
-    
-        // Fill if the image doesn't fit the frame exactly
-    
-        if ( 0 != dstX || 0 != dstY )
-        {
-            Rect rectFill( 0, 0, w, h );
-            SolidBrush brushFill( Color( g_fill_red, g_fill_green, g_fill_blue ) );
-            g->FillRectangle( &brushFill, rectFill );
-        }
+    Rect rectFrame( 0, 0, w, h );
+    BitmapData bdFrame;
+    frame.LockBits( &rectFrame, ImageLockModeWrite, GdipPixelFormat(), &bdFrame );
 
-        // Unless upscaling, one or the other dimension will match exactly. So it's basically a blt, not a resize
-    
-        Rect rectT( dstX, dstY, targetw, targeth );
-    
-        g->SetCompositingMode( CompositingMode::CompositingModeSourceCopy );
-        g->SetCompositingQuality( CompositingQuality::CompositingQualityHighQuality );
-        g->SetInterpolationMode( InterpolationMode::InterpolationModeHighQualityBicubic );
-        g->SetPixelOffsetMode( PixelOffsetMode::PixelOffsetModeHighQuality );
+    Rect rectb( 0, 0, bw, bh );
+    BitmapData bdb;
+    b.LockBits( &rectb, ImageLockModeRead, GdipPixelFormat(), &bdb );
 
-        g->DrawImage( &b, rectT, 0, 0, bw, bh, UnitPixel, NULL, NULL );
+    DispatchPixel( PixelBytes(), [&] ( auto pixel )
+    {
+        typedef decltype( pixel ) P;
 
-        // this works too, but is no faster. I'm not using in case nonscaled images are passed in the future
-        // g->DrawImage( &b, dstX, dstY );
-    }
+        if ( fitCrop == g_fit )
+            CCompositor::Crop<P>( (byte *) bdFrame.Scan0, w, h, bdFrame.Stride, (byte *) bdb.Scan0, bw, bh, bdb.Stride, ResampleFilter() );
+        else if ( fitBlur == g_fit )
+            CCompositor::ComposeBlurred<P>( (byte *) bdFrame.Scan0, w, h, bdFrame.Stride, (byte *) bdb.Scan0, bw, bh, bdb.Stride,
+                                            targetw, targeth, ResampleFilter() );
+        else
+            CCompositor::Compose<P>( (byte *) bdFrame.Scan0, w, h, bdFrame.Stride, (byte *) bdb.Scan0, bw, bh, bdb.Stride,
+                                     targetw, targeth, g_fill_red, g_fill_green, g_fill_blue, ResampleFilter() );
+    } );
+
+    b.UnlockBits( &bdb );
+    frame.UnlockBits( &bdFrame );
 } //FitBitmapInFrame
 
 void FlipY( Bitmap & b )
 {
     Rect rect( 0, 0, b.GetWidth(), b.GetHeight() );
     BitmapData bd;
-    b.LockBits( &rect, ImageLockModeWrite, PixelFormat24bppRGB, &bd );
+    b.LockBits( &rect, ImageLockModeWrite, GdipPixelFormat(), &bd );
     int stride = abs( bd.Stride );
 
-    if ( stride != StrideInBytes( b.GetWidth(), ALL_BPP ) )
+    if ( stride != StrideInBytes( b.GetWidth(), g_bpp ) )
         printf( "stride in FlipY not expected\n" );
 
     byte * p = (byte *) bd.Scan0;
     int height = b.GetHeight();
     int half = height / 2;
-    int parallel = __min( 4, half );
-    int ineach = half / parallel;
 
-    parallel_for( 0, parallel, [&] (int t)
+    // Each swapped row touches two rows of the image
+
+    scheduler.ForRange( 0, half, CTaskScheduler::RowsPerBlock( 2 * stride, half ), [&] ( int top, int beyondtop )
     {
         vector<byte> row( stride );
-        int top = t * ineach;
-        int beyondtop = ( t == ( parallel - 1 ) ) ? half : ( top + ineach );
         int bottom = ( height - 1 ) - top;
         byte * ptop = p + ( top * stride );
         byte * pbottom = p + ( bottom * stride );
@@ -903,39 +1038,112 @@ void FlipY( Bitmap & b )
     b.UnlockBits( &bd );
 } //FlipY
 
-extern "C" int __cdecl wmain( int argc, WCHAR * argv[] )
-{
-    CPerfTime perfApp;
-    LONGLONG startTime = perfApp.TimeNow();
+// The settings a job in a job file can change. Values from the command line are the defaults for every job.
 
-    _set_se_translator([](unsigned int u, EXCEPTION_POINTERS *pExp)
+struct JobSettings
+{
+    WCHAR inputSpec[ MAX_PATH + 1 ];
+    WCHAR inputTextFile[ MAX_PATH + 1 ];
+    WCHAR outputFile[ MAX_PATH + 1 ];
+    UINT32 width, height, msDelay, msTransitionEffect, videoBitRate;
+    int transition, kenburns, resample, burstDistance;
+    FitMode fit;
+    bool recurse, captions, usegpu;
+    byte fillRed, fillGreen, fillBlue;
+    WCHAR sortOrder;
+    vector<Rendition> renditions;
+
+    void Capture()
     {
-        printf( "translating exception %x\n", u );
-        std::string error = "SE Exception: ";
-        switch (u)
-        {
-            case 0xC0000005:
-                error += "Access Violation";
-                break;
-            default:
-                char result[11];
-                sprintf_s(result, 11, "0x%08X", u);
-                error += result;
-        };
+        wcscpy( inputSpec, g_input_spec );
+        wcscpy( inputTextFile, g_input_text_file );
+        wcscpy( outputFile, g_output_file );
+        width = g_width;
+        height = g_height;
+        msDelay = g_ms_delay;
+        msTransitionEffect = g_ms_transition_effect;
+        videoBitRate = g_video_bit_rate;
+        transition = g_transition;
+        kenburns = g_kenburns;
+        burstDistance = g_burst_distance;
+        resample = g_resample;
+        fit = g_fit;
+        recurse = g_recurse;
+        captions = g_captions;
+        usegpu = g_usegpu;
+        fillRed = g_fill_red;
+        fillGreen = g_fill_green;
+        fillBlue = g_fill_blue;
+        sortOrder = g_sort_order;
+        renditions = g_renditions;
+    } //Capture
+
+    void Apply() const
+    {
+        wcscpy( g_input_spec, inputSpec );
+        wcscpy( g_input_text_file, inputTextFile );
+        wcscpy( g_output_file, outputFile );
+        g_width = width;
+        g_height = height;
+        g_ms_delay = msDelay;
+        g_ms_transition_effect = msTransitionEffect;
+        g_video_bit_rate = videoBitRate;
+        g_transition = transition;
+        g_kenburns = kenburns;
+        g_burst_distance = burstDistance;
+        g_resample = resample;
+        g_fit = fit;
+        g_recurse = recurse;
+        g_captions = captions;
+        g_usegpu = usegpu;
+        g_fill_red = fillRed;
+        g_fill_green = fillGreen;
+        g_fill_blue = fillBlue;
+        g_sort_order = sortOrder;
+        g_renditions = renditions;
+    } //Apply
+
+    bool Writes( const WCHAR * pwcFile ) const
+    {
+        if ( !_wcsicmp( outputFile, pwcFile ) )
+            return true;
 
-        printf( "throwing std::exception\n" );
-    
-        throw std::exception(error.c_str());
-    });
+        for ( size_t r = 0; r < renditions.size(); r++ )
+            if ( !_wcsicmp( renditions[ r ].output, pwcFile ) )
+                return true;
 
-    tracer.Enable( false, L"cv.txt", true );
+        return false;
+    } //Writes
+}; //JobSettings
 
+// One encoded video of a job: the main output or one of its renditions
+
+struct VideoOutput
+{
+    UINT32 width, height, bitRate;
+    const WCHAR * pwcPath;
+    int stride;
+    CFramePool * pool;
+    IMFSinkWriter * pWriter;    // NULL with --sink:null and --decode-only
+    CVideoSink * pSink;
+
+    VideoOutput() : width( 0 ), height( 0 ), bitRate( 0 ), pwcPath( NULL ), stride( 0 ), pool( NULL ), pWriter( NULL ), pSink( NULL ) {}
+};
+
+// What each job produced. The finalizing thread fills in the last three fields.
+
+struct JobResult
+{
+    LONGLONG images;
+    LONGLONG pipelineTime;
+    LONGLONG finalizeTime;
+    CVideoSink::Stats sinkStats;
+    HRESULT hr;
+};
+
+static void ParseArguments( int argc, WCHAR * argv[], bool jobLine )
+{
     int iArg = 1;
-    g_input_spec[ 0 ] = 0;
-    g_input_text_file[ 0 ] = 0;
-    g_output_file[ 0 ] = 0;
-    WCHAR sortOrder = 'r';
-    bool preserveFileOrder = false;
 
     while ( iArg < argc )
     {
@@ -947,7 +1155,117 @@ extern "C" int __cdecl wmain( int argc, WCHAR * argv[] )
         {
            WCHAR a1 = towlower( pwcArg[1] );
 
-           if ( L'b' == a1 )
+           // Options that shape the whole run (workers, NUMA, memory, stats and benchmark modes) only come from the command line
+
+           if ( jobLine && ( ( L'-' == a1 && _wcsnicmp( pwcArg + 2, L"rendition:", 10 ) ) || L'a' == a1 || L'l' == a1 || L'n' == a1 ||
+                             L'p' == a1 || L'z' == a1 ) )
+           {
+               printf( "%ws applies to the whole run and can't be used in a job file\n\n", pwcArg );
+               Usage();
+           }
+
+           if ( L'-' == a1 )
+           {
+               // long options, for benchmarking the pipeline without the encoder
+
+               const WCHAR * pwcLong = pwcArg + 2;
+
+               if ( !_wcsicmp( pwcLong, L"sink:null" ) )
+                   g_sink = sinkNull;
+               else if ( !_wcsicmp( pwcLong, L"sink:mf" ) )
+                   g_sink = sinkMF;
+               else if ( !_wcsicmp( pwcLong, L"decode-only" ) )
+                   g_decode_only = true;
+               else if ( !_wcsicmp( pwcLong, L"counters" ) )
+                   g_counters = true;
+               else if ( !_wcsicmp( pwcLong, L"arena:on" ) )
+                   g_arena = true;
+               else if ( !_wcsicmp( pwcLong, L"arena:off" ) )
+                   g_arena = false;
+               else if ( !_wcsnicmp( pwcLong, L"arena-cache:", 12 ) && iswdigit( pwcLong[ 12 ] ) )
+                   g_arena_cache_mb = _wtoi( pwcLong + 12 );
+               else if ( !_wcsicmp( pwcLong, L"io:map" ) )
+                   g_io_map = true;
+               else if ( !_wcsicmp( pwcLong, L"io:read" ) )
+                   g_io_map = false;
+               else if ( !_wcsicmp( pwcLong, L"fmp4" ) )
+                   g_fmp4_seconds = 2;
+               else if ( !_wcsnicmp( pwcLong, L"fmp4:", 5 ) )
+               {
+                   g_fmp4_seconds = _wtoi( pwcLong + 5 );
+
+                   if ( g_fmp4_seconds < 1 || g_fmp4_seconds > 60 )
+                   {
+                       printf( "invalid fragment interval %ws; expected 1-60 seconds\n\n", pwcArg );
+                       Usage();
+                   }
+               }
+               else if ( !_wcsicmp( pwcLong, L"pixel:24" ) )
+                   g_bpp = 24;
+               else if ( !_wcsicmp( pwcLong, L"pixel:32" ) )
+                   g_bpp = 32;
+               else if ( !_wcsnicmp( pwcLong, L"json:", 5 ) && 0 != pwcLong[ 5 ] && wcslen( pwcLong + 5 ) <= MAX_PATH )
+                   wcscpy( g_json_file, pwcLong + 5 );
+               else if ( !_wcsnicmp( pwcLong, L"status:", 7 ) && 0 != pwcLong[ 7 ] && wcslen( pwcLong + 7 ) <= MAX_PATH - 4 )
+                   wcscpy( g_status_file, pwcLong + 7 );
+               else if ( !_wcsnicmp( pwcLong, L"status-ms:", 10 ) )
+               {
+                   g_status_ms = _wtoi( pwcLong + 10 );
+
+                   if ( g_status_ms < 100 || g_status_ms > 60000 )
+                   {
+                       printf( "invalid status interval %ws; expected 100-60000 milliseconds\n\n", pwcArg );
+                       Usage();
+                   }
+               }
+               else if ( !_wcsnicmp( pwcLong, L"jobs:", 5 ) && 0 != pwcLong[ 5 ] && wcslen( pwcLong + 5 ) <= MAX_PATH )
+                   wcscpy( g_jobs_file, pwcLong + 5 );
+               else if ( !_wcsnicmp( pwcLong, L"rendition:", 10 ) )
+               {
+                   Rendition r;
+                   WCHAR * pwcEnd = NULL;
+                   r.width = wcstoul( pwcLong + 10, &pwcEnd, 10 );
+                   r.height = ( L'x' == towlower( *pwcEnd ) ) ? wcstoul( pwcEnd + 1, &pwcEnd, 10 ) : 0;
+                   r.bitRate = ( L',' == *pwcEnd ) ? wcstoul( pwcEnd + 1, &pwcEnd, 10 ) : 0;
+
+                   if ( 0 == r.width || 0 == r.height || L':' != *pwcEnd || 0 == pwcEnd[ 1 ] || wcslen( pwcEnd + 1 ) > MAX_PATH )
+                   {
+                       printf( "invalid rendition %ws; expected WxH[,bitrate]:file\n\n", pwcArg );
+                       Usage();
+                   }
+
+                   wcscpy( r.output, pwcEnd + 1 );
+                   g_renditions.push_back( r );
+               }
+               else
+               {
+                   printf( "unrecognized argument %ws\n", pwcArg );
+                   Usage();
+               }
+           }
+           else if ( L'a' == a1 )
+           {
+               g_read_ahead_files = 16;
+
+               if ( 0 != pwcArg[2] )
+               {
+                   if ( L':' != pwcArg[2] )
+                       Usage();
+
+                   WCHAR * pwcEnd = NULL;
+                   g_read_ahead_files = wcstol( pwcArg + 3, &pwcEnd, 10 );
+
+                   if ( L',' == *pwcEnd )
+                       g_read_ahead_mb = wcstoul( pwcEnd + 1, &pwcEnd, 10 );
+
+                   if ( g_read_ahead_files < 0 || g_read_ahead_files > 1024 || 0 == g_read_ahead_mb || 0 != *pwcEnd )
+                   {
+                       printf( "invalid read-ahead; expected /a:files[,MB]\n\n" );
+                       Usage();
+                   }
+               }
+           }
+           else if ( L'b' == a1 )
            {
                if ( L':' != pwcArg[2] )
                    Usage();
@@ -1038,6 +1356,88 @@ extern "C" int __cdecl wmain( int argc, WCHAR * argv[] )
 
                wcscpy( g_input_text_file, pwcArg + 3 );
            }
+           else if ( L'k' == a1 )
+           {
+               g_kenburns = 120;
+
+               if ( 0 != pwcArg[2] )
+               {
+                   if ( L':' != pwcArg[2] )
+                       Usage();
+
+                   g_kenburns = _wtoi( pwcArg + 3 );
+
+                   if ( g_kenburns <= 100 || g_kenburns > 200 )
+                   {
+                       printf( "invalid zoom percentage for /k\n\n" );
+                       Usage();
+                   }
+               }
+           }
+           else if ( L'u' == a1 )
+           {
+               g_burst_distance = 6;
+
+               if ( 0 != pwcArg[2] )
+               {
+                   if ( L':' != pwcArg[2] )
+                       Usage();
+
+                   g_burst_distance = _wtoi( pwcArg + 3 );
+
+                   if ( g_burst_distance < 0 || g_burst_distance > 32 )
+                   {
+                       printf( "invalid hash distance for /u\n\n" );
+                       Usage();
+                   }
+               }
+           }
+           else if ( L'l' == a1 )
+           {
+               if ( 0 != pwcArg[2] )
+                   Usage();
+
+               g_large_pages = true;
+           }
+           else if ( L'm' == a1 )
+           {
+               if ( L':' != pwcArg[2] || 0 == pwcArg[3] || 0 != pwcArg[4] )
+                   Usage();
+
+               WCHAR m = towlower( pwcArg[3] );
+
+               if ( L'l' == m )
+                   g_fit = fitLetterbox;
+               else if ( L'c' == m )
+                   g_fit = fitCrop;
+               else if ( L'b' == m )
+                   g_fit = fitBlur;
+               else
+               {
+                   printf( "invalid fit mode\n\n" );
+                   Usage();
+               }
+           }
+           else if ( L'n' == a1 )
+           {
+               g_pin = true;
+
+               if ( 0 != pwcArg[2] )
+               {
+                   if ( L':' != pwcArg[2] )
+                       Usage();
+
+                   char acNodes[ 100 ];
+                   size_t converted = 0;
+                   wcstombs_s( &converted, acNodes, _countof( acNodes ), pwcArg + 3, _TRUNCATE );
+
+                   if ( !CTopology::ParseCpuList( acNodes, g_pin_nodes ) || 0 == g_pin_nodes.size() )
+                   {
+                       printf( "invalid node list\n\n" );
+                       Usage();
+                   }
+               }
+           }
            else if ( L'w' == a1 )
            {
                if ( L':' != pwcArg[2] )
@@ -1079,6 +1479,27 @@ extern "C" int __cdecl wmain( int argc, WCHAR * argv[] )
                    Usage();
                }
            }
+           else if ( L'q' == a1 )
+           {
+               if ( L':' != pwcArg[2] || 0 == pwcArg[3] || 0 != pwcArg[4] )
+                   Usage();
+
+               WCHAR q = towlower( pwcArg[3] );
+
+               if ( L'w' == q )
+                   g_resample = -1;
+               else if ( L'l' == q )
+                   g_resample = CResampler::filterLanczos3;
+               else if ( L'c' == q )
+                   g_resample = CResampler::filterBicubic;
+               else if ( L'b' == q )
+                   g_resample = CResampler::filterBilinear;
+               else
+               {
+                   printf( "invalid quality\n\n" );
+                   Usage();
+               }
+           }
            else if ( L'r' == a1 )
            {
                if ( 0 != pwcArg[2] )
@@ -1091,8 +1512,8 @@ extern "C" int __cdecl wmain( int argc, WCHAR * argv[] )
                if ( 0 == pwcArg[2] || 0 == pwcArg[3] )
                    Usage();
 
-               sortOrder = pwcArg[ 3 ];
-               WCHAR lorder = tolower( sortOrder );
+               g_sort_order = pwcArg[ 3 ];
+               WCHAR lorder = tolower( g_sort_order );
 
                if ( 'w' != lorder && 'c' != lorder && 'u' != lorder && 'p' != lorder && 'r' != lorder )
                {
@@ -1139,14 +1560,23 @@ extern "C" int __cdecl wmain( int argc, WCHAR * argv[] )
 
        iArg++;
     }
+} //ParseArguments
 
-    if ( ( 0 != g_transition ) && ( g_ms_transition_effect * 2 ) >= g_ms_delay )
+static void CheckArguments( bool encode )
+{
+    if ( ( 0 != g_transition ) && ( 0 != g_kenburns ) )
     {
-        printf( "The transition effect time must be less than half the transition delay\n" );
+        printf( "transitions (/t) can't be combined with pan and zoom (/k)\n" );
         Usage();
     }
 
-    if ( 0 == g_input_spec[0] && 0 == g_input_text_file[0] )
+    if ( ( 0 != g_transition ) && ( g_ms_transition_effect * 2 ) >= g_ms_delay )
+    {
+        printf( "The transition effect time must be less than half the transition delay\n" );
+        Usage();
+    }
+
+    if ( 0 == g_input_spec[0] && 0 == g_input_text_file[0] )
     {
         printf( "no input specified\n" );
         Usage();
@@ -1158,13 +1588,134 @@ extern "C" int __cdecl wmain( int argc, WCHAR * argv[] )
         Usage();
     }
 
-    if ( 0 == g_output_file[ 0 ] )
+    if ( encode && 0 == g_output_file[ 0 ] )
     {
         printf( "no output file specified\n\n" );
         Usage();
     }
 
-    CPathArray paths;
+    if ( ( 0 != g_renditions.size() ) && ( 0 != g_kenburns ) )
+    {
+        printf( "renditions can't be combined with pan and zoom (/k)\n\n" );
+        Usage();
+    }
+
+    for ( size_t r = 0; encode && ( r < g_renditions.size() ); r++ )
+    {
+        bool duplicate = !_wcsicmp( g_renditions[ r ].output, g_output_file );
+
+        for ( size_t o = 0; o < r; o++ )
+            duplicate |= !_wcsicmp( g_renditions[ r ].output, g_renditions[ o ].output );
+
+        if ( duplicate )
+        {
+            printf( "more than one video is written to %ws\n\n", g_renditions[ r ].output );
+            Usage();
+        }
+    }
+} //CheckArguments
+
+// Each line of a job file is one video, written with the same arguments as the command line.
+// Blank lines and lines starting with # are skipped. Every job is validated before any rendering starts.
+
+static void LoadJobs( vector<JobSettings> & jobs, bool encode )
+{
+    FILE * file = _wfopen( g_jobs_file, L"r" );
+    if ( 0 == file )
+    {
+        printf( "can't open job file %ws\n", g_jobs_file );
+        Usage();
+    }
+
+    JobSettings defaults;
+    defaults.Capture();
+
+    static WCHAR awcLine[ 8 * MAX_PATH ];
+
+    while ( fgetws( awcLine, _countof( awcLine ), file ) )
+    {
+        g_job_line++;
+
+        int c = wcslen( awcLine ) - 1;
+
+        while ( ( c >= 0 ) && ( ( awcLine[c] == 0xd ) || ( awcLine[c] == 0xa ) ) )
+        {
+            awcLine[c] = 0;
+            c--;
+        }
+
+        WCHAR * pwcLine = awcLine;
+        while ( iswspace( *pwcLine ) )
+            pwcLine++;
+
+        if ( 0 == pwcLine[ 0 ] || L'#' == pwcLine[ 0 ] )
+            continue;
+
+        // CommandLineToArgvW parses the first token as a program name, so give it one
+
+        wstring commandLine( L"cv " );
+        commandLine += pwcLine;
+
+        int jobArgc = 0;
+        WCHAR ** jobArgv = CommandLineToArgvW( commandLine.c_str(), &jobArgc );
+
+        if ( NULL == jobArgv )
+        {
+            printf( "can't parse the job\n\n" );
+            Usage();
+        }
+
+        defaults.Apply();
+        ParseArguments( jobArgc, jobArgv, true );
+        CheckArguments( encode );
+        LocalFree( jobArgv );
+
+        JobSettings job;
+        job.Capture();
+
+        for ( size_t j = 0; encode && j < jobs.size(); j++ )
+        {
+            const WCHAR * pwcDuplicate = jobs[ j ].Writes( job.outputFile ) ? job.outputFile : NULL;
+
+            for ( size_t r = 0; NULL == pwcDuplicate && r < job.renditions.size(); r++ )
+                if ( jobs[ j ].Writes( job.renditions[ r ].output ) )
+                    pwcDuplicate = job.renditions[ r ].output;
+
+            if ( NULL != pwcDuplicate )
+            {
+                printf( "more than one job writes %ws\n\n", pwcDuplicate );
+                Usage();
+            }
+        }
+
+        jobs.push_back( job );
+    }
+
+    fclose( file );
+    g_job_line = 0;
+
+    if ( 0 == jobs.size() )
+    {
+        printf( "no jobs found in %ws\n\n", g_jobs_file );
+        Usage();
+    }
+} //LoadJobs
+
+// Enumerates the images for the current settings. Jobs with the same input share one array, so capture dates
+// are read at most once no matter how many jobs sort on them.
+
+static CPathArray & FindInputs( map<wstring, unique_ptr<CPathArray>> & cache )
+{
+    wstring key = g_recurse ? L"r|" : L"-|";
+    key += ( 0 != g_input_spec[ 0 ] ) ? g_input_spec : ( wstring( L"@" ) + g_input_text_file );
+
+    unique_ptr<CPathArray> & entry = cache[ key ];
+
+    if ( entry.get() )
+        return *entry;
+
+    entry.reset( new CPathArray() );
+    CPathArray & paths = *entry;
 
     if ( 0 != g_input_spec[0] )
     {
@@ -1224,36 +1775,168 @@ extern "C" int __cdecl wmain( int argc, WCHAR * argv[] )
         Usage();
     }
 
-    WCHAR lorder = tolower( sortOrder );
+    printf( "%zd input files\n", paths.Count() );
+    return paths;
+} //FindInputs
+
+// Orders the images for the current settings. Returns true if frames must be written in that order
+
+static bool SortInputs( CPathArray & paths )
+{
+    // Uppercase orders are descending. They're sorted that way rather than reversed afterward so ties keep their order
+
+    WCHAR lorder = tolower( g_sort_order );
+    bool ascending = ( lorder == g_sort_order );
+
     if ( 'w' == lorder )
-        paths.SortOnLastWrite();
+        paths.SortOnLastWrite( ascending );
     else if ( 'c' == lorder )
-        paths.SortOnCreation();
+        paths.SortOnCreation( ascending );
     else if ( 'u' == lorder )
-        paths.SortOnCapture();
+        paths.SortOnCapture( ascending );
     else if ( 'p' == lorder )
-        paths.SortOnPath();
+        paths.SortOnPath( ascending );
     else if ( 'r' == lorder )
         paths.Randomize();
 
-    if ( lorder != sortOrder )
-        paths.InvertSort();
+    return ( 'r' != lorder );
+} //SortInputs
 
-    if ( 'r' != lorder )
-        preserveFileOrder = true;
+// Drains each output's encoder, on its own thread so the encoders finish in parallel, then releases the outputs
 
-    printf( "%zd input files\n", paths.Count() );
+static void FinalizeOutputs( vector<VideoOutput> outputs, bool encode, JobResult * pResult )
+{
+    HRESULT hrCo = CoInitializeEx( NULL, COINIT_MULTITHREADED );
+    CPerfTime finalizeTimer;
+    vector<HRESULT> results( outputs.size(), S_OK );
+    vector<thread> drains;
+
+    for ( size_t o = 0; o < outputs.size(); o++ )
+    {
+        drains.push_back( thread( [&, o] ()
+        {
+            HRESULT hrDrainCo = CoInitializeEx( NULL, COINIT_MULTITHREADED );
+            results[ o ] = outputs[ o ].pSink->Finalize();
+
+            if ( SUCCEEDED( hrDrainCo ) )
+                CoUninitialize();
+        } ) );
+    }
+
+    for ( size_t o = 0; o < drains.size(); o++ )
+        drains[ o ].join();
+
+    finalizeTimer.CumulateSince( pResult->finalizeTime );
+    pResult->hr = S_OK;
+
+    for ( size_t o = 0; o < outputs.size(); o++ )
+    {
+        CVideoSink::Stats stats = outputs[ o ].pSink->GetStats();
+        pResult->sinkStats.framesSubmitted += stats.framesSubmitted;
+        pResult->sinkStats.bytesSubmitted += stats.bytesSubmitted;
+        pResult->sinkStats.bytesCopied += stats.bytesCopied;
+        pResult->sinkStats.outOfOrder += stats.outOfOrder;
+        pResult->sinkStats.fragments += stats.fragments;
+
+        delete outputs[ o ].pSink;
+        SafeRelease( &outputs[ o ].pWriter );
+
+        if ( FAILED( results[ o ] ) )
+        {
+            printf( "\nerror %x finalizing %ws\n", results[ o ], outputs[ o ].pwcPath );
+            pResult->hr = results[ o ];
+        }
+        else if ( encode )
+            printf( "\nVideo creation complete: %ws\n", outputs[ o ].pwcPath );
+    }
+
+    if ( SUCCEEDED( hrCo ) )
+        CoUninitialize();
+} //FinalizeOutputs
+
+extern "C" int __cdecl wmain( int argc, WCHAR * argv[] )
+{
+    CPerfTime perfApp;
+    LONGLONG startTime = perfApp.TimeNow();
+
+    _set_se_translator([](unsigned int u, EXCEPTION_POINTERS *pExp)
+    {
+        printf( "translating exception %x\n", u );
+        std::string error = "SE Exception: ";
+        switch (u)
+        {
+            case 0xC0000005:
+                error += "Access Violation";
+                break;
+            default:
+                char result[11];
+                sprintf_s(result, 11, "0x%08X", u);
+                error += result;
+        };
+
+        printf( "throwing std::exception\n" );
+    
+        throw std::exception(error.c_str());
+    });
 
-    int frameStride = StrideInBytes( g_width, ALL_BPP );
+    tracer.Enable( false, L"cv.txt", true );
+
+    ParseArguments( argc, argv, false );
+
+    bool encode = ( sinkMF == g_sink ) && !g_decode_only;
+
+    // Each job is one video. Without a job file the command line is the only job.
 
-    byte ** frame_batch = new byte * [ g_parallelism ];
-    ZeroMemory( frame_batch, sizeof (byte *) * g_parallelism );
+    vector<JobSettings> jobs;
 
-    Bitmap ** frame_bitmap_batch = new Bitmap * [ g_parallelism ];
-    ZeroMemory( frame_bitmap_batch, sizeof (Bitmap *) * g_parallelism );
+    if ( 0 != g_jobs_file[ 0 ] )
+    {
+        if ( 0 != g_input_spec[ 0 ] || 0 != g_input_text_file[ 0 ] || 0 != g_output_file[ 0 ] )
+        {
+            printf( "with --jobs, inputs and outputs come from the job file\n\n" );
+            Usage();
+        }
+
+        LoadJobs( jobs, encode );
+    }
+    else
+    {
+        CheckArguments( encode );
+        jobs.resize( 1 );
+        jobs[ 0 ].Capture();
+    }
+
+    // Both metadata parsing (for capture-date sorting) and decoding read through mapped views unless --io:read
+
+    CMappedFile::Enable( g_io_map );
+    captioner.UsePixelBytes( PixelBytes() );
+    stageCounters.Enable( g_counters );
+
+    // Shared by all jobs: enumerated inputs (with their capture dates once loaded) and frame pools by frame size.
+    // Inputs are found up front so a bad job fails before any video is rendered.
+
+    map<wstring, unique_ptr<CPathArray>> inputCache;
+    map<size_t, unique_ptr<CFramePool>> framePools;
+    vector<JobResult> results( jobs.size() );
+    LONGLONG totalImages = 0;
+    LONGLONG plannedImages = 0;
+
+    for ( size_t j = 0; j < jobs.size(); j++ )
+    {
+        jobs[ j ].Apply();
+        plannedImages += FindInputs( inputCache ).Count();
+    }
 
-    HANDLE *frame_event_batch = new HANDLE[ g_parallelism ];
-    ZeroMemory( frame_event_batch, sizeof( HANDLE ) * g_parallelism );
+    for ( auto & entry : inputCache )
+        memoryTags.Add( memTagMetadata, (long long) entry.second->Bytes() );
+
+    arena.Bypass( !g_arena );
+    arena.SetMaxCachedBytes( g_arena_cache_mb * 1024 * 1024 );
+
+    if ( g_large_pages && !arena.EnableLargePages() )
+        printf( "large pages aren't available; the Lock pages in memory privilege is required. Using regular pages\n" );
+
+    CVideoSink::Stats sinkStats = {};
 
     LONGLONG totalLoadTime = 0;
     LONGLONG totalReadRotateTime = 0;
@@ -1261,9 +1944,132 @@ extern "C" int __cdecl wmain( int argc, WCHAR * argv[] )
     LONGLONG totalRotateTime = 0;
     LONGLONG totalFlipTime = 0;
     LONGLONG totalFitTime = 0;
+    LONGLONG totalCaptionTime = 0;
+    LONGLONG totalRenditionTime = 0;  // composing renditions from the decoded image, including their captions and flips
+    LONGLONG totalSynthTime = 0;    // pan and zoom frames sampled from canvases (part of frame time)
+    LONGLONG totalSynthFrames = 0;
+    LONGLONG totalDecodedBytes = 0;   // pixels out of the load stage
+    LONGLONG pipelineTime = 0;        // per job from the first image through the last write, before finalizing
     LONGLONG totalWaitTime = 0;
     LONGLONG totalFrameTime = 0;
+    LONGLONG totalHashTime = 0;       // perceptual hashes for /u, part of load
+    LONGLONG totalSkipped = 0;        // near-duplicate images /u didn't compose or write
     LONGLONG totalFinalizeTime = 0;
+    LONGLONG totalDecodedByPath = 0;  // images WIC opened and read itself, because they weren't in memory or mapped
+    LONGLONG totalBytesCopied = 0;  // image bytes copied between decoding and the frame (rotation and fitting)
+
+    // Batch item i's frame comes from node ( i % count of nodes ). Its image is decoded by a worker pinned to that node,
+    // so the decode scratch buffers (allocated by that worker) land on the same node. -1 means no NUMA placement.
+
+    vector<int> nodeIds;
+    CTopology topology;
+
+    if ( g_pin )
+    {
+        topology.Detect();
+
+        if ( 0 == g_pin_nodes.size() )
+            for ( size_t n = 0; n < topology.Nodes().size(); n++ )
+                g_pin_nodes.push_back( topology.Nodes()[ n ].id );
+
+        vector<vector<int>> nodeCpus;
+
+        for ( size_t i = 0; i < g_pin_nodes.size(); i++ )
+        {
+            int n = topology.FindNode( g_pin_nodes[ i ] );
+
+            if ( -1 == n )
+            {
+                printf( "NUMA node %d doesn't exist on this machine\n\n", g_pin_nodes[ i ] );
+                Usage();
+            }
+
+            nodeIds.push_back( topology.Nodes()[ n ].id );
+            nodeCpus.push_back( topology.Nodes()[ n ].cpus );
+        }
+
+        printf( "pinning workers to %zd of %zd NUMA nodes; %zd L3 cache domains\n", nodeIds.size(), topology.Nodes().size(), topology.L3Domains().size() );
+        scheduler.PinToNodes( nodeCpus );
+    }
+
+    // Per-node image counts and time spent loading and composing, indexed by node with "unpinned" last
+
+    int statNodes = (int) nodeIds.size() + 1;
+    vector<LONGLONG> nodeImages( statNodes, 0 );
+    vector<LONGLONG> nodeBusyTime( statNodes, 0 );
+
+    // One pool of workers for images and the work within them. The calling thread is a worker too.
+
+    scheduler.Start( 0 );
+
+    // Reads files ahead of the decoders, in the order they'll be written
+
+    CReadAhead readAhead( g_read_ahead_files, g_read_ahead_mb * 1024 * 1024 );
+
+    // With --status, a background thread rewrites the status file from counters the workers already keep.
+    // The workers only add a relaxed increment of imagesDone, made while they hold the write lock anyway.
+    // Utilization is each stage's share of the -p image slots over the last interval; a stage is counted when it ends.
+
+    struct StatusStage
+    {
+        const char * name;
+        LONGLONG * total;
+        LONGLONG last;
+    };
+
+    StatusStage statusStages[] = { { "load", &totalLoadTime, 0 }, { "readRotate", &totalReadRotateTime, 0 }, { "resize", &totalResizeTime, 0 },
+                                   { "rotate", &totalRotateTime, 0 }, { "hash", &totalHashTime, 0 }, { "fit", &totalFitTime, 0 },
+                                   { "caption", &totalCaptionTime, 0 }, { "flip", &totalFlipTime, 0 }, { "renditions", &totalRenditionTime, 0 },
+                                   { "wait", &totalWaitTime, 0 }, { "frame", &totalFrameTime, 0 } };
+    LONGLONG statusLastTime = perfApp.TimeNow();
+    atomic<LONGLONG> imagesDone( 0 );
+    atomic<int> statusJob( 0 );
+    atomic<CFramePool *> statusPool( NULL );   // the current job's main video pool. Its frames are in flight to the encoder
+    CStatusFile status( g_status_file, g_status_ms );
+
+    if ( 0 != g_status_file[ 0 ] )
+    {
+        status.Start( [&] ( string & fields ) -> CStatusFile::Progress
+        {
+            LONGLONG now = perfApp.TimeNow();
+            LONGLONG slots = (LONGLONG) g_parallelism * ( now - statusLastTime );
+            string busy = "{";
+
+            for ( size_t s = 0; s < _countof( statusStages ); s++ )
+            {
+                LONGLONG total = ReadNoFence64( statusStages[ s ].total );
+                char ac[ 64 ];
+                sprintf_s( ac, _countof( ac ), "%s \"%s\": %.3f", ( 0 == s ) ? "" : ",", statusStages[ s ].name,
+                           ( slots <= 0 ) ? 0.0 : (double) ( total - statusStages[ s ].last ) / (double) slots );
+                busy += ac;
+                statusStages[ s ].last = total;
+            }
+
+            busy += " }";
+            statusLastTime = now;
+
+            CBufferArena::Stats arenaStats = arena.GetStats();
+            CFramePool * pool = statusPool;
+
+            CStatusFile::Field( fields, "job", statusJob.load() );
+            CStatusFile::Field( fields, "jobs", (LONGLONG) jobs.size() );
+            CStatusFile::Field( fields, "imagesSkipped", ReadNoFence64( &totalSkipped ) );
+            CStatusFile::FieldRaw( fields, "utilization", busy.c_str() );
+            CStatusFile::Field( fields, "bytesInUse", arenaStats.bytesInUse );
+            CStatusFile::Field( fields, "peakBytesInUse", arenaStats.peakBytesInUse );
+            CStatusFile::Field( fields, "framesInFlight", ( NULL == pool ) ? 0 : pool->GetStats().outstanding );
+            CStatusFile::Field( fields, "taggedBytes", memoryTags.Bytes() );
+            CStatusFile::Field( fields, "taggedPeakBytes", memoryTags.PeakBytes() );
+
+            string dominant = "\"";
+            dominant += CMemoryTags::Name( memoryTags.DominantAtPeak() );
+            dominant += "\"";
+            CStatusFile::FieldRaw( fields, "peakDominatedBy", dominant.c_str() );
+
+            CStatusFile::Progress progress = { imagesDone.load(), plannedImages };
+            return progress;
+        } );
+    }
 
     try
     {
@@ -1282,59 +2088,260 @@ extern "C" int __cdecl wmain( int argc, WCHAR * argv[] )
                     }
                 #endif
 
-                IMFSinkWriter *pSinkWriter = NULL;
-                DWORD stream;
-    
                 ULONG_PTR gdiplusToken = 0;
-                hr = InitializeSinkWriter(&pSinkWriter, &stream, g_output_file );
-                if ( SUCCEEDED( hr ) )
+                GdiplusStartupInput si;
+                GdiplusStartup( &gdiplusToken, &si, NULL );
+
+                thread finalizer; // finishes the previous job's videos while the next job renders
+
+                for ( size_t j = 0; SUCCEEDED( hr ) && ( j < jobs.size() ); j++ )
                 {
-                    GdiplusStartupInput si;
-                    GdiplusStartup( &gdiplusToken, &si, NULL );
-    
-                    for ( int i = 0; i < g_parallelism; i++ )
+                    jobs[ j ].Apply();
+                    JobResult & result = results[ j ];
+                    CPathArray & paths = FindInputs( inputCache );
+                    bool preserveFileOrder = SortInputs( paths );
+
+                    // The main video and its renditions. Each has its own encoder and frame pool.
+                    // Frames are composed in place in pooled buffers and handed to the encoder without a copy.
+                    // They return to the pool when the encoder is done with them, which may be while the next job renders.
+
+                    vector<VideoOutput> outputs( 1 + jobs[ j ].renditions.size() );
+                    outputs[ 0 ].width = g_width;
+                    outputs[ 0 ].height = g_height;
+                    outputs[ 0 ].bitRate = g_video_bit_rate;
+                    outputs[ 0 ].pwcPath = jobs[ j ].outputFile;
+
+                    for ( size_t r = 0; r < jobs[ j ].renditions.size(); r++ )
                     {
-                        frame_batch[ i ] = new byte[ frameStride * g_height ];
-                        frame_bitmap_batch[ i ] = new Bitmap( g_width, g_height, frameStride, PixelFormat24bppRGB, frame_batch[ i ] );
-                        frame_event_batch[ i ] = CreateEvent( NULL, FALSE, FALSE, NULL );
+                        const Rendition & rendition = jobs[ j ].renditions[ r ];
+                        VideoOutput & o = outputs[ 1 + r ];
+                        o.width = rendition.width;
+                        o.height = rendition.height;
+                        o.pwcPath = rendition.output;
+
+                        // Without a bitrate, a rendition gets the main bitrate scaled by its share of the pixels
+
+                        o.bitRate = ( 0 != rendition.bitRate ) ? rendition.bitRate :
+                                    (UINT32) ( (double) g_video_bit_rate * ( (double) o.width * o.height ) / ( (double) g_width * g_height ) );
                     }
-    
+
+                    // With renditions, each image is decoded once, large enough for the biggest of them, and every
+                    // video's frame is scaled from that. Cropping keeps all of the image so each aspect ratio can be cut from it.
+
+                    int decodeW = 0, decodeH = 0;
+
+                    for ( size_t o = 0; o < outputs.size(); o++ )
+                    {
+                        decodeW = __max( decodeW, (int) outputs[ o ].width );
+                        decodeH = __max( decodeH, (int) outputs[ o ].height );
+                    }
+
+                    #ifdef USE_WIC_FOR_OPEN
+                        wic2gdi.UseResampler( g_resample );
+                        wic2gdi.UseCrop( ( fitCrop == g_fit ) && ( 1 == outputs.size() ) );
+                        wic2gdi.UseCover( ( fitCrop == g_fit ) && ( outputs.size() > 1 ) );
+                    #endif
+
+                    for ( size_t o = 0; o < outputs.size(); o++ )
+                    {
+                        outputs[ o ].stride = StrideInBytes( outputs[ o ].width, g_bpp );
+                        size_t frameBytes = (size_t) outputs[ o ].stride * outputs[ o ].height;
+                        unique_ptr<CFramePool> & pool = framePools[ frameBytes ];
+                        if ( NULL == pool.get() )
+                            pool.reset( new CFramePool( frameBytes ) );
+                        outputs[ o ].pool = pool.get();
+                    }
+
+                    int frameStride = outputs[ 0 ].stride;
+                    CFramePool & framePool = *outputs[ 0 ].pool;
+                    statusPool = &framePool;
+                    statusJob = (int) j + 1;
+
+                    if ( jobs.size() > 1 )
+                        printf( "\njob %zd of %zd: %zd images at %u x %u to %ws\n", j + 1, jobs.size(), paths.Count(), g_width, g_height,
+                                encode ? outputs[ 0 ].pwcPath : L"(not encoded)" );
+
+                    for ( size_t o = 0; SUCCEEDED( hr ) && ( o < outputs.size() ); o++ )
+                    {
+                        DWORD stream;
+
+                        if ( encode )
+                            hr = InitializeSinkWriter( &outputs[ o ].pWriter, &stream, outputs[ o ].pwcPath, outputs[ o ].width,
+                                                       outputs[ o ].height, outputs[ o ].bitRate );
+
+                        if ( FAILED( hr ) )
+                            printf( "error %x initializing sink writer for %ws\n", hr, outputs[ o ].pwcPath );
+                        else if ( encode )
+                            outputs[ o ].pSink = new CMFVideoSink( outputs[ o ].pWriter, stream );
+                        else
+                            outputs[ o ].pSink = new CNullVideoSink();
+
+                        if ( SUCCEEDED( hr ) && ( 0 != g_fmp4_seconds ) )
+                            outputs[ o ].pSink->UseFragments( (LONGLONG) g_fmp4_seconds * 1000 * VIDEO_UNITS_PER_MS );
+                    }
+
+                    if ( FAILED( hr ) )
+                    {
+                        for ( size_t o = 0; o < outputs.size(); o++ )
+                        {
+                            delete outputs[ o ].pSink;
+                            SafeRelease( &outputs[ o ].pWriter );
+                        }
+
+                        result.hr = hr;
+                        break;
+                    }
+
+                    #ifdef USE_WIC_FOR_OPEN
+                        if ( 0 != g_read_ahead_files )
+                        {
+                            vector<const WCHAR *> readOrder( paths.Count() );
+                            for ( size_t i = 0; i < paths.Count(); i++ )
+                                readOrder[ i ] = paths.Get( i );
+
+                            readAhead.Start( readOrder );
+                        }
+                    #endif
+
+                    CVideoSink & sink = *outputs[ 0 ].pSink;
                     LONGLONG duration = ( g_ms_delay * 1000 * 10 );
                     int iframe = 0;
+                    int written = 0;  // images written, which time the frames. Behind iframe when /u skips images
+                    LONGLONG pipelineStart = perfApp.TimeNow();
+
+                    // With /u, each image's hash, and whether it's been computed: 0 not yet, 1 hashed, 2 couldn't be hashed
+
+                    vector<uint64_t> imageHashes;
+                    unique_ptr<atomic<int>[]> hashStates;
+
+                    if ( g_burst_distance >= 0 )
+                    {
+                        imageHashes.resize( paths.Count() );
+                        hashStates.reset( new atomic<int>[ paths.Count() ] );
+
+                        for ( size_t i = 0; i < paths.Count(); i++ )
+                            hashStates[ i ] = 0;
+                    }
+
                     while ( iframe < paths.Count() )
                     {
                         int batchsize = __min( g_parallelism, ( paths.Count() - iframe ) );
                         int batchBaseFrame = iframe;
+                        atomic<int> turn( 0 ); // in the preserveFileOrder case, the item in the batch allowed to write next
     
-                        parallel_for ( int(0), int(batchsize), [&]( int item )
+                        // Images are scheduler tasks. Their row-block subtasks (rotate, flip, transitions) share the same workers,
+                        // and an image waiting for its turn to write helps finish the others rather than sitting idle.
+
+                        scheduler.ForRange( 0, batchsize, 1, [&]( int item, int /*itemEnd*/ )
                         {
                             try
                             {
-                                // Give priority to threads encoding finished frames, so they don't sit around consuming RAM
-                                // Let the first of the batch finish first, so other frames wait less
+                                CPerfTime perfLoop;
+                                LONGLONG imageStart = perfLoop.TimeNow();
+                                CStageClock stageClock( stageCounters );
+
+                                int node = ( 0 == nodeIds.size() ) ? -1 : nodeIds[ item % nodeIds.size() ];
+
+                                // The image is composed into the canvas: the video frame itself, or with pan and zoom a larger
+                                // buffer that every frame of this image is later sampled from.
 
-                                if ( preserveFileOrder && ( 0 == item ) )
-                                    SetThreadPriority( GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL );
+                                unique_ptr<CFrame, FrameReleaser> frame;
+                                unique_ptr<byte, ArenaDeleter> canvasBuffer;
+                                int canvasW = g_width, canvasH = g_height, canvasStride = frameStride;
+                                byte * canvas = NULL;
+
+                                if ( 0 != g_kenburns )
+                                {
+                                    canvasW = ( g_width * g_kenburns + 50 ) / 100;
+                                    canvasH = ( g_height * g_kenburns + 50 ) / 100;
+                                    canvasStride = StrideInBytes( canvasW, g_bpp );
+                                    canvasBuffer.reset( (byte *) arena.Alloc( (size_t) canvasStride * canvasH, memTagCanvas ) );
+                                    canvas = canvasBuffer.get();
+                                }
                                 else
-                                    SetThreadPriority( GetCurrentThread(), THREAD_PRIORITY_LOWEST );
+                                {
+                                    frame.reset( framePool.Acquire( node ) );
+                                    canvas = frame ? frame->Bits() : NULL;
+                                }
 
-                                CPerfTime perfLoop;
+                                if ( NULL == canvas )
+                                {
+                                    printf( "out of memory allocating a video frame\n" );
+                                    exit( 1 );
+                                }
+
+                                unique_ptr<Bitmap> frameBitmap( new Bitmap( canvasW, canvasH, canvasStride, GdipPixelFormat(), canvas ) );
+
+                                bool placed = false; // true if the image was decoded straight into the frame at placedRect
+                                Rect placedRect;
 
                                 #ifdef USE_WIC_FOR_OPEN // loading via WIC is much faster because scaling is done during decompression
                                     int aWidth, aHeight;
-                                    int targetW = frame_bitmap_batch[ item ]->GetWidth();
-                                    int targetH = frame_bitmap_batch[ item ]->GetHeight();
+                                    int targetW = frameBitmap->GetWidth();
+                                    int targetH = frameBitmap->GetHeight();
                                     byte * pbuffer = 0;
-                                    unique_ptr<Bitmap> bitmap( wic2gdi.GDIPBitmapFromWIC( paths.Get( batchBaseFrame + item ), 0, &pbuffer,
-                                                                                          targetW, targetH, &aWidth, &aHeight, PixelFormat24bppRGB ) );
-                                    unique_ptr<byte> bitmap_buffer( pbuffer );
+                                    unique_ptr<byte, ArenaDeleter> bitmap_buffer; // declared first so it's freed after the bitmap
+                                    CWic2Gdi::DecodeTarget target( canvas, canvasW, canvasH, canvasStride );
+
+                                    // Renditions need the decoded image, so it's only placed straight in the frame without them
+
+                                    if ( outputs.size() > 1 )
+                                    {
+                                        targetW = decodeW;
+                                        targetH = decodeH;
+                                    }
+
+                                    // With read-ahead the file is usually in memory already. Otherwise a file on a local fixed drive is
+                                    // mapped, so it's opened once and WIC reads it from the view. If neither works, WIC opens it by path.
+
+                                    size_t index = batchBaseFrame + item;
+                                    const byte * pRead = NULL;
+                                    size_t cbRead = 0;
+                                    IStream * pStream = NULL;
+                                    unique_ptr<CMappedFile> mapped;
+
+                                    if ( 0 != g_read_ahead_files && readAhead.Acquire( index, pRead, cbRead ) )
+                                        pStream = wic2gdi.CreateMemoryStream( (byte *) pRead, (DWORD) cbRead );
+                                    else
+                                    {
+                                        mapped.reset( new CMappedFile( paths.Get( index ) ) );
+
+                                        if ( mapped->Ok() && mapped->Size() <= MAXDWORD )
+                                            pStream = wic2gdi.CreateMemoryStream( (byte *) mapped->Data(), (DWORD) mapped->Size() );
+                                    }
+
+                                    if ( NULL == pStream )
+                                        InterlockedIncrement64( &totalDecodedByPath );
+
+                                    unique_ptr<Bitmap> bitmap( wic2gdi.GDIPBitmapFromWIC( pStream ? NULL : paths.Get( index ), pStream, &pbuffer,
+                                                                                          targetW, targetH, &aWidth, &aHeight, GdipPixelFormat(),
+                                                                                          ( 1 == outputs.size() ) ? &target : NULL ) );
+                                    bitmap_buffer.reset( pbuffer );
+
+                                    if ( pStream )
+                                        pStream->Release();
+
+                                    mapped.reset();
+
+                                    if ( 0 != g_read_ahead_files )
+                                        readAhead.Release( index );
+
                                     perfLoop.CumulateSince( totalLoadTime );
+
+                                    placed = target.placed;
+                                    placedRect = Rect( target.imageX, target.imageY, target.imageW, target.imageH );
+                                    InterlockedExchangeAdd64( &totalBytesCopied, target.bytesCopied );
     
-                                    if ( NULL == bitmap.get() || 0 == bitmap->GetWidth() )
+                                    if ( !placed && ( NULL == bitmap.get() || 0 == bitmap->GetWidth() ) )
                                     {
                                         printf( "error, can't open file %ws\n", paths.Get( batchBaseFrame + item ) );
                                         exit( 1 );
                                     }
+
+                                    LONGLONG decodedBytes = placed ? (LONGLONG) target.imageW * target.imageH * PixelBytes() :
+                                                                     (LONGLONG) bitmap->GetWidth() * bitmap->GetHeight() * PixelBytes();
+                                    InterlockedExchangeAdd64( &totalDecodedBytes, decodedBytes );
+                                    stageClock.Mark( stageLoad, decodedBytes );
                                 #else
                                     unique_ptr<Bitmap> bitmap( new Bitmap( paths.Get( batchBaseFrame + item ), FALSE ) );
                                     perfLoop.CumulateSince( totalLoadTime );
@@ -1344,46 +2351,169 @@ extern "C" int __cdecl wmain( int argc, WCHAR * argv[] )
                                         printf( "error, can't open file %ws\n", paths.Get( batchBaseFrame + item ) );
                                         exit( 1 );
                                     }
+
+                                    InterlockedExchangeAdd64( &totalDecodedBytes, (LONGLONG) bitmap->GetWidth() * bitmap->GetHeight() * PixelBytes() );
+                                    stageClock.Mark( stageLoad, (LONGLONG) bitmap->GetWidth() * bitmap->GetHeight() * PixelBytes() );
             
                                     int val = ExifRotateValue( *bitmap );
                                     bool invertWH = ( val >= 5 && val <= 8 );
                                     perfLoop.CumulateSince( totalReadRotateTime );
             
                                     int eventualW, eventualH;
-                                    ComputeEventualSize( eventualW, eventualH, *frame_bitmap_batch[ item ], *bitmap, invertWH );
+                                    ComputeEventualSize( eventualW, eventualH, *frameBitmap, *bitmap, invertWH );
                                     bitmap.reset( ResizeBitmap( bitmap.get(), eventualW, eventualH ) );
     
                                     perfLoop.CumulateSince( totalResizeTime );
             
                                     if ( 6 == val )
+                                    {
                                         bitmap.reset( Rotate90( *bitmap ) ); // 4.7 times faster than ExifRotate!
+                                        InterlockedExchangeAdd64( &totalBytesCopied, (LONGLONG) bitmap->GetWidth() * bitmap->GetHeight() * PixelBytes() );
+                                    }
                                     else
                                         ExifRotate( *bitmap, val, FALSE );
     
                                     perfLoop.CumulateSince( totalRotateTime );
+                                    stageClock.Mark( stageRotate, (LONGLONG) bitmap->GetWidth() * bitmap->GetHeight() * PixelBytes() );
                                 #endif
 
-                                FitBitmapInFrame( *frame_bitmap_batch[ item ], *bitmap );
-                                perfLoop.CumulateSince( totalFitTime );
+                                // /u skips an image that looks like the one before it, before it's composed or encoded. The hash
+                                // comes from the already-scaled decode; images decode in parallel, so the previous one's hash may
+                                // still be on its way.
+
+                                bool skip = false;
+
+                                if ( g_burst_distance >= 0 )
+                                {
+                                    size_t imageIndex = batchBaseFrame + item;
+                                    uint64_t hash = 0;
+                                    bool hashed = HashDecodedImage( placed, canvas, canvasStride, placedRect, bitmap.get(), hash );
+                                    imageHashes[ imageIndex ] = hash;
+                                    hashStates[ imageIndex ] = hashed ? 1 : 2;
+                                    perfLoop.CumulateSince( totalHashTime );
+                                    stageClock.Mark( stageHash );
+
+                                    if ( hashed && 0 != imageIndex )
+                                    {
+                                        scheduler.HelpUntil( [&] { return 0 != hashStates[ imageIndex - 1 ]; } );
+                                        skip = ( 1 == hashStates[ imageIndex - 1 ] ) &&
+                                               ( CPerceptualHash::Distance( hash, imageHashes[ imageIndex - 1 ] ) <= g_burst_distance );
+                                        perfLoop.CumulateSince( totalWaitTime );
+                                        stageClock.Mark( stageWait );
+                                    }
+                                }
+
+                                // --decode-only measures just the load stage
 
-                                if ( g_captions )
-                                    DrawCaption( *frame_bitmap_batch[ item ], paths.Get( batchBaseFrame + item ) );
+                                if ( !g_decode_only && !skip )
+                                {
+                                    if ( placed )
+                                    {
+                                        DispatchPixel( PixelBytes(), [&] ( auto pixel )
+                                        {
+                                            if ( fitBlur == g_fit )
+                                                CCompositor::BlurBars<decltype( pixel )>( canvas, canvasW, canvasH, canvasStride, placedRect.X, placedRect.Y,
+                                                                                          placedRect.Width, placedRect.Height );
+                                            else
+                                                CCompositor::FillBars<decltype( pixel )>( canvas, canvasW, canvasH, canvasStride, placedRect.X, placedRect.Y,
+                                                                                          placedRect.Width, placedRect.Height, g_fill_red, g_fill_green, g_fill_blue );
+                                        } );
+                                    }
+                                    else
+                                    {
+                                        FitBitmapInFrame( *frameBitmap, *bitmap );
+                                        InterlockedExchangeAdd64( &totalBytesCopied, (LONGLONG) bitmap->GetWidth() * bitmap->GetHeight() * PixelBytes() );
+                                    }
 
-                                // FlipY is 15x faster than bitmap->RotateFlip( RotateNoneFlipY );
+                                    perfLoop.CumulateSince( totalFitTime );
+                                    stageClock.Mark( stageFit, (LONGLONG) canvasStride * canvasH );
+
+                                    // With pan and zoom, captions and flipping happen as each frame is sampled from the canvas
+
+                                    if ( 0 == g_kenburns )
+                                    {
+                                        if ( g_captions )
+                                        {
+                                            DrawCaption( frame->Bits(), g_width, g_height, frameStride, paths.Get( batchBaseFrame + item ) );
+                                            perfLoop.CumulateSince( totalCaptionTime );
+                                            stageClock.Mark( stageCaption );
+                                        }
 
-                                FlipY( *frame_bitmap_batch[ item ] );
+                                        // FlipY is 15x faster than bitmap->RotateFlip( RotateNoneFlipY );
+
+                                        FlipY( *frameBitmap );
+                                    }
+                                }
+
+                                frameBitmap.reset();
                                 perfLoop.CumulateSince( totalFlipTime );
+                                stageClock.Mark( stageFlip, ( g_decode_only || skip || 0 != g_kenburns ) ? 0 : (LONGLONG) frameStride * g_height );
+
+                                // Renditions are scaled from the same decoded image, each into a frame from its own pool
+
+                                vector<unique_ptr<CFrame, FrameReleaser>> renditionFrames( outputs.size() );
+                                LONGLONG renditionBytes = 0;
+
+                                for ( size_t r = 1; r < outputs.size(); r++ )
+                                    renditionBytes += (LONGLONG) outputs[ r ].stride * outputs[ r ].height;
+
+                                if ( !g_decode_only && !skip )
+                                {
+                                    for ( size_t r = 1; r < outputs.size(); r++ )
+                                    {
+                                        const VideoOutput & o = outputs[ r ];
+                                        renditionFrames[ r ].reset( o.pool->Acquire( node ) );
+
+                                        if ( NULL == renditionFrames[ r ].get() )
+                                        {
+                                            printf( "out of memory allocating a video frame\n" );
+                                            exit( 1 );
+                                        }
+
+                                        Bitmap renditionBitmap( o.width, o.height, o.stride, GdipPixelFormat(), renditionFrames[ r ]->Bits() );
+                                        FitBitmapInFrame( renditionBitmap, *bitmap );
+
+                                        if ( g_captions )
+                                            DrawCaption( renditionFrames[ r ]->Bits(), o.width, o.height, o.stride, paths.Get( batchBaseFrame + item ) );
+
+                                        FlipY( renditionBitmap );
+                                    }
+
+                                    perfLoop.CumulateSince( totalRenditionTime );
+
+                                    if ( outputs.size() > 1 )
+                                        stageClock.Mark( stageRenditions, renditionBytes );
+                                }
         
+                                int statNode = ( -1 == CTaskScheduler::CurrentNode() ) ? ( statNodes - 1 ) : CTaskScheduler::CurrentNode();
+                                InterlockedIncrement64( &nodeImages[ statNode ] );
+                                InterlockedExchangeAdd64( &nodeBusyTime[ statNode ], perfLoop.Since( imageStart ) );
+
                                 if ( preserveFileOrder && ( 0 != item ) )
-                                    WaitForSingleObject( frame_event_batch[ item - 1 ], INFINITE );
+                                    scheduler.HelpUntil( [&] { return item == turn; } );
 
-                                // In the preserveFileOrder case, taking this lock is redundant because events make the code single-threaded. But it doesn't hurt.
+                                // In the preserveFileOrder case, taking this lock is redundant because turns make the code single-threaded. But it doesn't hurt.
 
-                                lock_guard<mutex> lock( g_mtx );
+                                scheduler.HelpUntil( [&] { return g_mtx.try_lock(); } );
+                                lock_guard<mutex> lock( g_mtx, adopt_lock );
 
                                 perfLoop.CumulateSince( totalWaitTime ); // total of waiting for an (optinal) event and the lock
+                                stageClock.Mark( stageWait );
 
-                                hr = WriteTransitionFrame( pSinkWriter, stream, (LONGLONG) iframe * (LONGLONG) duration, duration, frame_batch[ item ], g_transition, g_ms_transition_effect );
+                                if ( g_decode_only || skip )
+                                    hr = S_OK;
+                                else if ( 0 != g_kenburns )
+                                    hr = WriteKenBurnsFrames( sink, framePool, (LONGLONG) written * (LONGLONG) duration, duration, canvas, canvasW, canvasH, canvasStride,
+                                                              iframe, node, paths.Get( batchBaseFrame + item ), totalSynthTime, totalSynthFrames );
+                                else
+                                {
+                                    LONGLONG start = (LONGLONG) written * (LONGLONG) duration;
+                                    hr = WriteTransitionFrame( sink, framePool, start, duration, frame.get(), g_width, g_height, g_transition, g_ms_transition_effect );
+
+                                    for ( size_t r = 1; SUCCEEDED( hr ) && ( r < outputs.size() ); r++ )
+                                        hr = WriteTransitionFrame( *outputs[ r ].pSink, *outputs[ r ].pool, start, duration, renditionFrames[ r ].get(),
+                                                                   outputs[ r ].width, outputs[ r ].height, g_transition, g_ms_transition_effect );
+                                }
                                 if (FAILED(hr))
                                 {
                                     printf( "can't write frame: %x\n", hr );
@@ -1391,16 +2521,26 @@ extern "C" int __cdecl wmain( int argc, WCHAR * argv[] )
                                 }
     
                                 iframe++;
+                                imagesDone.fetch_add( 1, memory_order_relaxed );
+
+                                if ( skip )
+                                    totalSkipped++;
+                                else
+                                    written++;
     
                                 if ( 0 == ( iframe % 50 ) )
                                     printf( "\n%d files completed", iframe );
                                 else
-                                    printf( "." );
+                                    printf( skip ? "-" : "." );
     
                                 perfLoop.CumulateSince( totalFrameTime );
+                                stageClock.Mark( stageFrame, ( g_decode_only || skip ) ? 0 : (LONGLONG) frameStride * g_height + renditionBytes );
 
                                 if ( preserveFileOrder && ( item != ( batchsize - 1 ) ) )
-                                    SetEvent( frame_event_batch[ item ] );
+                                {
+                                    turn = item + 1;
+                                    scheduler.Notify();
+                                }
                             }
                             catch( std::exception & ex )
                             {
@@ -1412,68 +2552,44 @@ extern "C" int __cdecl wmain( int argc, WCHAR * argv[] )
                                 printf( "caught a generic exception processing an image; exiting\n" );
                                 exit( -1 );
                             }
-                        });
+                        }, CTaskScheduler::levelImage, [] ( int item ) { return item; } );
                     }
-                }
-                else
-                {
-                    printf( "error %x initializing sink writer\n", hr );
-                }
 
-                CPerfTime finalizeTimer;
+                    readAhead.Stop();
+                    result.images = paths.Count();
+                    result.pipelineTime = perfApp.Since( pipelineStart );
+                    totalImages += result.images;
+                    pipelineTime += result.pipelineTime;
 
-                if ( SUCCEEDED( hr ) )
-                {
-                    printf( "\ncalling finalize() to finish compressing and writing the video...\n" );
-                    hr = pSinkWriter->Finalize();
+                    // Finalizing drains the encoder and mostly waits on it, so it runs while the next job renders.
+                    // Only one finalize is outstanding at a time, which bounds the frames held by encoders.
+
+                    if ( finalizer.joinable() )
+                        finalizer.join();
+
+                    if ( encode )
+                        printf( "\ncalling finalize() to finish compressing and writing the video...\n" );
+
+                    finalizer = thread( FinalizeOutputs, outputs, encode, &result );
                 }
 
-                finalizeTimer.CumulateSince( totalFinalizeTime );
-    
-                SafeRelease( &pSinkWriter );
+                if ( finalizer.joinable() )
+                    finalizer.join();
 
-                // Free resources
+                status.Stop();
 
+                for ( size_t j = 0; j < results.size(); j++ )
                 {
-                    if ( 0 != frame_batch )
-                    {
-                        for ( int i = 0; i < g_parallelism; i++ )
-                        {
-                            delete frame_batch[ i ];
-                            frame_batch[ i ] = NULL;
-                        }
-                
-                        delete frame_batch;
-                    }
-                
-                    if ( 0 != frame_bitmap_batch )
-                    {
-                        for ( int i = 0; i < g_parallelism; i++ )
-                        {
-                            delete frame_bitmap_batch[ i ];
-                            frame_bitmap_batch[ i ] = NULL;
-                        }
-                
-                        delete frame_bitmap_batch;
-                    }
-                
-                    if ( 0 != frame_event_batch )
-                    {
-                        for ( int i = 0; i < g_parallelism; i++ )
-                        {
-                            if ( 0 != frame_event_batch[ i ] )
-                            {
-                                CloseHandle( frame_event_batch[ i ] );
-                                frame_event_batch[ i ] = 0;
-                            }
-                        }
-                
-                        delete frame_event_batch;
-                    }
-
-                    FreeTransitionFrames();
+                    totalFinalizeTime += results[ j ].finalizeTime;
+                    sinkStats.framesSubmitted += results[ j ].sinkStats.framesSubmitted;
+                    sinkStats.bytesSubmitted += results[ j ].sinkStats.bytesSubmitted;
+                    sinkStats.bytesCopied += results[ j ].sinkStats.bytesCopied;
+                    sinkStats.outOfOrder += results[ j ].sinkStats.outOfOrder;
+                    sinkStats.fragments += results[ j ].sinkStats.fragments;
                 }
-    
+
+                scheduler.Shutdown();
+
                 // GdiplusShutdown may not be needed; I think MFShutdown() does this. 
     
                 GdiplusShutdown( gdiplusToken ); 
@@ -1494,7 +2610,47 @@ extern "C" int __cdecl wmain( int argc, WCHAR * argv[] )
         exit( -1 );
     }
 
-    printf( "\nVideo creation complete: %ws\n", g_output_file );
+    if ( jobs.size() > 1 )
+    {
+        // Per-job render time is from the first image through the last write. Finalizing overlaps the next job.
+
+        printf( "\n%zd jobs\n", jobs.size() );
+
+        for ( size_t j = 0; j < jobs.size(); j++ )
+            printf( "  %3zd %7lld images %8lld frames %9lld ms render %9lld ms finalize  %ws%s\n", j + 1, results[ j ].images,
+                    results[ j ].sinkStats.framesSubmitted, perfApp.DurationToMS( results[ j ].pipelineTime ),
+                    perfApp.DurationToMS( results[ j ].finalizeTime ), encode ? jobs[ j ].outputFile : L"",
+                    FAILED( results[ j ].hr ) ? " (failed)" : "" );
+
+        double wallSeconds = (double) perfApp.DurationToMS( perfApp.Since( startTime ) ) / 1000.0;
+        printf( "  all %7lld images %8lld frames in %.2f seconds, %.1f images/sec\n", totalImages, sinkStats.framesSubmitted, wallSeconds,
+                ( wallSeconds > 0.0 ) ? (double) totalImages / wallSeconds : 0.0 );
+    }
+
+    if ( !encode )
+    {
+        // Throughput without the encoder, for capacity planning
+
+        double seconds = (double) perfApp.DurationToMS( pipelineTime ) / 1000.0;
+        if ( 0.0 == seconds )
+            seconds = 0.001;
+
+        printf( "\n%s run complete: %lld images in %.2f seconds\n", g_decode_only ? "decode-only" : "null sink", totalImages, seconds );
+        printf( "  images/sec      %14.1f\n", (double) totalImages / seconds );
+
+        if ( g_decode_only )
+            printf( "  decoded MB/s    %14.1f\n", (double) totalDecodedBytes / ( 1024.0 * 1024.0 ) / seconds );
+        else
+        {
+            printf( "  frames/sec      %14.1f\n", (double) sinkStats.framesSubmitted / seconds );
+            printf( "  frame MB/s      %14.1f\n", (double) sinkStats.bytesSubmitted / ( 1024.0 * 1024.0 ) / seconds );
+
+            if ( 0 != sinkStats.outOfOrder )
+                printf( "  out of order    %14lld frames\n", sinkStats.outOfOrder );
+        }
+    }
+
+    CReadAhead::Stats readStats = readAhead.GetStats();
 
     if ( g_stats )
     {
@@ -1507,13 +2663,111 @@ extern "C" int __cdecl wmain( int argc, WCHAR * argv[] )
         {
             printf( "peak working set  %14ws\n", perfApp.RenderLL( pmc.PeakWorkingSetSize ) );
             printf( "working set       %14ws\n", perfApp.RenderLL( pmc.WorkingSetSize ) );
+            printf( "page faults       %14ws\n", perfApp.RenderLL( pmc.PageFaultCount ) );
             printf( "\n" );
         }
     
+        CBufferArena::Stats arenaStats = arena.GetStats();
+        printf( "arena allocations %14ws\n", perfApp.RenderLL( arenaStats.allocations ) );
+        printf( "  reused          %14ws\n", perfApp.RenderLL( arenaStats.reused ) );
+        printf( "  from the OS     %14ws\n", perfApp.RenderLL( arenaStats.osAllocations ) );
+        if ( 0 != arenaStats.largePageBlocks )
+            printf( "  large pages     %14ws\n", perfApp.RenderLL( arenaStats.largePageBlocks ) );
+        printf( "  peak bytes      %14ws\n", perfApp.RenderLL( arenaStats.peakBytesInUse ) );
+        printf( "  allocator time  %14ws ms\n", perfApp.RenderLL( arenaStats.allocatorNS / 1000000 ) );
+        printf( "\n" );
+
+        // Arena blocks (including freed ones cached for reuse), pooled frames and enumerated paths by what they're for,
+        // as of the moment their total peaked.
+        // Memory held inside GDI+, WIC and the encoder isn't seen here; the working set above includes it.
+
+        printf( "memory high water %14ws\n", perfApp.RenderLL( memoryTags.PeakBytes() ) );
+
+        for ( int t = 0; t < memTagCount; t++ )
+        {
+            CMemoryTags::Stats ms = memoryTags.GetStats( t );
+
+            if ( 0 != ms.peakBytes )
+            {
+                printf( "  %-16s%14ws", CMemoryTags::Name( t ), perfApp.RenderLL( ms.bytesAtPeak ) );
+                printf( "  (own peak %ws)\n", perfApp.RenderLL( ms.peakBytes ) );
+            }
+        }
+
+        int dominant = memoryTags.DominantAtPeak();
+        printf( "  dominated by %17s   to use less, turn down %s\n", CMemoryTags::Name( dominant ), memoryKnobs[ dominant ] );
+
+        // Each time the high-water mark grew by a quarter, and what held the most then
+
+        vector<CMemoryTags::Sample> timeline = memoryTags.Timeline();
+        long long shown = 0;
+
+        for ( size_t i = 0; i < timeline.size(); i++ )
+        {
+            if ( ( timeline[ i ].bytes - shown ) >= ( shown / 4 ) || ( i == timeline.size() - 1 ) )
+            {
+                printf( "  at %10.1f sec %12ws", (double) timeline[ i ].ms / 1000.0, perfApp.RenderLL( timeline[ i ].bytes ) );
+                printf( "  %s\n", CMemoryTags::Name( timeline[ i ].dominant ) );
+                shown = timeline[ i ].bytes;
+            }
+        }
+
+        printf( "\n" );
+
+        CFramePool::Stats poolStats = {};
+        for ( auto & pool : framePools )
+        {
+            CFramePool::Stats s = pool.second->GetStats();
+            poolStats.allocated += s.allocated;
+            poolStats.reused += s.reused;
+        }
+
+        printf( "frames submitted  %14ws\n", perfApp.RenderLL( sinkStats.framesSubmitted ) );
+        printf( "  bytes copied    %14ws\n", perfApp.RenderLL( sinkStats.bytesCopied ) );
+
+        if ( 0 != g_fmp4_seconds )
+            printf( "  fragments       %14ws\n", perfApp.RenderLL( sinkStats.fragments ) );
+        printf( "  pool frames     %14ws\n", perfApp.RenderLL( poolStats.allocated ) );
+        printf( "  pool reuses     %14ws\n", perfApp.RenderLL( poolStats.reused ) );
+        printf( "image bytes copied%14ws\n", perfApp.RenderLL( totalBytesCopied ) );
+        printf( "  per image       %14ws\n", perfApp.RenderLL( ( 0 == totalImages ) ? 0 : totalBytesCopied / totalImages ) );
+        printf( "\n" );
+
+        CStream::IOCounts & ioCounts = CStream::Counts();
+        printf( "input file opens  %14ws\n", perfApp.RenderLL( ioCounts.opens + totalDecodedByPath ) );
+        printf( "  mapped          %14ws\n", perfApp.RenderLL( ioCounts.maps ) );
+        printf( "  decoded by path %14ws\n", perfApp.RenderLL( totalDecodedByPath ) );
+        printf( "  ReadFile calls  %14ws   (metadata parsing; WIC's own reads of files it opens aren't counted)\n", perfApp.RenderLL( ioCounts.reads ) );
+        printf( "  seek calls      %14ws\n", perfApp.RenderLL( ioCounts.seeks ) );
+        printf( "\n" );
+
+        if ( 0 != g_read_ahead_files )
+        {
+            double pipelineSeconds = (double) perfApp.DurationToMS( pipelineTime ) / 1000.0;
+            printf( "files read ahead  %14ws\n", perfApp.RenderLL( readStats.filesRead ) );
+            printf( "  on demand       %14ws\n", perfApp.RenderLL( readStats.filesOnDemand ) );
+            if ( 0 != readStats.filesFailed )
+                printf( "  failed          %14ws\n", perfApp.RenderLL( readStats.filesFailed ) );
+            printf( "  MB read         %14ws\n", perfApp.RenderLL( readStats.bytesRead / ( 1024 * 1024 ) ) );
+            printf( "  read MB/s       %14.1f\n", ( pipelineSeconds > 0.0 ) ? (double) readStats.bytesRead / ( 1024.0 * 1024.0 ) / pipelineSeconds : 0.0 );
+            printf( "\n" );
+        }
+
         LONGLONG elapsed = 0;
         perfApp.CumulateSince( elapsed );
         printf( "total elapsed    %15ws\n", perfApp.RenderDurationInMS( elapsed ) );
         printf( "  load           %15ws\n", perfApp.RenderDurationInMS( totalLoadTime ) );
+        if ( g_burst_distance >= 0 )
+            printf( "  hash           %15ws\n", perfApp.RenderDurationInMS( totalHashTime ) );
+        if ( 0 != g_read_ahead_files )
+        {
+            // Read-ahead separates waiting on the disk from decoding, which are otherwise both inside WIC
+
+            LONGLONG ioMS = ( readStats.waitNS + readStats.readNS ) / 1000000;
+            LONGLONG loadMS = perfApp.DurationToMS( totalLoadTime );
+            printf( "    io wait      %15ws\n", perfApp.RenderLL( ioMS ) );
+            printf( "    decode       %15ws\n", perfApp.RenderLL( ( loadMS > ioMS ) ? ( loadMS - ioMS ) : 0 ) );
+        }
         if ( 0 != totalReadRotateTime )
             printf( "  readrot        %15ws\n", perfApp.RenderDurationInMS( totalReadRotateTime ) );
         if ( 0 != totalResizeTime )
@@ -1522,13 +2776,94 @@ extern "C" int __cdecl wmain( int argc, WCHAR * argv[] )
             printf( "  rotate         %15ws\n", perfApp.RenderDurationInMS( totalRotateTime ) );
         printf( "  flip           %15ws\n", perfApp.RenderDurationInMS( totalFlipTime ) );
         printf( "  fit            %15ws\n", perfApp.RenderDurationInMS( totalFitTime ) );
+        if ( 0 != totalCaptionTime )
+            printf( "  caption        %15ws\n", perfApp.RenderDurationInMS( totalCaptionTime ) );
+        if ( 0 != totalRenditionTime )
+            printf( "  renditions     %15ws\n", perfApp.RenderDurationInMS( totalRenditionTime ) );
         printf( "  wait           %15ws\n", perfApp.RenderDurationInMS( totalWaitTime ) );
         printf( "  frame          %15ws\n", perfApp.RenderDurationInMS( totalFrameTime ) );
+        if ( 0 != totalSynthFrames )
+        {
+            // Synthesizing must stay well under 1000 / VIDEO_FPS ms per frame or pan and zoom can't keep up with encoding
+
+            double synthMS = (double) perfApp.DurationToMS( totalSynthTime ) / (double) totalSynthFrames;
+            printf( "    pan/zoom     %15ws frames\n", perfApp.RenderLL( totalSynthFrames ) );
+            printf( "    per frame    %15.2f ms (real time is %.2f)\n", synthMS, 1000.0 / VIDEO_FPS );
+        }
         printf( "  finalize       %15ws\n", perfApp.RenderDurationInMS( totalFinalizeTime ) );
         printf( "  TOTAL          %15ws\n", perfApp.RenderDurationInMS( totalLoadTime + totalReadRotateTime + totalResizeTime + totalRotateTime +
-                                                                        totalFlipTime + +totalFlipTime + totalFitTime + totalWaitTime +
-                                                                        totalFrameTime + totalFinalizeTime ) );
+                                                                        totalFlipTime + +totalFlipTime + totalFitTime + totalCaptionTime + totalRenditionTime + totalWaitTime +
+                                                                        totalFrameTime + totalFinalizeTime + totalHashTime ) );
         printf( "\n" );
+
+        if ( g_burst_distance >= 0 )
+        {
+            // Time saved is what the images that were kept took on average to compose and write, times the images skipped
+
+            LONGLONG kept = totalImages - totalSkipped;
+            LONGLONG keptTime = totalFitTime + totalCaptionTime + totalFlipTime + totalRenditionTime + totalFrameTime;
+            LONGLONG savedTime = ( 0 == kept ) ? 0 : keptTime / kept * totalSkipped;
+            printf( "near-duplicates  %15ws\n", perfApp.RenderLL( totalSkipped ) );
+            printf( "  kept           %15ws\n", perfApp.RenderLL( kept ) );
+            printf( "  est. time saved%15ws\n", perfApp.RenderDurationInMS( savedTime ) );
+            printf( "  hash cost      %14.2f%% of load\n", ( 0 == totalLoadTime ) ? 0.0 : 100.0 * (double) totalHashTime / (double) totalLoadTime );
+            printf( "\n" );
+        }
+
+        if ( g_counters )
+        {
+            // GHz is cycles per second of wall time in the stage. Well under the clock rate means the thread waited,
+            // was descheduled, or (in wait) spent part of the time helping other images.
+
+            LARGE_INTEGER liFreq;
+            QueryPerformanceFrequency( &liFreq );
+            printf( "stage             calls         ms      Mcycles  cycles/call  cycles/byte    GHz\n" );
+
+            for ( int s = 0; s < stageCount; s++ )
+            {
+                CStageCounters::Stats st = stageCounters.GetStats( s );
+
+                if ( 0 == st.calls )
+                    continue;
+
+                double seconds = (double) st.ticks / (double) liFreq.QuadPart;
+                printf( "  %-12s %8lld %10.1f %12.1f %12.0f ", stageNames[ s ], st.calls, seconds * 1000.0, (double) st.cycles / 1000000.0,
+                        (double) st.cycles / (double) st.calls );
+
+                if ( 0 != st.bytes )
+                    printf( "%12.2f ", (double) st.cycles / (double) st.bytes );
+                else
+                    printf( "%12s ", "-" );
+
+                printf( "%6.2f\n", ( seconds > 0.0 ) ? (double) st.cycles / seconds / 1e9 : 0.0 );
+            }
+
+            ULONG64 processCycles = 0;
+            QueryProcessCycleTime( GetCurrentProcess(), &processCycles );
+            printf( "  process Mcycles %15.1f\n", (double) processCycles / 1000000.0 );
+            printf( "\n" );
+        }
+
+        if ( 0 != nodeIds.size() )
+        {
+            double elapsedSeconds = (double) perfApp.DurationToMS( elapsed ) / 1000.0;
+
+            for ( int n = 0; n < statNodes; n++ )
+            {
+                if ( n == ( statNodes - 1 ) && 0 == nodeImages[ n ] )
+                    continue;
+
+                if ( n == ( statNodes - 1 ) )
+                    printf( "  unpinned       " );
+                else
+                    printf( "  node %-3d       ", nodeIds[ n ] );
+
+                printf( "%6lld images, busy %10ws ms, %8.2lf images/s\n", nodeImages[ n ], perfApp.RenderDurationInMS( nodeBusyTime[ n ] ),
+                        ( elapsedSeconds > 0.0 ) ? (double) nodeImages[ n ] / elapsedSeconds : 0.0 );
+            }
+
+            printf( "\n" );
+        }
     
         FILETIME creationFT, exitFT, kernelFT, userFT;
         GetProcessTimes( GetCurrentProcess(), &creationFT, &exitFT, &kernelFT, &userFT );
@@ -1545,4 +2880,103 @@ extern "C" int __cdecl wmain( int argc, WCHAR * argv[] )
         printf( "total CPU         %14ws\n", perfApp.RenderDurationInMS( ullU.QuadPart + ullK.QuadPart ) );
         printf( "avg. cores used   %14.2lf%\n", (double) ( ullU.QuadPart + ullK.QuadPart ) / (double) elapsed );
     }
+
+    if ( 0 != g_json_file[ 0 ] )
+    {
+        // One flat-ish object per run. cvbench collects these and compares them against a baseline.
+
+        FILE * fp = _wfopen( g_json_file, L"w" );
+
+        if ( NULL == fp )
+            printf( "can't open json stats file %ws\n", g_json_file );
+        else
+        {
+            PROCESS_MEMORY_COUNTERS_EX pmc = {};
+            pmc.cb = sizeof pmc;
+            GetProcessMemoryInfo( GetCurrentProcess(), (PPROCESS_MEMORY_COUNTERS) &pmc, sizeof PROCESS_MEMORY_COUNTERS_EX );
+
+            FILETIME creationFT, exitFT, kernelFT, userFT;
+            GetProcessTimes( GetCurrentProcess(), &creationFT, &exitFT, &kernelFT, &userFT );
+            ULARGE_INTEGER ullK, ullU;
+            ullK.HighPart = kernelFT.dwHighDateTime;
+            ullK.LowPart = kernelFT.dwLowDateTime;
+            ullU.HighPart = userFT.dwHighDateTime;
+            ullU.LowPart = userFT.dwLowDateTime;
+
+            const char * fitNames[] = { "letterbox", "crop", "blur" };
+            const char * filterNames[] = { "bilinear", "bicubic", "lanczos3" };
+            CBufferArena::Stats arenaStats = arena.GetStats();
+
+            fprintf( fp, "{\n" );
+            fprintf( fp, "  \"config\": {\n" );
+            fprintf( fp, "    \"width\": %u, \"height\": %u, \"parallelism\": %d, \"transition\": %d, \"delayMS\": %u,\n",
+                     g_width, g_height, g_parallelism, g_transition, g_ms_delay );
+            fprintf( fp, "    \"captions\": %s, \"kenburns\": %d, \"fit\": \"%s\", \"scaler\": \"%s\",\n", g_captions ? "true" : "false", g_kenburns,
+                     fitNames[ g_fit ], ( -1 == g_resample ) ? "wic" : filterNames[ g_resample ] );
+            fprintf( fp, "    \"sink\": \"%s\", \"decodeOnly\": %s, \"renditions\": %zd, \"pixelBits\": %u\n", encode ? "mf" : "null",
+                     g_decode_only ? "true" : "false", g_renditions.size(), g_bpp );
+            fprintf( fp, "  },\n" );
+            fprintf( fp, "  \"jobs\": %zd,\n", jobs.size() );
+            fprintf( fp, "  \"images\": %lld,\n", totalImages );
+            fprintf( fp, "  \"imagesSkipped\": %lld,\n", totalSkipped );
+            fprintf( fp, "  \"frames\": %lld,\n", sinkStats.framesSubmitted );
+            fprintf( fp, "  \"fragments\": %lld,\n", sinkStats.fragments );
+            fprintf( fp, "  \"wallMS\": %lld,\n", perfApp.DurationToMS( perfApp.Since( startTime ) ) );
+            fprintf( fp, "  \"pipelineMS\": %lld,\n", perfApp.DurationToMS( pipelineTime ) );
+            fprintf( fp, "  \"cpuMS\": %llu,\n", ( ullK.QuadPart + ullU.QuadPart ) / 10000 );
+            fprintf( fp, "  \"stagesMS\": {\n" );
+            fprintf( fp, "    \"load\": %lld, \"readrot\": %lld, \"resize\": %lld, \"rotate\": %lld, \"fit\": %lld, \"caption\": %lld,\n",
+                     perfApp.DurationToMS( totalLoadTime ), perfApp.DurationToMS( totalReadRotateTime ), perfApp.DurationToMS( totalResizeTime ),
+                     perfApp.DurationToMS( totalRotateTime ), perfApp.DurationToMS( totalFitTime ), perfApp.DurationToMS( totalCaptionTime ) );
+            fprintf( fp, "    \"flip\": %lld, \"renditions\": %lld, \"wait\": %lld, \"frame\": %lld, \"finalize\": %lld, \"ioWait\": %lld, \"hash\": %lld\n",
+                     perfApp.DurationToMS( totalFlipTime ), perfApp.DurationToMS( totalRenditionTime ), perfApp.DurationToMS( totalWaitTime ),
+                     perfApp.DurationToMS( totalFrameTime ), perfApp.DurationToMS( totalFinalizeTime ),
+                     ( readStats.waitNS + readStats.readNS ) / 1000000, perfApp.DurationToMS( totalHashTime ) );
+            fprintf( fp, "  },\n" );
+            fprintf( fp, "  \"peakWorkingSet\": %zu,\n", pmc.PeakWorkingSetSize );
+            fprintf( fp, "  \"pageFaults\": %u,\n", pmc.PageFaultCount );
+            fprintf( fp, "  \"arenaPeakBytes\": %lld,\n", arenaStats.peakBytesInUse );
+            fprintf( fp, "  \"arenaAllocatorMS\": %lld,\n", arenaStats.allocatorNS / 1000000 );
+            fprintf( fp, "  \"decodedBytes\": %lld,\n", totalDecodedBytes );
+            fprintf( fp, "  \"bytesRead\": %lld,\n", readStats.bytesRead );
+            fprintf( fp, "  \"inputIO\": { \"opens\": %lld, \"maps\": %lld, \"decodedByPath\": %lld, \"reads\": %lld, \"seeks\": %lld },\n",
+                     (long long) CStream::Counts().opens + totalDecodedByPath, (long long) CStream::Counts().maps, totalDecodedByPath,
+                     (long long) CStream::Counts().reads, (long long) CStream::Counts().seeks );
+            if ( g_counters )
+            {
+                fprintf( fp, "  \"stageCycles\": {" );
+
+                for ( int s = 0; s < stageCount; s++ )
+                    fprintf( fp, "%s \"%s\": %lld", ( 0 == s ) ? "" : ",", stageNames[ s ], stageCounters.GetStats( s ).cycles );
+
+                fprintf( fp, " },\n" );
+            }
+
+            fprintf( fp, "  \"memory\": {\n" );
+            fprintf( fp, "    \"peakBytes\": %lld, \"dominatedBy\": \"%s\",\n", memoryTags.PeakBytes(), CMemoryTags::Name( memoryTags.DominantAtPeak() ) );
+            fprintf( fp, "    \"tags\": {" );
+
+            for ( int t = 0; t < memTagCount; t++ )
+            {
+                CMemoryTags::Stats ms = memoryTags.GetStats( t );
+                fprintf( fp, "%s\n      \"%s\": { \"bytesAtPeak\": %lld, \"peakBytes\": %lld }", ( 0 == t ) ? "" : ",",
+                         CMemoryTags::Name( t ), ms.bytesAtPeak, ms.peakBytes );
+            }
+
+            fprintf( fp, "\n    },\n" );
+            fprintf( fp, "    \"timeline\": [" );
+
+            vector<CMemoryTags::Sample> timeline = memoryTags.Timeline();
+
+            for ( size_t i = 0; i < timeline.size(); i++ )
+                fprintf( fp, "%s\n      { \"ms\": %lld, \"bytes\": %lld, \"dominant\": \"%s\" }", ( 0 == i ) ? "" : ",",
+                         timeline[ i ].ms, timeline[ i ].bytes, CMemoryTags::Name( timeline[ i ].dominant ) );
+
+            fprintf( fp, "\n    ]\n" );
+            fprintf( fp, "  },\n" );
+            fprintf( fp, "  \"bytesCopied\": %lld\n", totalBytesCopied );
+            fprintf( fp, "}\n" );
+            fclose( fp );
+        }
+    }
 } //wmain
@@ -0,0 +1,867 @@
+// cvbench: throughput regression harness for cv.
+// Generates a reproducible corpus of synthetic photos, runs cv over it in a fixed set of configurations,
+// records wall time, peak memory and cv's per-stage timings (cv --json) to a results file, and compares
+// those results against a baseline results file.
+// It also benchmarks sorting the enumerated path list at archive scale, old layout and sorts against new.
+
+#define UNICODE
+
+#include <windows.h>
+#include <psapi.h>
+#include <wincodec.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <djl_pa.hxx>
+
+using namespace std;
+using namespace std::chrono;
+
+#pragma comment( lib, "windowscodecs.lib" )
+#pragma comment( lib, "ole32.lib" )
+#pragma comment( lib, "oleaut32.lib" )
+
+CDJLTrace tracer;
+
+static void Usage()
+{
+    printf( "Usage: cvbench corpus [dir] /n:[count] /s:[seed]\n" );
+    printf( "       cvbench run [corpusdir] /o:[results.json] /b:[baseline.json] /r:[percent] /c:[cv.exe]\n" );
+    printf( "       cvbench sort /n:[count] /s:[seed]\n" );
+    printf( "  corpus     Writes count synthetic photos to dir. The same seed always produces the same files:\n" );
+    printf( "             mixed sizes and aspect ratios, all eight EXIF orientations, JPEG quality and chroma\n" );
+    printf( "             subsampling variations, plain and interlaced PNG, and large panoramas. Default count 100, seed 1\n" );
+    printf( "  run        Runs cv over the corpus in each benchmark configuration and writes the results as JSON.\n" );
+    printf( "             -b       Baseline results to compare against. Exit code is 1 if anything regressed\n" );
+    printf( "             -c       Path of cv.exe. Default is cv.exe next to cvbench.exe\n" );
+    printf( "             -o       Results file to write\n" );
+    printf( "             -r       Percent slower or larger than the baseline that counts as a regression. Default is 10\n" );
+    printf( "  sort       Times adding and sorting count synthetic paths with per-path allocations and qsort (how the\n" );
+    printf( "             path list used to work) and with CPathArray's string arena, radix and merge sorts.\n" );
+    printf( "             Default is 1,000,000 and then 10,000,000 paths\n" );
+    printf( "  examples:  cvbench corpus c:\\bench\\corpus /n:200\n" );
+    printf( "             cvbench run c:\\bench\\corpus /o:c:\\bench\\today.json /b:c:\\bench\\baseline.json /r:5\n" );
+    exit( 1 );
+} //Usage
+
+// Deterministic on every machine and C runtime, unlike rand()
+
+class CRandom
+{
+    private:
+        uint64_t state;
+
+    public:
+        CRandom( uint64_t seed ) : state( seed * 0x9e3779b97f4a7c15ull + 1 ) {}
+
+        uint32_t Next()
+        {
+            state = state * 6364136223846793005ull + 1442695040888963407ull;
+            return (uint32_t) ( state >> 33 );
+        }
+
+        int Range( int lo, int hi ) { return lo + (int) ( Next() % (uint32_t) ( hi - lo + 1 ) ); } // inclusive
+}; //CRandom
+
+struct CorpusImage
+{
+    int width, height;
+    int orientation;        // EXIF 1-8; JPEG only
+    bool png;
+    bool interlaced;        // Adam7 PNG, the WIC encoder's nearest thing to a progressive JPEG
+    float quality;          // JPEG
+    int subsampling;        // WICJpegYCrCbSubsamplingOption
+};
+
+static void PlanCorpus( int count, uint32_t seed, vector<CorpusImage> & images )
+{
+    // Typical camera, phone and web sizes in both orientations, plus panoramas
+
+    static const int sizes[][ 2 ] = { { 640, 480 }, { 1024, 768 }, { 1600, 1200 }, { 1920, 1080 }, { 2048, 2048 },
+                                      { 3024, 4032 }, { 4032, 3024 }, { 4000, 6000 }, { 6000, 4000 }, { 1080, 1920 } };
+    static const int panoramas[][ 2 ] = { { 12000, 2000 }, { 20000, 3000 }, { 3000, 12000 } };
+    static const int subsamplings[] = { WICJpegYCrCbSubsampling420, WICJpegYCrCbSubsampling422, WICJpegYCrCbSubsampling444 };
+
+    CRandom rand( seed );
+    images.resize( count );
+
+    for ( int i = 0; i < count; i++ )
+    {
+        CorpusImage & ci = images[ i ];
+
+        if ( 0 == ( i % 25 ) && 0 != i )
+        {
+            const int * p = panoramas[ rand.Range( 0, _countof( panoramas ) - 1 ) ];
+            ci.width = p[ 0 ];
+            ci.height = p[ 1 ];
+        }
+        else
+        {
+            const int * s = sizes[ rand.Range( 0, _countof( sizes ) - 1 ) ];
+
+            // jitter so images don't all share a handful of exact sizes (and scaler tables)
+
+            ci.width = s[ 0 ] + 4 * rand.Range( -8, 8 );
+            ci.height = s[ 1 ] + 4 * rand.Range( -8, 8 );
+        }
+
+        ci.png = ( 0 == ( i % 10 ) );
+        ci.interlaced = ci.png && ( 0 == ( i % 20 ) );
+        ci.orientation = ci.png ? 1 : 1 + ( i % 8 );
+        ci.quality = 0.6f + 0.05f * rand.Range( 0, 7 );
+        ci.subsampling = subsamplings[ rand.Range( 0, _countof( subsamplings ) - 1 ) ];
+    }
+} //PlanCorpus
+
+// Something photo-like to compress: smooth gradients, soft waves, hard-edged blocks and noise
+
+static void Synthesize( const CorpusImage & ci, uint32_t seed, vector<BYTE> & pixels, UINT & stride )
+{
+    stride = ( ( ci.width * 3 ) + 3 ) & ~3;
+    pixels.resize( (size_t) stride * ci.height );
+    CRandom rand( seed );
+
+    int blocks = rand.Range( 4, 12 );
+    vector<int> bx( blocks ), by( blocks ), bw( blocks ), bh( blocks ), bc( blocks );
+
+    for ( int b = 0; b < blocks; b++ )
+    {
+        bw[ b ] = rand.Range( ci.width / 20 + 1, ci.width / 4 + 1 );
+        bh[ b ] = rand.Range( ci.height / 20 + 1, ci.height / 4 + 1 );
+        bx[ b ] = rand.Range( 0, ci.width - 1 );
+        by[ b ] = rand.Range( 0, ci.height - 1 );
+        bc[ b ] = rand.Range( 0, 255 );
+    }
+
+    double fx = 6.2831853 / ( 50 + rand.Range( 0, 400 ) );
+    double fy = 6.2831853 / ( 50 + rand.Range( 0, 400 ) );
+
+    for ( int y = 0; y < ci.height; y++ )
+    {
+        BYTE * row = pixels.data() + (size_t) y * stride;
+        double wy = sin( y * fy );
+
+        for ( int x = 0; x < ci.width; x++ )
+        {
+            int base = ( x * 200 ) / ci.width + ( y * 55 ) / ci.height;
+            int wave = (int) ( 30.0 * ( sin( x * fx ) + wy ) );
+            int noise = (int) ( rand.Next() & 15 ) - 8;
+
+            row[ 3 * x + 0 ] = (BYTE) __max( 0, __min( 255, base + wave + noise ) );
+            row[ 3 * x + 1 ] = (BYTE) __max( 0, __min( 255, 255 - base + noise ) );
+            row[ 3 * x + 2 ] = (BYTE) __max( 0, __min( 255, ( base / 2 ) + wave + 64 + noise ) );
+        }
+
+        for ( int b = 0; b < blocks; b++ )
+        {
+            if ( y < by[ b ] || y >= ( by[ b ] + bh[ b ] ) )
+                continue;
+
+            int xEnd = __min( ci.width, bx[ b ] + bw[ b ] );
+
+            for ( int x = bx[ b ]; x < xEnd; x++ )
+                row[ 3 * x + ( b % 3 ) ] = (BYTE) bc[ b ];
+        }
+    }
+} //Synthesize
+
+static HRESULT WriteImage( IWICImagingFactory * pFactory, const WCHAR * pwcPath, const CorpusImage & ci, uint32_t seed )
+{
+    vector<BYTE> pixels;
+    UINT stride;
+    Synthesize( ci, seed, pixels, stride );
+
+    IWICBitmap * pBitmap = NULL;
+    IWICStream * pStream = NULL;
+    IWICBitmapEncoder * pEncoder = NULL;
+    IWICBitmapFrameEncode * pFrame = NULL;
+    IPropertyBag2 * pProps = NULL;
+
+    HRESULT hr = pFactory->CreateBitmapFromMemory( ci.width, ci.height, GUID_WICPixelFormat24bppBGR, stride, (UINT) pixels.size(), pixels.data(), &pBitmap );
+
+    if ( SUCCEEDED( hr ) )
+        hr = pFactory->CreateStream( &pStream );
+
+    if ( SUCCEEDED( hr ) )
+        hr = pStream->InitializeFromFilename( pwcPath, GENERIC_WRITE );
+
+    if ( SUCCEEDED( hr ) )
+        hr = pFactory->CreateEncoder( ci.png ? GUID_ContainerFormatPng : GUID_ContainerFormatJpeg, NULL, &pEncoder );
+
+    if ( SUCCEEDED( hr ) )
+        hr = pEncoder->Initialize( pStream, WICBitmapEncoderNoCache );
+
+    if ( SUCCEEDED( hr ) )
+        hr = pEncoder->CreateNewFrame( &pFrame, &pProps );
+
+    if ( SUCCEEDED( hr ) )
+    {
+        PROPBAG2 option = {};
+        VARIANT value;
+        VariantInit( &value );
+
+        if ( ci.png )
+        {
+            option.pstrName = (LPOLESTR) L"InterlaceOption";
+            value.vt = VT_BOOL;
+            value.boolVal = ci.interlaced ? VARIANT_TRUE : VARIANT_FALSE;
+            hr = pProps->Write( 1, &option, &value );
+        }
+        else
+        {
+            option.pstrName = (LPOLESTR) L"ImageQuality";
+            value.vt = VT_R4;
+            value.fltVal = ci.quality;
+            hr = pProps->Write( 1, &option, &value );
+
+            if ( SUCCEEDED( hr ) )
+            {
+                option.pstrName = (LPOLESTR) L"JpegYCrCbSubsampling";
+                value.vt = VT_UI1;
+                value.bVal = (BYTE) ci.subsampling;
+                hr = pProps->Write( 1, &option, &value );
+            }
+        }
+    }
+
+    if ( SUCCEEDED( hr ) )
+        hr = pFrame->Initialize( pProps );
+
+    if ( SUCCEEDED( hr ) )
+        hr = pFrame->SetSize( ci.width, ci.height );
+
+    WICPixelFormatGUID format = GUID_WICPixelFormat24bppBGR;
+
+    if ( SUCCEEDED( hr ) )
+        hr = pFrame->SetPixelFormat( &format );
+
+    if ( SUCCEEDED( hr ) && !ci.png )
+    {
+        // The pixels are stored as-is; the orientation tag tells cv how to rotate them for display
+
+        IWICMetadataQueryWriter * pWriter = NULL;
+        hr = pFrame->GetMetadataQueryWriter( &pWriter );
+
+        if ( SUCCEEDED( hr ) )
+        {
+            PROPVARIANT pv;
+            PropVariantInit( &pv );
+            pv.vt = VT_UI2;
+            pv.uiVal = (USHORT) ci.orientation;
+            hr = pWriter->SetMetadataByName( L"/app1/ifd/{ushort=274}", &pv );
+            pWriter->Release();
+        }
+    }
+
+    if ( SUCCEEDED( hr ) )
+        hr = pFrame->WriteSource( pBitmap, NULL );
+
+    if ( SUCCEEDED( hr ) )
+        hr = pFrame->Commit();
+
+    if ( SUCCEEDED( hr ) )
+        hr = pEncoder->Commit();
+
+    if ( pProps )
+        pProps->Release();
+    if ( pFrame )
+        pFrame->Release();
+    if ( pEncoder )
+        pEncoder->Release();
+    if ( pStream )
+        pStream->Release();
+    if ( pBitmap )
+        pBitmap->Release();
+
+    return hr;
+} //WriteImage
+
+static int GenerateCorpus( const WCHAR * pwcDir, int count, uint32_t seed )
+{
+    CreateDirectory( pwcDir, NULL );
+
+    IWICImagingFactory * pFactory = NULL;
+    HRESULT hr = CoCreateInstance( CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_PPV_ARGS( &pFactory ) );
+
+    if ( FAILED( hr ) )
+    {
+        printf( "can't create the WIC factory: %#x\n", hr );
+        return 1;
+    }
+
+    vector<CorpusImage> images;
+    PlanCorpus( count, seed, images );
+
+    for ( int i = 0; i < count; i++ )
+    {
+        const CorpusImage & ci = images[ i ];
+        WCHAR awcPath[ MAX_PATH + 1 ];
+        swprintf_s( awcPath, _countof( awcPath ), L"%ws\\cvb_%04d_%dx%d_o%d.%ws", pwcDir, i, ci.width, ci.height, ci.orientation, ci.png ? L"png" : L"jpg" );
+
+        hr = WriteImage( pFactory, awcPath, ci, seed * 7919 + i );
+
+        if ( FAILED( hr ) )
+        {
+            printf( "can't write %ws: %#x\n", awcPath, hr );
+            pFactory->Release();
+            return 1;
+        }
+
+        printf( "." );
+    }
+
+    printf( "\n%d images written to %ws\n", count, pwcDir );
+    pFactory->Release();
+    return 0;
+} //GenerateCorpus
+
+// Just enough JSON to read cvbench's own results files: every scalar is stored under its dotted path,
+// e.g. runs.3.cv.stagesMS.load. Strings are kept without their quotes.
+
+class CJsonFlattener
+{
+    private:
+        const char * p;
+        map<string, string> & values;
+
+        void Skip() { while ( *p && strchr( " \t\r\n", *p ) ) p++; }
+
+        string String()
+        {
+            string s;
+            p++; // opening quote
+
+            while ( *p && '"' != *p )
+            {
+                if ( '\\' == *p && p[ 1 ] )
+                    p++;
+                s += *p++;
+            }
+
+            if ( *p )
+                p++;
+            return s;
+        } //String
+
+        bool Value( const string & path )
+        {
+            Skip();
+
+            if ( '{' == *p )
+            {
+                p++;
+                Skip();
+
+                while ( *p && '}' != *p )
+                {
+                    if ( '"' != *p )
+                        return false;
+
+                    string key = String();
+                    Skip();
+
+                    if ( ':' != *p++ )
+                        return false;
+
+                    if ( !Value( path.empty() ? key : path + "." + key ) )
+                        return false;
+
+                    Skip();
+
+                    if ( ',' == *p )
+                        p++;
+                    Skip();
+                }
+
+                if ( *p )
+                    p++;
+                return true;
+            }
+
+            if ( '[' == *p )
+            {
+                p++;
+                Skip();
+
+                for ( int i = 0; *p && ']' != *p; i++ )
+                {
+                    if ( !Value( path + "." + to_string( i ) ) )
+                        return false;
+
+                    Skip();
+
+                    if ( ',' == *p )
+                        p++;
+                    Skip();
+                }
+
+                if ( *p )
+                    p++;
+                return true;
+            }
+
+            if ( '"' == *p )
+            {
+                values[ path ] = String();
+                return true;
+            }
+
+            const char * start = p;
+            while ( *p && !strchr( ",}] \t\r\n", *p ) )
+                p++;
+
+            if ( start == p )
+                return false;
+
+            values[ path ] = string( start, p - start );
+            return true;
+        } //Value
+
+    public:
+        CJsonFlattener( map<string, string> & v ) : p( NULL ), values( v ) {}
+
+        bool Parse( const char * text )
+        {
+            p = text;
+            return Value( "" );
+        } //Parse
+}; //CJsonFlattener
+
+static bool ReadFileText( const WCHAR * pwcPath, string & text )
+{
+    FILE * fp = _wfopen( pwcPath, L"rb" );
+    if ( NULL == fp )
+        return false;
+
+    char buf[ 4096 ];
+    size_t n;
+    text.clear();
+
+    while ( 0 != ( n = fread( buf, 1, sizeof buf, fp ) ) )
+        text.append( buf, n );
+
+    fclose( fp );
+    return true;
+} //ReadFileText
+
+struct BenchConfig
+{
+    const char * name;
+    const WCHAR * args;
+};
+
+// Each configuration isolates one feature against the p4 default. nullsink and decodeonly show how much of the
+// wall time is the encoder and how much is decoding. capture-map and capture-read sort on EXIF capture dates, so
+// every file is parsed and then decoded; their cv.inputIO counts compare mapped views with ReadFile calls.
+// 4k-arena-off is 4k with every big buffer taken from the heap and freed right away; comparing the two shows what
+// the arena saves in cv.pageFaults and cv.arenaAllocatorMS.
+// The pixel32 configurations repeat the kernels that differ most by pixel format with --pixel:32, to compare
+// against their 24bpp counterparts at HD and 4K. fmp4 writes fragmented MP4, which should move time out of finalize.
+
+static const BenchConfig configs[] =
+{
+    { "p1",          L"/p:1" },
+    { "p4",          L"/p:4" },
+    { "p16",         L"/p:16" },
+    { "fade-black",  L"/p:4 /t:1" },
+    { "fade-white",  L"/p:4 /t:2" },
+    { "4k",          L"/p:4 /w:3840 /h:2160" },
+    { "4k-arena-off", L"/p:4 /w:3840 /h:2160 --arena:off" },
+    { "captions",    L"/p:4 /c" },
+    { "crop",        L"/p:4 /m:c" },
+    { "blur",        L"/p:4 /m:b" },
+    { "lanczos",     L"/p:4 /q:l" },
+    { "kenburns",    L"/p:4 /k" },
+    { "nullsink",    L"/p:4 --sink:null" },
+    { "decodeonly",  L"/p:4 --decode-only" },
+    { "capture-map", L"/p:4 /s:u" },
+    { "capture-read", L"/p:4 /s:u --io:read" },
+    { "fmp4",        L"/p:4 --fmp4" },
+    { "pixel32",     L"/p:4 --pixel:32" },
+    { "pixel32-4k",  L"/p:4 /w:3840 /h:2160 --pixel:32" },
+    { "pixel32-lanczos", L"/p:4 /q:l --pixel:32" },
+    { "pixel32-kenburns", L"/p:4 /k --pixel:32" },
+    { "pixel32-fade", L"/p:4 /t:1 --pixel:32" },
+};
+
+// Metrics compared against the baseline. Larger is worse for all of them.
+// The floor is the absolute change below which a difference is considered noise.
+
+struct Metric
+{
+    const char * key;
+    double floor;
+};
+
+static const Metric metrics[] =
+{
+    { "wallMS",                100.0 },
+    { "peakWorkingSet",        32.0 * 1024 * 1024 },
+    { "cv.pipelineMS",         100.0 },
+    { "cv.stagesMS.load",      100.0 },
+    { "cv.stagesMS.fit",       50.0 },
+    { "cv.stagesMS.frame",     100.0 },
+    { "cv.stagesMS.finalize",  100.0 },
+    { "cv.inputIO.opens",      0.0 },
+    { "cv.inputIO.reads",      100.0 },
+    { "cv.pageFaults",         10000.0 },
+    { "cv.arenaAllocatorMS",   20.0 },
+};
+
+// The path list as it was before the string arena: a heap string per path, sorted with qsort
+
+struct LegacyPathItem
+{
+    WCHAR * pwcPath;
+    FILETIME ftCreation;
+    FILETIME ftLastWrite;
+    FILETIME ftCapture;
+    ULONG ulAttribute;
+};
+
+static int LegacyLastWriteCompare( const void * a, const void * b )
+{
+    ULARGE_INTEGER ulA, ulB;
+    ulA.LowPart = ( (LegacyPathItem *) a )->ftLastWrite.dwLowDateTime;
+    ulA.HighPart = ( (LegacyPathItem *) a )->ftLastWrite.dwHighDateTime;
+    ulB.LowPart = ( (LegacyPathItem *) b )->ftLastWrite.dwLowDateTime;
+    ulB.HighPart = ( (LegacyPathItem *) b )->ftLastWrite.dwHighDateTime;
+
+    return ( ulA.QuadPart > ulB.QuadPart ) ? 1 : ( ulA.QuadPart < ulB.QuadPart ) ? -1 : 0;
+} //LegacyLastWriteCompare
+
+static int LegacyPathCompare( const void * a, const void * b )
+{
+    return wcscmp( ( (LegacyPathItem *) a )->pwcPath, ( (LegacyPathItem *) b )->pwcPath );
+} //LegacyPathCompare
+
+static long long MSSince( steady_clock::time_point & start )
+{
+    steady_clock::time_point now = steady_clock::now();
+    long long ms = duration_cast<milliseconds>( now - start ).count();
+    start = now;
+    return ms;
+} //MSSince
+
+static void SortBenchmark( int count, uint32_t seed )
+{
+    // Paths shaped like a dated photo archive, with write times spread over 20 years
+
+    printf( "generating %d paths\n", count );
+    vector<WCHAR> names( (size_t) count * 48 );
+    vector<FILETIME> times( count );
+    CRandom random( seed );
+
+    for ( int i = 0; i < count; i++ )
+    {
+        swprintf_s( names.data() + (size_t) i * 48, 48, L"d:\\archive\\%04d\\%02d\\%02d\\img_%08u.jpg",
+                    random.Range( 2005, 2024 ), random.Range( 1, 12 ), random.Range( 1, 28 ), random.Next() % 100000000 );
+
+        ULARGE_INTEGER uli;
+        uli.QuadPart = 0x01c5000000000000ull + ( (unsigned long long) random.Next() << 24 );
+        times[ i ].dwLowDateTime = uli.LowPart;
+        times[ i ].dwHighDateTime = uli.HighPart;
+    }
+
+    steady_clock::time_point start = steady_clock::now();
+    vector<LegacyPathItem> legacy;
+
+    for ( int i = 0; i < count; i++ )
+    {
+        LegacyPathItem pi = {};
+        const WCHAR * pwc = names.data() + (size_t) i * 48;
+        size_t len = 1 + wcslen( pwc );
+        pi.pwcPath = new WCHAR[ len ];
+        wcscpy_s( pi.pwcPath, len, pwc );
+        pi.ftCreation = pi.ftLastWrite = times[ i ];
+        legacy.push_back( pi );
+    }
+
+    long long legacyAdd = MSSince( start );
+    qsort( legacy.data(), legacy.size(), sizeof LegacyPathItem, LegacyLastWriteCompare );
+    long long legacyTime = MSSince( start );
+    qsort( legacy.data(), legacy.size(), sizeof LegacyPathItem, LegacyPathCompare );
+    long long legacyPath = MSSince( start );
+
+    for ( size_t i = 0; i < legacy.size(); i++ )
+        delete [] legacy[ i ].pwcPath;
+
+    long long legacyFree = MSSince( start );
+    legacy.clear();
+    legacy.shrink_to_fit();
+
+    start = steady_clock::now();
+    unique_ptr<CPathArray> paths( new CPathArray() );
+
+    for ( int i = 0; i < count; i++ )
+        paths->Add( names.data() + (size_t) i * 48, times[ i ], times[ i ] );
+
+    long long arenaAdd = MSSince( start );
+    paths->SortOnLastWrite();
+    long long arenaTime = MSSince( start );
+    paths->SortOnPath();
+    long long arenaPath = MSSince( start );
+    paths.reset();
+    long long arenaFree = MSSince( start );
+
+    printf( "%14s %16s %16s\n", "milliseconds", "heap + qsort", "arena + sorts" );
+    printf( "%14s %16lld %16lld\n", "add", legacyAdd, arenaAdd );
+    printf( "%14s %16lld %16lld\n", "sort on write", legacyTime, arenaTime );
+    printf( "%14s %16lld %16lld\n", "sort on path", legacyPath, arenaPath );
+    printf( "%14s %16lld %16lld\n\n", "free", legacyFree, arenaFree );
+} //SortBenchmark
+
+static int RunBenchmarks( const WCHAR * pwcCorpus, const WCHAR * pwcCV, const WCHAR * pwcResults, const WCHAR * pwcBaseline, double threshold )
+{
+    WCHAR awcTemp[ MAX_PATH + 1 ], awcVideo[ MAX_PATH + 1 ], awcJson[ MAX_PATH + 1 ];
+    GetTempPath( _countof( awcTemp ), awcTemp );
+    swprintf_s( awcVideo, _countof( awcVideo ), L"%wscvbench.mp4", awcTemp );
+    swprintf_s( awcJson, _countof( awcJson ), L"%wscvbench.json", awcTemp );
+
+    FILE * fp = _wfopen( pwcResults, L"w" );
+    if ( NULL == fp )
+    {
+        printf( "can't open results file %ws\n", pwcResults );
+        return 1;
+    }
+
+    fprintf( fp, "{\n  \"runs\": [\n" );
+    bool failed = false;
+
+    for ( int c = 0; c < _countof( configs ); c++ )
+    {
+        static WCHAR awcCmd[ 4 * MAX_PATH ];
+        swprintf_s( awcCmd, _countof( awcCmd ), L"\"%ws\" \"%ws\\cvb_*\" /s:p /o:\"%ws\" --json:\"%ws\" %ws",
+                    pwcCV, pwcCorpus, awcVideo, awcJson, configs[ c ].args );
+
+        printf( "%-12s %ws\n", configs[ c ].name, configs[ c ].args );
+        DeleteFile( awcJson );
+
+        STARTUPINFO si = {};
+        si.cb = sizeof si;
+        si.dwFlags = STARTF_USESTDHANDLES;
+        si.hStdInput = GetStdHandle( STD_INPUT_HANDLE );
+        si.hStdError = GetStdHandle( STD_ERROR_HANDLE );
+        PROCESS_INFORMATION pi = {};
+
+        // cv is chatty; send its output to nul. The handle must be inheritable for the child to use it.
+
+        SECURITY_ATTRIBUTES sa = { sizeof sa, NULL, TRUE };
+        si.hStdOutput = CreateFile( L"nul", GENERIC_WRITE, FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, NULL );
+
+        steady_clock::time_point start = steady_clock::now();
+
+        if ( !CreateProcess( NULL, awcCmd, NULL, NULL, TRUE, 0, NULL, NULL, &si, &pi ) )
+        {
+            printf( "  can't start %ws: %d\n", pwcCV, GetLastError() );
+            CloseHandle( si.hStdOutput );
+            fclose( fp );
+            return 1;
+        }
+
+        WaitForSingleObject( pi.hProcess, INFINITE );
+        long long wallMS = duration_cast<milliseconds>( steady_clock::now() - start ).count();
+
+        DWORD exitCode = 0;
+        GetExitCodeProcess( pi.hProcess, &exitCode );
+
+        PROCESS_MEMORY_COUNTERS pmc = {};
+        pmc.cb = sizeof pmc;
+        GetProcessMemoryInfo( pi.hProcess, &pmc, sizeof pmc );
+
+        CloseHandle( pi.hThread );
+        CloseHandle( pi.hProcess );
+        CloseHandle( si.hStdOutput );
+
+        string cvJson;
+        if ( !ReadFileText( awcJson, cvJson ) || 0 != exitCode )
+        {
+            printf( "  failed with exit code %d\n", exitCode );
+            cvJson = "{}";
+            failed = true;
+        }
+
+        printf( "  %lld ms, peak working set %zu MB\n", wallMS, pmc.PeakWorkingSetSize / ( 1024 * 1024 ) );
+
+        fprintf( fp, "    {\n      \"name\": \"%s\",\n      \"args\": \"%ws\",\n", configs[ c ].name, configs[ c ].args );
+        fprintf( fp, "      \"exitCode\": %d,\n      \"wallMS\": %lld,\n      \"peakWorkingSet\": %zu,\n", exitCode, wallMS, pmc.PeakWorkingSetSize );
+        fprintf( fp, "      \"cv\": %s\n    }%s\n", cvJson.c_str(), ( c == ( _countof( configs ) - 1 ) ) ? "" : "," );
+    }
+
+    fprintf( fp, "  ]\n}\n" );
+    fclose( fp );
+    DeleteFile( awcVideo );
+
+    if ( failed )
+        return 1;
+
+    if ( NULL == pwcBaseline )
+        return 0;
+
+    // Compare run by run, matching runs by name
+
+    string baseText, currentText;
+    map<string, string> base, current;
+
+    if ( !ReadFileText( pwcBaseline, baseText ) || !CJsonFlattener( base ).Parse( baseText.c_str() ) )
+    {
+        printf( "can't read baseline %ws\n", pwcBaseline );
+        return 1;
+    }
+
+    if ( !ReadFileText( pwcResults, currentText ) || !CJsonFlattener( current ).Parse( currentText.c_str() ) )
+    {
+        printf( "can't read results %ws\n", pwcResults );
+        return 1;
+    }
+
+    map<string, string> baseRuns;   // name -> path prefix in the baseline
+
+    for ( int i = 0; base.count( "runs." + to_string( i ) + ".name" ); i++ )
+        baseRuns[ base[ "runs." + to_string( i ) + ".name" ] ] = "runs." + to_string( i ) + ".";
+
+    int regressions = 0;
+    printf( "\n%-12s %-22s %14s %14s %8s\n", "config", "metric", "baseline", "current", "change" );
+
+    for ( int i = 0; current.count( "runs." + to_string( i ) + ".name" ); i++ )
+    {
+        string prefix = "runs." + to_string( i ) + ".";
+        string name = current[ prefix + "name" ];
+
+        if ( 0 == baseRuns.count( name ) )
+        {
+            printf( "%-12s not in the baseline\n", name.c_str() );
+            continue;
+        }
+
+        for ( int m = 0; m < _countof( metrics ); m++ )
+        {
+            string key = metrics[ m ].key;
+
+            if ( 0 == current.count( prefix + key ) || 0 == base.count( baseRuns[ name ] + key ) )
+                continue;
+
+            double now = atof( current[ prefix + key ].c_str() );
+            double then = atof( base[ baseRuns[ name ] + key ].c_str() );
+            double change = ( 0.0 == then ) ? 0.0 : 100.0 * ( now - then ) / then;
+            bool regressed = ( change > threshold ) && ( ( now - then ) > metrics[ m ].floor );
+
+            if ( regressed )
+                regressions++;
+
+            printf( "%-12s %-22s %14.0f %14.0f %7.1f%%%s\n", name.c_str(), key.c_str(), then, now, change, regressed ? "  REGRESSION" : "" );
+        }
+    }
+
+    printf( "\n%d regression%s beyond %.1f%%\n", regressions, ( 1 == regressions ) ? "" : "s", threshold );
+    return ( 0 == regressions ) ? 0 : 1;
+} //RunBenchmarks
+
+extern "C" int __cdecl wmain( int argc, WCHAR * argv[] )
+{
+    if ( argc < 2 )
+        Usage();
+
+    // sort has no directory argument
+
+    const WCHAR * pwcCommand = argv[ 1 ];
+    bool sortCommand = !_wcsicmp( pwcCommand, L"sort" );
+    int firstOption = sortCommand ? 2 : 3;
+
+    if ( argc < firstOption )
+        Usage();
+
+    const WCHAR * pwcDir = sortCommand ? NULL : argv[ 2 ];
+    int count = sortCommand ? 0 : 100;
+    uint32_t seed = 1;
+    const WCHAR * pwcResults = NULL;
+    const WCHAR * pwcBaseline = NULL;
+    double threshold = 10.0;
+
+    static WCHAR awcCV[ MAX_PATH + 1 ];
+    GetModuleFileName( NULL, awcCV, _countof( awcCV ) );
+    WCHAR * slash = wcsrchr( awcCV, L'\\' );
+    if ( slash )
+        slash[ 1 ] = 0;
+    else
+        awcCV[ 0 ] = 0;
+    wcscat_s( awcCV, _countof( awcCV ), L"cv.exe" );
+    const WCHAR * pwcCV = awcCV;
+
+    for ( int iArg = firstOption; iArg < argc; iArg++ )
+    {
+        const WCHAR * pwcArg = argv[ iArg ];
+
+        if ( ( L'-' != pwcArg[ 0 ] && L'/' != pwcArg[ 0 ] ) || L':' != pwcArg[ 2 ] )
+            Usage();
+
+        WCHAR a1 = towlower( pwcArg[ 1 ] );
+
+        if ( L'n' == a1 )
+            count = _wtoi( pwcArg + 3 );
+        else if ( L's' == a1 )
+            seed = (uint32_t) _wtoi( pwcArg + 3 );
+        else if ( L'o' == a1 )
+            pwcResults = pwcArg + 3;
+        else if ( L'b' == a1 )
+            pwcBaseline = pwcArg + 3;
+        else if ( L'r' == a1 )
+            threshold = _wtof( pwcArg + 3 );
+        else if ( L'c' == a1 )
+            pwcCV = pwcArg + 3;
+        else
+            Usage();
+    }
+
+    if ( sortCommand )
+    {
+        if ( count < 0 )
+            Usage();
+
+        if ( 0 != count )
+            SortBenchmark( count, seed );
+        else
+        {
+            SortBenchmark( 1000000, seed );
+            SortBenchmark( 10000000, seed );
+        }
+
+        return 0;
+    }
+
+    HRESULT hr = CoInitializeEx( NULL, COINIT_MULTITHREADED );
+    if ( FAILED( hr ) )
+    {
+        printf( "can't initialize COM: %#x\n", hr );
+        return 1;
+    }
+
+    int result = 1;
+
+    if ( !_wcsicmp( pwcCommand, L"corpus" ) )
+    {
+        if ( count <= 0 )
+            Usage();
+
+        result = GenerateCorpus( pwcDir, count, seed );
+    }
+    else if ( !_wcsicmp( pwcCommand, L"run" ) )
+    {
+        if ( NULL == pwcResults || threshold < 0.0 )
+            Usage();
+
+        result = RunBenchmarks( pwcDir, pwcCV, pwcResults, pwcBaseline, threshold );
+    }
+    else
+        Usage();
+
+    CoUninitialize();
+    return result;
+} //wmain
@@ -0,0 +1,395 @@
+#pragma once
+
+//
+// Size-class arena for big, repeatedly allocated buffers (decoded images, rotated copies, frames).
+// Freed buffers are kept on per-class free lists and handed out again, so a long run doesn't keep
+// asking the OS for fresh memory and page faulting it in for every image.
+// Blocks are 64-byte aligned. Blocks of at least 2MB come straight from the OS and can optionally use
+// large pages (Windows, requires SeLockMemoryPrivilege) or transparent huge pages (Linux).
+// Size classes are four steps per power of two, so at most 25% of a block is unused.
+// Bypass( true ) turns the arena into a thin wrapper over the C runtime heap, with no free lists or OS pages, to
+// measure what it saves. allocatorNS is the time spent in Alloc and Free either way.
+// Each block carries a tag (djl_memtag.hxx) saying what it's for; its bytes count toward that tag until it's freed,
+// then toward memTagArenaCache while it waits on a free list, and are only uncounted once returned to the OS.
+//
+// In one source file, declare the CBufferArena named arena like this:
+//    CBufferArena arena;
+// Usage:
+//    byte * p = (byte *) arena.Alloc( cb, memTagDecode );
+//    arena.Free( p );
+//    unique_ptr<byte, ArenaDeleter> holder( (byte *) arena.Alloc( cb ) );
+//
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include <djltrace.hxx>
+#include <djl_memtag.hxx>
+
+#ifdef _WIN32
+    #include <windows.h>
+    #include <malloc.h>
+#else
+    #include <sys/mman.h>
+#endif
+
+using namespace std;
+
+class CBufferArena
+{
+    public:
+        struct Stats
+        {
+            long long allocations;      // calls to Alloc()
+            long long reused;           // allocations satisfied from a free list; the allocations avoided
+            long long osAllocations;    // blocks obtained from the OS or the C runtime
+            long long largePageBlocks;  // blocks backed by large/huge pages
+            long long bytesInUse;       // bytes in blocks handed out and not yet freed
+            long long peakBytesInUse;
+            long long bytesCached;      // bytes in blocks sitting on free lists
+            long long allocatorNS;      // time in Alloc and Free, including getting memory from and returning it to the OS
+        };
+
+    private:
+        enum BlockKind { kindHeap = 0, kindPages = 1, kindLargePages = 2 };
+
+        // Sits in the 64 bytes in front of every block handed out
+
+        struct BlockHeader
+        {
+            uint32_t magic;
+            int32_t sizeClass;
+            uint32_t kind;
+            uint32_t tag;              // MemoryTag
+            size_t classBytes;         // usable bytes after the header
+            size_t osBytes;            // bytes obtained from the OS including the header
+        };
+
+        static const uint32_t BlockMagic = 0x61726e61;   // 'arna'
+        static const size_t HeaderBytes = 64;
+        static const size_t Alignment = 64;
+        static const size_t MinClassBytes = 64 * 1024;
+        static const size_t PageBlockBytes = 2 * 1024 * 1024;   // at or above this, get blocks from the OS
+        static const int MaxClasses = 128;
+
+        std::mutex mtx;
+        vector<BlockHeader *> freeLists[ MaxClasses ];
+        Stats stats;
+        size_t maxCachedBytes;
+        bool largePages;
+        size_t largePageBytes;
+        bool bypass;
+        atomic<long long> allocatorNS;
+
+        static long long NowNS()
+        {
+            return chrono::duration_cast<chrono::nanoseconds>( chrono::steady_clock::now().time_since_epoch() ).count();
+        } //NowNS
+
+        static int SizeClass( size_t cb, size_t & classBytes )
+        {
+            size_t base = MinClassBytes;
+            int c = 0;
+
+            if ( cb <= base )
+            {
+                classBytes = base;
+                return 0;
+            }
+
+            for ( ;; )
+            {
+                for ( int q = 1; q <= 4; q++ )
+                {
+                    c++;
+                    size_t size = base + ( base / 4 ) * q;
+
+                    if ( cb <= size )
+                    {
+                        classBytes = size;
+                        return c;
+                    }
+                }
+
+                base *= 2;
+            }
+        } //SizeClass
+
+        BlockHeader * OSAlloc( size_t classBytes )
+        {
+            size_t osBytes = classBytes + HeaderBytes;
+            BlockKind kind = kindHeap;
+            void * p = NULL;
+
+            if ( osBytes >= PageBlockBytes && !bypass )
+            {
+#ifdef _WIN32
+                if ( largePages && 0 != largePageBytes )
+                {
+                    size_t rounded = ( ( osBytes + largePageBytes - 1 ) / largePageBytes ) * largePageBytes;
+                    p = VirtualAlloc( NULL, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE );
+
+                    if ( NULL != p )
+                    {
+                        osBytes = rounded;
+                        kind = kindLargePages;
+                    }
+                }
+
+                if ( NULL == p )
+                {
+                    p = VirtualAlloc( NULL, osBytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE );
+                    kind = kindPages;
+                }
+#else
+                p = mmap( NULL, osBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+
+                if ( MAP_FAILED == p )
+                    p = NULL;
+                else
+                {
+                    kind = kindPages;
+
+    #ifdef MADV_HUGEPAGE
+                    if ( largePages && 0 == madvise( p, osBytes, MADV_HUGEPAGE ) )
+                        kind = kindLargePages;
+    #endif
+                }
+#endif
+            }
+            else
+            {
+#ifdef _WIN32
+                p = _aligned_malloc( osBytes, Alignment );
+#else
+                if ( 0 != posix_memalign( &p, Alignment, osBytes ) )
+                    p = NULL;
+#endif
+            }
+
+            if ( NULL == p )
+                return NULL;
+
+            BlockHeader * h = (BlockHeader *) p;
+            h->magic = BlockMagic;
+            h->kind = kind;
+            h->classBytes = classBytes;
+            h->osBytes = osBytes;
+            return h;
+        } //OSAlloc
+
+        static void OSFree( BlockHeader * h )
+        {
+            if ( kindHeap == h->kind )
+            {
+#ifdef _WIN32
+                _aligned_free( h );
+#else
+                free( h );
+#endif
+            }
+            else
+            {
+#ifdef _WIN32
+                VirtualFree( h, 0, MEM_RELEASE );
+#else
+                munmap( h, h->osBytes );
+#endif
+            }
+        } //OSFree
+
+    public:
+        CBufferArena() : maxCachedBytes( (size_t) 1024 * 1024 * 1024 ), largePages( false ), largePageBytes( 0 ), bypass( false ), allocatorNS( 0 )
+        {
+            memset( &stats, 0, sizeof stats );
+        }
+
+        ~CBufferArena()
+        {
+            Trim();
+        }
+
+        // Blocks beyond this many cached bytes are returned to the OS when freed
+
+        void SetMaxCachedBytes( size_t cb ) { maxCachedBytes = cb; }
+
+        // Call before the first Alloc. Every Alloc then gets a fresh heap block and every Free returns it.
+
+        void Bypass( bool b ) { bypass = b; }
+
+        // Returns true if large pages can be used. On Windows this requires the "Lock pages in memory" privilege.
+
+        bool EnableLargePages()
+        {
+#ifdef _WIN32
+            HANDLE hToken = NULL;
+
+            if ( OpenProcessToken( GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken ) )
+            {
+                TOKEN_PRIVILEGES tp = {};
+                tp.PrivilegeCount = 1;
+                tp.Privileges[ 0 ].Attributes = SE_PRIVILEGE_ENABLED;
+
+                if ( LookupPrivilegeValue( NULL, SE_LOCK_MEMORY_NAME, &tp.Privileges[ 0 ].Luid ) )
+                {
+                    AdjustTokenPrivileges( hToken, FALSE, &tp, 0, NULL, NULL );
+
+                    if ( ERROR_SUCCESS == GetLastError() )
+                        largePageBytes = GetLargePageMinimum();
+                }
+
+                CloseHandle( hToken );
+            }
+
+            largePages = ( 0 != largePageBytes );
+#elif defined( MADV_HUGEPAGE )
+            largePages = true;
+#endif
+
+            return largePages;
+        } //EnableLargePages
+
+        void * Alloc( size_t cb, int tag = memTagOther )
+        {
+            long long start = NowNS();
+            size_t classBytes = 0;
+            int c = SizeClass( cb, classBytes );
+
+            if ( c >= MaxClasses )
+                return NULL;
+
+            BlockHeader * h = NULL;
+            bool fresh = false;
+
+            {
+                lock_guard<mutex> lock( mtx );
+                stats.allocations++;
+
+                if ( !bypass && 0 != freeLists[ c ].size() )
+                {
+                    h = freeLists[ c ].back();
+                    freeLists[ c ].pop_back();
+                    stats.reused++;
+                    stats.bytesCached -= h->classBytes;
+                    memoryTags.Move( memTagArenaCache, tag, (long long) h->classBytes );
+                }
+            }
+
+            if ( NULL == h )
+            {
+                h = OSAlloc( classBytes );
+
+                if ( NULL == h )
+                {
+                    allocatorNS += NowNS() - start;
+                    return NULL;
+                }
+
+                h->sizeClass = c;
+                fresh = true;
+            }
+
+            {
+                lock_guard<mutex> lock( mtx );
+
+                if ( fresh )
+                {
+                    stats.osAllocations++;
+
+                    if ( kindLargePages == h->kind )
+                        stats.largePageBlocks++;
+                }
+
+                stats.bytesInUse += h->classBytes;
+
+                if ( stats.bytesInUse > stats.peakBytesInUse )
+                    stats.peakBytesInUse = stats.bytesInUse;
+            }
+
+            h->tag = tag;
+
+            if ( fresh )
+                memoryTags.Add( tag, (long long) h->classBytes );
+
+            allocatorNS += NowNS() - start;
+            return (uint8_t *) h + HeaderBytes;
+        } //Alloc
+
+        void Free( void * p )
+        {
+            if ( NULL == p )
+                return;
+
+            BlockHeader * h = (BlockHeader *) ( (uint8_t *) p - HeaderBytes );
+
+            if ( BlockMagic != h->magic )
+            {
+                tracer.Trace( "freeing a block %p not allocated by the arena\n", p );
+                return;
+            }
+
+            long long start = NowNS();
+            bool cache = false;
+
+            {
+                lock_guard<mutex> lock( mtx );
+                stats.bytesInUse -= h->classBytes;
+
+                if ( !bypass && ( stats.bytesCached + h->classBytes ) <= maxCachedBytes )
+                {
+                    freeLists[ h->sizeClass ].push_back( h );
+                    stats.bytesCached += h->classBytes;
+                    cache = true;
+                    memoryTags.Move( h->tag, memTagArenaCache, (long long) h->classBytes );
+                }
+            }
+
+            if ( !cache )
+            {
+                memoryTags.Add( h->tag, - (long long) h->classBytes );
+                OSFree( h );
+            }
+
+            allocatorNS += NowNS() - start;
+        } //Free
+
+        // Returns all cached blocks to the OS
+
+        void Trim()
+        {
+            lock_guard<mutex> lock( mtx );
+            memoryTags.Add( memTagArenaCache, - stats.bytesCached );
+
+            for ( int c = 0; c < MaxClasses; c++ )
+            {
+                for ( size_t i = 0; i < freeLists[ c ].size(); i++ )
+                    OSFree( freeLists[ c ][ i ] );
+
+                freeLists[ c ].clear();
+            }
+
+            stats.bytesCached = 0;
+        } //Trim
+
+        Stats GetStats()
+        {
+            lock_guard<mutex> lock( mtx );
+            Stats s = stats;
+            s.allocatorNS = allocatorNS;
+            return s;
+        } //GetStats
+}; //CBufferArena
+
+extern CBufferArena arena;
+
+struct ArenaDeleter
+{
+    void operator()( void * p ) { arena.Free( p ); }
+};
+
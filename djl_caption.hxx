@@ -0,0 +1,455 @@
+#pragma once
+
+//
+// Caption rendering from a glyph cache instead of building and rasterizing a GDI+ path for every frame.
+// Each character is rasterized once into two coverage masks: the outline (the glyph stroked with a round pen)
+// and the fill. Captions are laid out with the cached advances, wrapped at spaces, centered in the lower quarter
+// of the frame, then blended straight into the 24bpp or 32bpp frame: the outline color first, then the fill color.
+// The blend runs 16 bytes at a time with SSE2 where available. Masks are stored with each coverage value
+// repeated for B, G and R so the blend never has to deal with 3-byte pixels. For 32bpp frames the renderer
+// widens each glyph's masks once to 4 bytes per pixel, with no coverage for the unused byte.
+// Rasterizing is behind CGlyphRasterizer. CGdipGlyphRasterizer uses GDI+ on Windows; elsewhere supply another
+// (e.g. FreeType) to render captions without GDI+.
+// Usage:
+//    CGdipGlyphRasterizer rasterizer( L"Arial", 12.0f, 4.0f );
+//    CCaptionRenderer captioner( rasterizer );
+//    captioner.UsePixelBytes( 4 );           // before the first Draw, for 32bpp frames
+//    captioner.Draw( pFrame, width, height, stride, L"caption text", outlineRGB, fillRGB );
+//
+
+#include <stdint.h>
+#include <string.h>
+#include <wchar.h>
+#include <math.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if defined( _M_X64 ) || defined( __SSE2__ )
+    #define DJL_CAPTION_SSE2
+    #include <emmintrin.h>
+#endif
+
+#ifdef _WIN32
+    #include <windows.h>
+    #include <gdiplus.h>
+#endif
+
+#include <djl_pixel.hxx>
+
+using namespace std;
+
+struct CaptionGlyph
+{
+    int width, height;      // size of the masks
+    int offsetX, offsetY;   // of the masks' top-left relative to the pen position at the top of the line
+    int advance;            // pixels to the next character's pen position
+    vector<uint8_t> outline; // width * 3 coverage bytes per row (from the rasterizer), width * 4 once widened for 32bpp
+    vector<uint8_t> fill;
+};
+
+class CGlyphRasterizer
+{
+    public:
+        virtual ~CGlyphRasterizer() {}
+
+        virtual int LineHeight() = 0;
+
+        // Calls to Rasterize are serialized by CCaptionRenderer
+
+        virtual bool Rasterize( wchar_t ch, CaptionGlyph & glyph ) = 0;
+}; //CGlyphRasterizer
+
+class CCaptionRenderer
+{
+    private:
+        struct Placed
+        {
+            const CaptionGlyph * glyph;
+            int x, y;
+        };
+
+        CGlyphRasterizer & rasterizer;
+        std::mutex mtx;
+        map<wchar_t, unique_ptr<CaptionGlyph>> glyphs;  // never removed, so pointers stay valid without the lock
+        int lineHeight;
+        int pixelBytes;
+
+        static void Widen( vector<uint8_t> & mask )
+        {
+            vector<uint8_t> wide( mask.size() / 3 * 4, 0 );
+
+            for ( size_t from = 0, to = 0; from < mask.size(); from += 3, to += 4 )
+                memcpy( wide.data() + to, mask.data() + from, 3 );
+
+            mask.swap( wide );
+        } //Widen
+
+        // Call with mtx held
+
+        const CaptionGlyph * Glyph( wchar_t ch )
+        {
+            unique_ptr<CaptionGlyph> & g = glyphs[ ch ];
+
+            if ( !g )
+            {
+                g.reset( new CaptionGlyph() );
+
+                if ( !rasterizer.Rasterize( ch, *g ) )
+                {
+                    g->width = g->height = g->offsetX = g->offsetY = g->advance = 0;
+                    g->outline.clear();
+                    g->fill.clear();
+                }
+                else if ( 4 == pixelBytes )
+                {
+                    Widen( g->outline );
+                    Widen( g->fill );
+                }
+            }
+
+            return g.get();
+        } //Glyph
+
+        // d = ( d * ( 255 - a ) + c * a ) / 255, rounded
+
+        static void BlendSpan( uint8_t * d, const uint8_t * a, int n, uint8_t c )
+        {
+            int i = 0;
+
+#ifdef DJL_CAPTION_SSE2
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i c16 = _mm_set1_epi16( c );
+            const __m128i k255 = _mm_set1_epi16( 255 );
+            const __m128i k128 = _mm_set1_epi16( 128 );
+
+            for ( ; i + 16 <= n; i += 16 )
+            {
+                __m128i av = _mm_loadu_si128( (const __m128i *) ( a + i ) );
+
+                if ( 0xffff == _mm_movemask_epi8( _mm_cmpeq_epi8( av, zero ) ) )
+                    continue;
+
+                __m128i dv = _mm_loadu_si128( (const __m128i *) ( d + i ) );
+                __m128i result[ 2 ];
+
+                for ( int half = 0; half < 2; half++ )
+                {
+                    __m128i a16 = half ? _mm_unpackhi_epi8( av, zero ) : _mm_unpacklo_epi8( av, zero );
+                    __m128i d16 = half ? _mm_unpackhi_epi8( dv, zero ) : _mm_unpacklo_epi8( dv, zero );
+
+                    // x = d * ( 255 - a ) + c * a + 128 fits in 16 unsigned bits; x / 255 = ( x + ( x >> 8 ) ) >> 8
+
+                    __m128i x = _mm_add_epi16( _mm_mullo_epi16( d16, _mm_sub_epi16( k255, a16 ) ), _mm_mullo_epi16( c16, a16 ) );
+                    x = _mm_add_epi16( x, k128 );
+                    x = _mm_add_epi16( x, _mm_srli_epi16( x, 8 ) );
+                    result[ half ] = _mm_srli_epi16( x, 8 );
+                }
+
+                _mm_storeu_si128( (__m128i *) ( d + i ), _mm_packus_epi16( result[ 0 ], result[ 1 ] ) );
+            }
+#endif
+
+            for ( ; i < n; i++ )
+            {
+                if ( 0 == a[ i ] )
+                    continue;
+
+                unsigned x = d[ i ] * ( 255 - a[ i ] ) + c * a[ i ] + 128;
+                d[ i ] = (uint8_t) ( ( x + ( x >> 8 ) ) >> 8 );
+            }
+        } //BlendSpan
+
+        template <typename P> static void BlendGlyph( uint8_t * frame, int w, int h, int stride, const Placed & p,
+                                                      const uint8_t * outlineColor, const uint8_t * fillColor )
+        {
+            const CaptionGlyph & g = *p.glyph;
+            int x0 = max( 0, p.x );
+            int x1 = min( w, p.x + g.width );
+            int y0 = max( 0, p.y );
+            int y1 = min( h, p.y + g.height );
+
+            if ( x0 >= x1 || y0 >= y1 )
+                return;
+
+            int maskStride = g.width * P::Bytes;
+            int n = ( x1 - x0 ) * P::Bytes;
+
+            for ( int y = y0; y < y1; y++ )
+            {
+                uint8_t * d = frame + (ptrdiff_t) y * stride + x0 * P::Bytes;
+                size_t m = (size_t) ( y - p.y ) * maskStride + ( x0 - p.x ) * P::Bytes;
+
+                // outline then fill, like stroking the path and then filling it
+
+                BlendChannels<P>( d, g.outline.data() + m, n, outlineColor );
+                BlendChannels<P>( d, g.fill.data() + m, n, fillColor );
+            }
+        } //BlendGlyph
+
+        // Blends with a BGR color. Gray colors (the usual white outline and black fill) take the SIMD path.
+
+        template <typename P> static void BlendChannels( uint8_t * d, const uint8_t * a, int n, const uint8_t * bgr )
+        {
+            if ( bgr[ 0 ] == bgr[ 1 ] && bgr[ 1 ] == bgr[ 2 ] )
+            {
+                BlendSpan( d, a, n, bgr[ 0 ] );
+                return;
+            }
+
+            for ( int i = 0; i < n; i++ )
+            {
+                if ( 0 == a[ i ] )
+                    continue;
+
+                unsigned x = d[ i ] * ( 255 - a[ i ] ) + bgr[ i % P::Bytes ] * a[ i ] + 128;
+                d[ i ] = (uint8_t) ( ( x + ( x >> 8 ) ) >> 8 );
+            }
+        } //BlendChannels
+
+        int Advance( const vector<const CaptionGlyph *> & line, size_t begin, size_t end )
+        {
+            int width = 0;
+
+            for ( size_t i = begin; i < end; i++ )
+                width += line[ i ]->advance;
+
+            return width;
+        } //Advance
+
+    public:
+        CCaptionRenderer( CGlyphRasterizer & r ) : rasterizer( r ), lineHeight( -1 ), pixelBytes( 3 ) {}
+
+        // 3 (the default) for 24bpp frames, 4 for 32bpp. Call before the first Draw, since glyphs are cached in that layout.
+
+        void UsePixelBytes( int bytes ) { pixelBytes = bytes; }
+
+        size_t CachedGlyphs()
+        {
+            lock_guard<mutex> lock( mtx );
+            return glyphs.size();
+        } //CachedGlyphs
+
+        // Draws the caption centered in the lower quarter of a frame in the UsePixelBytes format, wrapping at spaces. frame is the top row;
+        // for a bottom-up frame pass its last row and a negative stride. Colors are 0xRRGGBB. Safe to call from many threads at once.
+
+        void Draw( uint8_t * frame, int w, int h, int stride, const wchar_t * text, uint32_t outlineRGB, uint32_t fillRGB )
+        {
+            size_t len = wcslen( text );
+            vector<const CaptionGlyph *> chars( len );
+
+            {
+                lock_guard<mutex> lock( mtx );
+
+                if ( -1 == lineHeight )
+                    lineHeight = rasterizer.LineHeight();
+
+                for ( size_t i = 0; i < len; i++ )
+                    chars[ i ] = Glyph( text[ i ] );
+            }
+
+            // Greedy word wrap: break at the last space that keeps the line within the frame
+
+            vector<pair<size_t, size_t>> lines;
+            size_t start = 0;
+
+            while ( start < len )
+            {
+                size_t end = start;
+                size_t lastBreak = 0;
+                int width = 0;
+
+                while ( end < len )
+                {
+                    if ( L' ' == text[ end ] )
+                        lastBreak = end;
+
+                    if ( width + chars[ end ]->advance > w && end > start )
+                        break;
+
+                    width += chars[ end ]->advance;
+                    end++;
+                }
+
+                if ( end < len && lastBreak > start )
+                    end = lastBreak;
+
+                lines.push_back( make_pair( start, end ) );
+                start = end;
+
+                while ( start < len && L' ' == text[ start ] )
+                    start++;
+            }
+
+            int top = ( h * 3 ) / 4;
+            int areaHeight = h - top;
+            int y = top + ( areaHeight - (int) lines.size() * lineHeight ) / 2;
+
+            uint8_t outlineColor[ 4 ] = { (uint8_t) outlineRGB, (uint8_t) ( outlineRGB >> 8 ), (uint8_t) ( outlineRGB >> 16 ), 255 };
+            uint8_t fillColor[ 4 ] = { (uint8_t) fillRGB, (uint8_t) ( fillRGB >> 8 ), (uint8_t) ( fillRGB >> 16 ), 255 };
+
+            for ( size_t l = 0; l < lines.size(); l++, y += lineHeight )
+            {
+                // trailing spaces don't count toward centering
+
+                size_t end = lines[ l ].second;
+                while ( end > lines[ l ].first && L' ' == text[ end - 1 ] )
+                    end--;
+
+                int x = ( w - Advance( chars, lines[ l ].first, end ) ) / 2;
+
+                for ( size_t i = lines[ l ].first; i < end; i++ )
+                {
+                    const CaptionGlyph * g = chars[ i ];
+
+                    if ( 0 != g->width )
+                    {
+                        Placed p = { g, x + g->offsetX, y + g->offsetY };
+                        if ( 4 == pixelBytes )
+                            BlendGlyph<CPixelBgrx32>( frame, w, h, stride, p, outlineColor, fillColor );
+                        else
+                            BlendGlyph<CPixelBgr24>( frame, w, h, stride, p, outlineColor, fillColor );
+                    }
+
+                    x += g->advance;
+                }
+            }
+        } //Draw
+}; //CCaptionRenderer
+
+#ifdef _WIN32
+
+// Rasterizes glyphs with GDI+ the way a GraphicsPath caption is drawn: the path stroked with a round-joined pen
+// for the outline and filled for the body. GDI+ objects are created per glyph so nothing outlives GdiplusShutdown.
+
+class CGdipGlyphRasterizer : public CGlyphRasterizer
+{
+    private:
+        WCHAR familyName[ LF_FACESIZE ];
+        float emSize;
+        float penWidth;
+        int pad;
+
+        static void ReadAlpha( Gdiplus::Bitmap & b, vector<uint8_t> & alpha )
+        {
+            int w = b.GetWidth();
+            int h = b.GetHeight();
+            Gdiplus::Rect rect( 0, 0, w, h );
+            Gdiplus::BitmapData bd;
+            b.LockBits( &rect, Gdiplus::ImageLockModeRead, PixelFormat32bppARGB, &bd );
+
+            alpha.resize( (size_t) w * h );
+
+            for ( int y = 0; y < h; y++ )
+            {
+                const uint8_t * row = (const uint8_t *) bd.Scan0 + (size_t) y * bd.Stride;
+
+                for ( int x = 0; x < w; x++ )
+                    alpha[ (size_t) y * w + x ] = row[ x * 4 + 3 ];
+            }
+
+            b.UnlockBits( &bd );
+        } //ReadAlpha
+
+    public:
+        CGdipGlyphRasterizer( const WCHAR * family, float em, float pen ) : emSize( em ), penWidth( pen )
+        {
+            wcsncpy_s( familyName, _countof( familyName ), family, _TRUNCATE );
+            pad = (int) ceil( penWidth ) + 2;
+        }
+
+        int LineHeight()
+        {
+            Gdiplus::FontFamily fontFamily( familyName );
+            UINT16 emHeight = fontFamily.GetEmHeight( Gdiplus::FontStyleRegular );
+
+            if ( 0 == emHeight )
+                return (int) ceil( emSize * 1.2f );
+
+            return (int) ceil( emSize * fontFamily.GetLineSpacing( Gdiplus::FontStyleRegular ) / emHeight );
+        } //LineHeight
+
+        bool Rasterize( wchar_t ch, CaptionGlyph & glyph )
+        {
+            Gdiplus::FontFamily fontFamily( familyName );
+            Gdiplus::StringFormat format( Gdiplus::StringFormat::GenericTypographic() );
+            format.SetFormatFlags( format.GetFormatFlags() | Gdiplus::StringFormatFlagsMeasureTrailingSpaces );
+
+            int cell = (int) ceil( emSize * 2 ) + 2 * pad;
+            Gdiplus::Bitmap bitmap( cell, cell, PixelFormat32bppARGB );
+            Gdiplus::Graphics graphics( &bitmap );
+            graphics.SetSmoothingMode( Gdiplus::SmoothingModeAntiAlias );
+
+            Gdiplus::Font font( &fontFamily, emSize, Gdiplus::FontStyleRegular, Gdiplus::UnitPixel );
+            Gdiplus::RectF bounds;
+            graphics.MeasureString( &ch, 1, &font, Gdiplus::PointF( 0, 0 ), &format, &bounds );
+            glyph.advance = (int) ( bounds.Width + 0.5f );
+
+            Gdiplus::GraphicsPath path;
+            path.AddString( &ch, 1, &fontFamily, Gdiplus::FontStyleRegular, emSize, Gdiplus::PointF( (float) pad, (float) pad ), &format );
+
+            Gdiplus::Pen pen( Gdiplus::Color( 255, 255, 255 ), penWidth );
+            pen.SetLineJoin( Gdiplus::LineJoinRound );
+
+            vector<uint8_t> outline, fill;
+            graphics.Clear( Gdiplus::Color( 0, 0, 0, 0 ) );
+            graphics.DrawPath( &pen, &path );
+            graphics.Flush();
+            ReadAlpha( bitmap, outline );
+
+            Gdiplus::SolidBrush brush( Gdiplus::Color( 255, 255, 255 ) );
+            graphics.Clear( Gdiplus::Color( 0, 0, 0, 0 ) );
+            graphics.FillPath( &brush, &path );
+            graphics.Flush();
+            ReadAlpha( bitmap, fill );
+
+            // Keep just the bounding box of what was drawn
+
+            int left = cell, top = cell, right = -1, bottom = -1;
+
+            for ( int y = 0; y < cell; y++ )
+                for ( int x = 0; x < cell; x++ )
+                    if ( 0 != outline[ (size_t) y * cell + x ] || 0 != fill[ (size_t) y * cell + x ] )
+                    {
+                        left = min( left, x );
+                        right = max( right, x );
+                        top = min( top, y );
+                        bottom = max( bottom, y );
+                    }
+
+            if ( right < 0 )
+            {
+                // whitespace
+
+                glyph.width = glyph.height = glyph.offsetX = glyph.offsetY = 0;
+                return true;
+            }
+
+            glyph.width = right - left + 1;
+            glyph.height = bottom - top + 1;
+            glyph.offsetX = left - pad;
+            glyph.offsetY = top - pad;
+            glyph.outline.resize( (size_t) glyph.width * glyph.height * 3 );
+            glyph.fill.resize( glyph.outline.size() );
+
+            for ( int y = 0; y < glyph.height; y++ )
+            {
+                for ( int x = 0; x < glyph.width; x++ )
+                {
+                    size_t from = (size_t) ( top + y ) * cell + left + x;
+                    size_t to = ( (size_t) y * glyph.width + x ) * 3;
+
+                    memset( glyph.outline.data() + to, outline[ from ], 3 );
+                    memset( glyph.fill.data() + to, fill[ from ], 3 );
+                }
+            }
+
+            return true;
+        } //Rasterize
+}; //CGdipGlyphRasterizer
+
+#endif // _WIN32
+
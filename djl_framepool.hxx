@@ -0,0 +1,159 @@
+#pragma once
+
+//
+// Pool of reference-counted, fixed-size video frames.
+// Frames are composed in place and handed to a video sink (djl_vsink.hxx) without copying. The sink, and
+// anything downstream like an encoder, holds references. The frame goes back to the pool when the last one
+// is released, so the same few buffers are recycled for the whole video no matter how long the encoder keeps them.
+// Frames can be placed on a NUMA node; free frames are kept per node. Their bytes count as memTagFrames
+// (djl_memtag.hxx) from the first time they're handed out until the pool is destroyed.
+// Usage:
+//    CFramePool pool( stride * height );
+//    CFrame * frame = pool.Acquire( node );     // node -1 means no preference
+//    compose into frame->Bits()
+//    sink.WriteFrame( frame, start, duration );  // the sink takes its own references
+//    frame->Release();
+//
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <djltrace.hxx>
+#include <djl_topo.hxx>
+#include <djl_memtag.hxx>
+
+using namespace std;
+
+class CFramePool;
+
+class CFrame
+{
+    friend class CFramePool;
+
+    private:
+        CFramePool * pool;
+        uint8_t * bits;
+        size_t cb;
+        int node;
+        atomic<long> refs;
+
+        CFrame( CFramePool * p, uint8_t * b, size_t c, int n ) : pool( p ), bits( b ), cb( c ), node( n ), refs( 0 ) {}
+
+    public:
+        uint8_t * Bits() { return bits; }
+        size_t Bytes() { return cb; }
+        int Node() { return node; }
+
+        void AddRef() { refs++; }
+        inline void Release();
+}; //CFrame
+
+struct FrameReleaser
+{
+    void operator()( CFrame * frame ) { frame->Release(); }
+};
+
+class CFramePool
+{
+    friend class CFrame;
+
+    public:
+        struct Stats
+        {
+            long long allocated;        // frames obtained from the OS
+            long long acquired;         // calls to Acquire()
+            long long reused;           // acquires satisfied by a recycled frame
+            long long outstanding;      // frames currently referenced
+            long long peakOutstanding;
+        };
+
+    private:
+        std::mutex mtx;
+        size_t frameBytes;
+        map<int, vector<CFrame *>> freeFrames;   // keyed by node
+        vector<CFrame *> allFrames;
+        Stats stats;
+
+        void Recycle( CFrame * frame )
+        {
+            lock_guard<mutex> lock( mtx );
+            freeFrames[ frame->node ].push_back( frame );
+            stats.outstanding--;
+        } //Recycle
+
+    public:
+        CFramePool( size_t cb ) : frameBytes( cb )
+        {
+            memset( &stats, 0, sizeof stats );
+        }
+
+        ~CFramePool()
+        {
+            if ( 0 != stats.outstanding )
+                tracer.Trace( "frame pool destroyed with %lld frames outstanding\n", stats.outstanding );
+
+            for ( size_t i = 0; i < allFrames.size(); i++ )
+            {
+                CTopology::FreeOnNode( allFrames[ i ]->bits, frameBytes );
+                delete allFrames[ i ];
+            }
+
+            memoryTags.Add( memTagFrames, - (long long) ( frameBytes * allFrames.size() ) );
+        }
+
+        size_t FrameBytes() { return frameBytes; }
+
+        // Returns a frame with one reference. Contents are whatever the last user left there.
+
+        CFrame * Acquire( int node = -1 )
+        {
+            lock_guard<mutex> lock( mtx );
+            stats.acquired++;
+            CFrame * frame = NULL;
+            vector<CFrame *> & list = freeFrames[ node ];
+
+            if ( 0 != list.size() )
+            {
+                frame = list.back();
+                list.pop_back();
+                stats.reused++;
+            }
+            else
+            {
+                uint8_t * bits = (uint8_t *) CTopology::AllocOnNode( frameBytes, node );
+                if ( NULL == bits )
+                    return NULL;
+
+                frame = new CFrame( this, bits, frameBytes, node );
+                allFrames.push_back( frame );
+                stats.allocated++;
+                memoryTags.Add( memTagFrames, (long long) frameBytes );
+            }
+
+            frame->refs = 1;
+            stats.outstanding++;
+
+            if ( stats.outstanding > stats.peakOutstanding )
+                stats.peakOutstanding = stats.outstanding;
+
+            return frame;
+        } //Acquire
+
+        Stats GetStats()
+        {
+            lock_guard<mutex> lock( mtx );
+            return stats;
+        } //GetStats
+}; //CFramePool
+
+inline void CFrame::Release()
+{
+    if ( 0 == --refs )
+        pool->Recycle( this );
+} //Release
+
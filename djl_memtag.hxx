@@ -0,0 +1,179 @@
+#pragma once
+
+//
+// Live and peak bytes of the app's big allocations, by what they're for. The arena (djl_arena.hxx), frame pool
+// (djl_framepool.hxx) and read-ahead (djl_readahead.hxx) report their blocks under a tag, and the app adds
+// anything else it keeps, like enumerated paths.
+// Along with each tag's own peak, the bytes of every tag are kept as of the moment the total peaked, so the tags
+// add up to the high-water mark and the one holding the most is what to cut. A timeline records each time the
+// high-water mark grows by another 1/16th, with the tag holding the most at that moment.
+// Adds take a lock; they happen a few times per image, for buffers of megabytes.
+// In one source file, declare the CMemoryTags named memoryTags like this:
+//    CMemoryTags memoryTags;
+// Usage:
+//    memoryTags.Add( memTagDecode, cb );    // and -cb when it's freed
+//    memoryTags.Move( memTagDecode, memTagArenaCache, cb );    // still held, but for something else now
+//    CMemoryTags::Stats s = memoryTags.GetStats( memTagDecode );
+//    vector<CMemoryTags::Sample> timeline = memoryTags.Timeline();
+//
+
+#include <string.h>
+
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+enum MemoryTag
+{
+    memTagOther,        // arena blocks allocated without a tag
+    memTagReadAhead,    // compressed files read ahead of the decoders
+    memTagDecode,       // WIC stripes being decoded and scaled
+    memTagBitmaps,      // decoded images held in GDI+ bitmaps
+    memTagRotate,       // rotated copies of decoded images
+    memTagCanvas,       // pan and zoom canvases
+    memTagFrames,       // pooled video frames: being composed, transition frames, and samples held by encoders
+    memTagMetadata,     // enumerated paths and their dates
+    memTagArenaCache,   // freed arena blocks kept on free lists for reuse
+    memTagCount
+};
+
+class CMemoryTags
+{
+    public:
+        struct Stats
+        {
+            long long bytes;        // live now
+            long long peakBytes;    // this tag's own peak
+            long long bytesAtPeak;  // live when the total peaked
+        };
+
+        struct Sample
+        {
+            long long ms;           // since the CMemoryTags was constructed
+            long long bytes;        // the new high-water mark
+            int dominant;           // tag holding the most bytes then
+        };
+
+        static const char * Name( int tag )
+        {
+            static const char * names[ memTagCount ] = { "other", "readAhead", "decode", "bitmaps", "rotate", "canvas", "frames", "metadata", "arenaCache" };
+            return ( tag >= 0 && tag < memTagCount ) ? names[ tag ] : "?";
+        } //Name
+
+    private:
+        static const size_t MaxSamples = 256;
+
+        std::mutex mtx;
+        Stats tags[ memTagCount ];
+        long long total;
+        long long peak;
+        long long lastSampled;
+        vector<Sample> timeline;
+        chrono::steady_clock::time_point start;
+
+        int DominantNow()
+        {
+            int dominant = 0;
+
+            for ( int t = 1; t < memTagCount; t++ )
+                if ( tags[ t ].bytes > tags[ dominant ].bytes )
+                    dominant = t;
+
+            return dominant;
+        } //DominantNow
+
+    public:
+        CMemoryTags() : total( 0 ), peak( 0 ), lastSampled( 0 ), start( chrono::steady_clock::now() )
+        {
+            memset( tags, 0, sizeof tags );
+        }
+
+        void Add( int tag, long long bytes )
+        {
+            if ( tag < 0 || tag >= memTagCount )
+                tag = memTagOther;
+
+            lock_guard<mutex> lock( mtx );
+            Stats & s = tags[ tag ];
+            s.bytes += bytes;
+            total += bytes;
+
+            if ( s.bytes > s.peakBytes )
+                s.peakBytes = s.bytes;
+
+            if ( total <= peak )
+                return;
+
+            peak = total;
+
+            for ( int t = 0; t < memTagCount; t++ )
+                tags[ t ].bytesAtPeak = tags[ t ].bytes;
+
+            if ( ( peak - lastSampled ) >= ( lastSampled / 16 ) && timeline.size() < MaxSamples )
+            {
+                Sample sample = { chrono::duration_cast<chrono::milliseconds>( chrono::steady_clock::now() - start ).count(), peak, DominantNow() };
+                timeline.push_back( sample );
+                lastSampled = peak;
+            }
+        } //Add
+
+        // Moves bytes from one tag to another without changing the total, so the move can't make a new peak
+
+        void Move( int from, int to, long long bytes )
+        {
+            if ( from < 0 || from >= memTagCount )
+                from = memTagOther;
+
+            if ( to < 0 || to >= memTagCount )
+                to = memTagOther;
+
+            lock_guard<mutex> lock( mtx );
+            tags[ from ].bytes -= bytes;
+            tags[ to ].bytes += bytes;
+
+            if ( tags[ to ].bytes > tags[ to ].peakBytes )
+                tags[ to ].peakBytes = tags[ to ].bytes;
+        } //Move
+
+        Stats GetStats( int tag )
+        {
+            lock_guard<mutex> lock( mtx );
+            return tags[ tag ];
+        } //GetStats
+
+        long long Bytes()
+        {
+            lock_guard<mutex> lock( mtx );
+            return total;
+        } //Bytes
+
+        long long PeakBytes()
+        {
+            lock_guard<mutex> lock( mtx );
+            return peak;
+        } //PeakBytes
+
+        // The tag holding the most bytes when the total peaked
+
+        int DominantAtPeak()
+        {
+            lock_guard<mutex> lock( mtx );
+            int dominant = 0;
+
+            for ( int t = 1; t < memTagCount; t++ )
+                if ( tags[ t ].bytesAtPeak > tags[ dominant ].bytesAtPeak )
+                    dominant = t;
+
+            return dominant;
+        } //DominantAtPeak
+
+        vector<Sample> Timeline()
+        {
+            lock_guard<mutex> lock( mtx );
+            return timeline;
+        } //Timeline
+}; //CMemoryTags
+
+extern CMemoryTags memoryTags;
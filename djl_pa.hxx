@@ -1,12 +1,17 @@
 #pragma once
 
 //
-// Wrapper for vector that stores paths and file information
+// Wrapper for vector that stores paths and file information.
+// Paths are packed one after another into a single string arena and referenced by 32-bit offsets, so a million
+// paths are a handful of allocations rather than a million. Pointers returned by Get() are valid until the next Add.
+// Time orders extract the times into dense 64-bit keys and radix sort them; path order is a merge sort of indexes.
+// Both run in parallel for large arrays (djl_sort.hxx) and are stable.
 //
 
 #include <djltrace.hxx>
 #include <djlimagedata.hxx>
 #include <djltimed.hxx>
+#include <djl_sort.hxx>
 
 #include <random>
 #include <ppl.h>
@@ -18,100 +23,80 @@ class CPathArray
     public:
         struct PathItem
         {
-            WCHAR * pwcPath;
             FILETIME ftCreation;
             FILETIME ftLastWrite;
             FILETIME ftCapture;
             ULONG ulAttribute;     // can be used to sort on anything, e.g. primary color
+            uint32_t pathOffset;   // in WCHARs from the start of the string arena
         };
 
     private:
         vector<PathItem> elements;
+        vector<WCHAR> strings;     // the string arena: every path, null-terminated, back to back
         bool captureTimesLoaded;
         std::mutex mtx;
 
-        static int CompareFT( FILETIME & ftA, FILETIME & ftB )
+        static uint64_t FTKey( const FILETIME & ft )
         {
-            ULARGE_INTEGER ulA, ulB;
-            ulA.LowPart = ftA.dwLowDateTime;
-            ulA.HighPart = ftA.dwHighDateTime;
-            ulB.LowPart = ftB.dwLowDateTime;
-            ulB.HighPart = ftB.dwHighDateTime;
+            return ( (uint64_t) ft.dwHighDateTime << 32 ) | ft.dwLowDateTime;
+        } //FTKey
 
-            return ( ulA.QuadPart > ulB.QuadPart ) ? 1 : ( ulA.QuadPart < ulB.QuadPart ) ? -1 : 0;
-        } //CompareFT
+        // Appends pwc to the arena. Call with mtx held. Fails once the arena outgrows 32-bit offsets.
 
-        static int PIAttributeCompare( const void * a, const void * b )
+        bool AddString( const WCHAR * pwc, size_t len, PathItem & pi )
         {
-            PathItem *pa = (PathItem *) a;
-            PathItem *pb = (PathItem *) b;
+            if ( ( strings.size() + len + 1 ) > UINT32_MAX )
+            {
+                tracer.Trace( "path array is full; skipping %ws\n", pwc );
+                return false;
+            }
 
-            return ( ( pa->ulAttribute > pb->ulAttribute ) ? 1 : ( pa->ulAttribute == pb->ulAttribute ) ? 0 : -1 );
-        } //PIAttributeCompare
+            pi.pathOffset = (uint32_t) strings.size();
+            strings.insert( strings.end(), pwc, pwc + len + 1 );
+            return true;
+        } //AddString
 
-        static int PILastWriteCompare( const void * a, const void * b )
+        void Reorder( const vector<uint32_t> & order )
         {
-            PathItem *pa = (PathItem *) a;
-            PathItem *pb = (PathItem *) b;
+            vector<PathItem> sorted( elements.size() );
 
-            return CompareFT( pa->ftLastWrite, pb->ftLastWrite );
-        } //PILastWriteCompare
-        
-        static int PICreationCompare( const void * a, const void * b )
-        {
-            PathItem *pa = (PathItem *) a;
-            PathItem *pb = (PathItem *) b;
+            parallel_for( (size_t) 0, elements.size(), [&] ( size_t i )
+            {
+                sorted[ i ] = elements[ order[ i ] ];
+            } );
 
-            return CompareFT( pa->ftCreation, pb->ftCreation );
-        } //PICreationCompare
-        
-        static int PICaptureCompare( const void * a, const void * b )
-        {
-            PathItem *pa = (PathItem *) a;
-            PathItem *pb = (PathItem *) b;
+            elements.swap( sorted );
+        } //Reorder
 
-            return CompareFT( pa->ftCapture, pb->ftCapture );
-        } //PICaptureCompare
-        
-        static int PIPathCompare( const void * a, const void * b )
+        // Radix sorts on the 64-bit key returned by key( item ). Descending order sorts the inverted keys so
+        // it stays stable rather than reversing ties.
+
+        template <typename Key> void SortOnKey( Key key, bool ascending )
         {
-            PathItem *pa = (PathItem *) a;
-            PathItem *pb = (PathItem *) b;
+            vector<CParallelSort::KeyIndex> keys( elements.size() );
 
-            return wcscmp( pa->pwcPath, pb->pwcPath );
-        } //PIPathCompare
+            parallel_for( (size_t) 0, elements.size(), [&] ( size_t i )
+            {
+                uint64_t k = key( elements[ i ] );
+                keys[ i ].key = ascending ? k : ~k;
+                keys[ i ].index = (uint32_t) i;
+            } );
 
-        static int PIAttributeCompareDescending( const void * a, const void * b )
-        {
-            return PIAttributeCompare( b, a );
-        } //PIAttributeCompareDescending
+            CParallelSort::RadixSort( keys );
 
-        static int PILastWriteCompareDescending( const void * a, const void * b )
-        {
-            return PILastWriteCompare( b, a );
-        } //PILastWriteCompareDescending
-        
-        static int PICreationCompareDescending( const void * a, const void * b )
-        {
-            return PICreationCompare( b, a );
-        } //PICreationCompareDescending
-        
-        static int PICaptureCompareDescending( const void * a, const void * b )
-        {
-            return PICaptureCompare( b, a );
-        } //PICaptureCompareDescending
-        
-        static int PIPathCompareDescending( const void * a, const void * b )
-        {
-            return PIPathCompare( b, a );
-        } //PIPathCompareDescendingDescending
+            vector<uint32_t> order( keys.size() );
+            for ( size_t i = 0; i < keys.size(); i++ )
+                order[ i ] = keys[ i ].index;
+
+            Reorder( order );
+        } //SortOnKey
 
         void PrintList()
         {
             for ( size_t i = 0; i < Count(); i++ )
             {
                 PathItem & e = elements[i];
-                tracer.Trace( "path %ws\n", e.pwcPath );
+                tracer.Trace( "path %ws\n", Get( i ) );
 
                 SYSTEMTIME st;
                 ULARGE_INTEGER uli;
@@ -145,21 +130,26 @@ class CPathArray
         }
 
         size_t Count() { return elements.size(); }
-        WCHAR * Get( size_t i ) { return elements[ i ].pwcPath; }
+        size_t Bytes() { return elements.capacity() * sizeof( PathItem ) + strings.capacity() * sizeof( WCHAR ); }
+        WCHAR * Get( size_t i ) { return strings.data() + elements[ i ].pathOffset; }
         PathItem & GetPathItem( size_t i ) { return elements[ i ]; }
         PathItem & operator[] ( size_t i ) { return elements[ i ]; }
 
         void Clear()
         {
-            for ( size_t i = 0; i < elements.size(); i++ )
-            {
-                delete elements[ i ].pwcPath;
-                elements[ i ].pwcPath = NULL;
-            }
-
             elements.resize( 0 );
+            strings.resize( 0 );
         } //Clear
 
+        // For callers that know roughly how many paths are coming, to avoid regrowing the arrays
+
+        void Reserve( size_t paths, size_t averageLength = 64 )
+        {
+            lock_guard<mutex> lock( mtx );
+            elements.reserve( paths );
+            strings.reserve( paths * ( averageLength + 1 ) );
+        } //Reserve
+
         void Randomize()
         {
             if ( elements.size() <= 1 )
@@ -180,22 +170,36 @@ class CPathArray
 
         void SortOnAttribute( bool ascending = true )
         {
-            qsort( elements.data(), elements.size(), sizeof PathItem, ascending ? PIAttributeCompare : PIAttributeCompareDescending );
+            SortOnKey( [] ( const PathItem & pi ) { return (uint64_t) pi.ulAttribute; }, ascending );
         } //SortOnAttribute
 
         void SortOnLastWrite( bool ascending = true )
         {
-            qsort( elements.data(), elements.size(), sizeof PathItem, ascending ? PILastWriteCompare : PILastWriteCompareDescending );
+            SortOnKey( [] ( const PathItem & pi ) { return FTKey( pi.ftLastWrite ); }, ascending );
         } //SortOnLastWrite
 
         void SortOnCreation( bool ascending = true )
         {
-            qsort( elements.data(), elements.size(), sizeof PathItem, ascending ? PICreationCompare : PICreationCompareDescending );
+            SortOnKey( [] ( const PathItem & pi ) { return FTKey( pi.ftCreation ); }, ascending );
         } //SortOnCreation
 
         void SortOnPath( bool ascending = true )
         {
-            qsort( elements.data(), elements.size(), sizeof PathItem, ascending ? PIPathCompare : PIPathCompareDescending );
+            // Sort indexes rather than the items so the merges move 4 bytes per element
+
+            const WCHAR * base = strings.data();
+            const PathItem * items = elements.data();
+            vector<uint32_t> order( elements.size() );
+
+            for ( size_t i = 0; i < order.size(); i++ )
+                order[ i ] = (uint32_t) i;
+
+            if ( ascending )
+                CParallelSort::MergeSort( order, [&] ( uint32_t a, uint32_t b ) { return wcscmp( base + items[ a ].pathOffset, base + items[ b ].pathOffset ) < 0; } );
+            else
+                CParallelSort::MergeSort( order, [&] ( uint32_t a, uint32_t b ) { return wcscmp( base + items[ b ].pathOffset, base + items[ a ].pathOffset ) < 0; } );
+
+            Reorder( order );
         } //SortOnPath
 
         void SortOnCapture( bool ascending = true )
@@ -214,7 +218,7 @@ class CPathArray
                     char dateTime[ 20 ];
                     dateTime[0] = 0;
 
-                    if ( ( id.FindDateTime( elements[i].pwcPath, dateTime, _countof( dateTime ) ) ) &&
+                    if ( ( id.FindDateTime( Get( i ), dateTime, _countof( dateTime ) ) ) &&
                          ( 19 == strlen( dateTime ) ) )
                     {
                         // 2005:02:17 21:21:31
@@ -240,7 +244,7 @@ class CPathArray
                 captureTimesLoaded = true;
             }
 
-            qsort( elements.data(), elements.size(), sizeof PathItem, ascending ? PICaptureCompare : PICaptureCompareDescending );
+            SortOnKey( [] ( const PathItem & pi ) { return FTKey( pi.ftCapture ); }, ascending );
             tracer.Trace( "sorted on capture time, ascending %d\n", ascending );
             PrintList();
         } //SortOnCapture
@@ -256,45 +260,37 @@ class CPathArray
 
         void Add( WCHAR * pwc, FILETIME & creation, FILETIME & lastWrite )
         {
-            PathItem pi;
+            PathItem pi = {};
             pi.ftCreation = creation;
             pi.ftLastWrite = lastWrite;
-            size_t len = 1 + wcslen( pwc );
-            pi.pwcPath = new WCHAR[ len ];
-            wcscpy_s( pi.pwcPath, len, pwc );
 
             // defer loading capture times until absolutely needed because it's slow
 
-            ZeroMemory( &pi.ftCapture, sizeof pi.ftCapture );
-
+            size_t len = wcslen( pwc );
             lock_guard<mutex> lock( mtx );
 
-            elements.push_back( pi );
+            if ( AddString( pwc, len, pi ) )
+                elements.push_back( pi );
         } //Add
 
         void Add( WCHAR * pwc )
         {
             PathItem pi = {};
-            size_t len = 1 + wcslen( pwc );
-            pi.pwcPath = new WCHAR[ len ];
-            wcscpy_s( pi.pwcPath, len, pwc );
-
+            size_t len = wcslen( pwc );
             lock_guard<mutex> lock( mtx );
 
-            elements.push_back( pi );
+            if ( AddString( pwc, len, pi ) )
+                elements.push_back( pi );
         } //Add
 
         void Add( char * pc )
         {
-            PathItem pi = {};
             size_t len = 1 + strlen( pc );
-            pi.pwcPath = new WCHAR[ len ];
+            vector<WCHAR> wide( len );
             size_t outputLen = 0;
-            mbstowcs_s( &outputLen, pi.pwcPath, len, pc, len );
-
-            lock_guard<mutex> lock( mtx );
+            mbstowcs_s( &outputLen, wide.data(), len, pc, len );
 
-            elements.push_back( pi );
+            Add( wide.data() );
         } //Add
 
         bool Delete( size_t item )
@@ -304,8 +300,7 @@ class CPathArray
             if ( item >= elements.size() )
                 return false;
 
-            delete elements[ item ].pwcPath;
-            elements[ item ].pwcPath = NULL;
+            // The path stays in the arena until Clear()
 
             elements.erase( elements.begin() + item );
 
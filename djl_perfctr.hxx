@@ -0,0 +1,139 @@
+#pragma once
+
+//
+// Per-stage CPU cycle accounting, to tell stages that compute from stages that wait on memory or other threads.
+// Each stage accumulates the calls, wall time, cycles of the thread doing the work (QueryThreadCycleTime) and the
+// bytes it touched. Cycles per byte shows how hard a stage works on its data; cycles per wall second far below the
+// clock rate means the thread was descheduled, blocked or helping other tasks for part of the stage.
+// Cycles are charged to the stage the measuring thread is in. A worker that runs another image's row blocks
+// while it waits charges those cycles to its own wait stage, so for stages that split into row blocks (flip,
+// rotate, transitions) the counts cover the calling thread's share of the work.
+// Windows only.
+// Usage:
+//    CStageCounters counters( stageCount );
+//    counters.Enable( true );
+//    CStageClock clock( counters );          // one per thread of work, like CPerfTime
+//    ...load...
+//    clock.Mark( stageLoad, bytesDecoded );  // charges the cycles since the previous Mark (or construction)
+//    CStageCounters::Stats s = counters.GetStats( stageLoad );
+//
+
+#include <windows.h>
+
+#include <atomic>
+#include <vector>
+
+using namespace std;
+
+class CStageCounters
+{
+    public:
+        struct Stats
+        {
+            long long calls;
+            long long ticks;     // QueryPerformanceCounter units
+            long long cycles;
+            long long bytes;
+        };
+
+    private:
+        struct Stage
+        {
+            atomic<long long> calls;
+            atomic<long long> ticks;
+            atomic<long long> cycles;
+            atomic<long long> bytes;
+        };
+
+        vector<Stage> stages;
+        bool enabled;
+
+    public:
+        CStageCounters( size_t count ) : stages( count ), enabled( false )
+        {
+            for ( size_t s = 0; s < stages.size(); s++ )
+            {
+                stages[ s ].calls = 0;
+                stages[ s ].ticks = 0;
+                stages[ s ].cycles = 0;
+                stages[ s ].bytes = 0;
+            }
+        }
+
+        void Enable( bool enable ) { enabled = enable; }
+        bool Enabled() { return enabled; }
+        size_t Count() { return stages.size(); }
+
+        static ULONG64 ThreadCycles()
+        {
+            ULONG64 cycles = 0;
+            QueryThreadCycleTime( GetCurrentThread(), &cycles );
+            return cycles;
+        } //ThreadCycles
+
+        static LONGLONG Ticks()
+        {
+            LARGE_INTEGER li;
+            QueryPerformanceCounter( &li );
+            return li.QuadPart;
+        } //Ticks
+
+        void Add( size_t stage, long long ticks, long long cycles, long long bytes )
+        {
+            Stage & s = stages[ stage ];
+            s.calls++;
+            s.ticks += ticks;
+            s.cycles += cycles;
+            s.bytes += bytes;
+        } //Add
+
+        Stats GetStats( size_t stage )
+        {
+            Stage & s = stages[ stage ];
+            Stats stats = { s.calls, s.ticks, s.cycles, s.bytes };
+            return stats;
+        } //GetStats
+}; //CStageCounters
+
+class CStageClock
+{
+    private:
+        CStageCounters & counters;
+        ULONG64 lastCycles;
+        LONGLONG lastTicks;
+
+    public:
+        CStageClock( CStageCounters & c ) : counters( c ), lastCycles( 0 ), lastTicks( 0 )
+        {
+            if ( counters.Enabled() )
+            {
+                lastCycles = CStageCounters::ThreadCycles();
+                lastTicks = CStageCounters::Ticks();
+            }
+        }
+
+        // Charges the time since the last Mark to stage. Must be called on the thread that constructed the clock.
+
+        void Mark( size_t stage, long long bytes = 0 )
+        {
+            if ( !counters.Enabled() )
+                return;
+
+            ULONG64 cycles = CStageCounters::ThreadCycles();
+            LONGLONG ticks = CStageCounters::Ticks();
+            counters.Add( stage, ticks - lastTicks, (long long) ( cycles - lastCycles ), bytes );
+            lastCycles = cycles;
+            lastTicks = ticks;
+        } //Mark
+
+        // Starts the next stage now without charging the time since the last Mark to anything
+
+        void Skip()
+        {
+            if ( counters.Enabled() )
+            {
+                lastCycles = CStageCounters::ThreadCycles();
+                lastTicks = CStageCounters::Ticks();
+            }
+        } //Skip
+}; //CStageClock
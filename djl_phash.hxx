@@ -0,0 +1,120 @@
+#pragma once
+
+//
+// 64-bit difference hash (dHash) of a 24bpp or 32bpp image (djl_pixel.hxx), for spotting near-duplicate photos such as bursts.
+// The image is divided into a 9 x 8 grid of cells and each cell's brightness is estimated from a few rows of it.
+// Bit ( y * 8 + x ) is set when cell ( x, y ) is brighter than cell ( x + 1, y ). Similar images have hashes a
+// small Hamming distance apart; 64 bits differ at most.
+// Only SampleRows rows per cell are read, and each of those rows is summed 16 bytes at a time with SSE2 on x64,
+// so hashing an already-decoded frame costs a few microseconds. Brightness is B + G + R; the channel weights of
+// true luma don't change which of two neighboring cells is brighter often enough to matter here. The unused
+// byte of 32bpp pixels is masked off, so both formats hash an image the same.
+// Usage:
+//    uint64_t hash = CPerceptualHash::DHash<CPixelBgr24>( pBits, width, height, stride );
+//    if ( CPerceptualHash::Distance( hash, previousHash ) <= threshold ) { ...near duplicate... }
+//
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <djl_pixel.hxx>
+
+#if defined( _M_X64 ) || defined( __x86_64__ )
+    #define DJL_PHASH_X64
+    #include <emmintrin.h>
+#endif
+
+class CPerceptualHash
+{
+    private:
+        static const int GridW = 9;
+        static const int GridH = 8;
+        static const int SampleRows = 4;
+
+        // Sum of the B, G and R bytes of the count bytes at p, which start on a pixel boundary
+
+        template <typename P> static uint64_t SumPixels( const uint8_t * p, size_t count )
+        {
+            uint64_t sum = 0;
+            size_t i = 0;
+
+            #ifdef DJL_PHASH_X64
+                __m128i zero = _mm_setzero_si128();
+                __m128i acc = _mm_setzero_si128();
+                __m128i mask = ( 4 == P::Bytes ) ? _mm_set1_epi32( 0x00ffffff ) : _mm_set1_epi8( -1 );
+
+                // 16 bytes are whole 4-byte pixels, so the mask stays lined up; 3-byte pixels have nothing to mask
+
+                for ( ; i + 16 <= count; i += 16 )
+                    acc = _mm_add_epi64( acc, _mm_sad_epu8( _mm_and_si128( _mm_loadu_si128( (const __m128i *) ( p + i ) ), mask ), zero ) );
+
+                sum = (uint64_t) _mm_cvtsi128_si64( acc ) + (uint64_t) _mm_cvtsi128_si64( _mm_unpackhi_epi64( acc, acc ) );
+            #endif
+
+            for ( ; i < count; i++ )
+                if ( 4 != P::Bytes || 3 != ( i & 3 ) )
+                    sum += p[ i ];
+
+            return sum;
+        } //SumPixels
+
+    public:
+        // stride may be negative for bottom-up images, with pBits pointing at the top row
+
+        template <typename P> static uint64_t DHash( const uint8_t * pBits, int width, int height, int stride )
+        {
+            if ( width < GridW || height < GridH )
+                return 0;
+
+            uint64_t cells[ GridH ][ GridW ];
+
+            for ( int gy = 0; gy < GridH; gy++ )
+            {
+                int top = height * gy / GridH;
+                int rows = height * ( gy + 1 ) / GridH - top;
+
+                for ( int gx = 0; gx < GridW; gx++ )
+                {
+                    int left = width * gx / GridW;
+                    int cols = width * ( gx + 1 ) / GridW - left;
+                    uint64_t sum = 0;
+
+                    // Every cell samples the same number of rows, spread evenly through it, so only its width needs normalizing
+
+                    for ( int s = 0; s < SampleRows; s++ )
+                    {
+                        int y = top + ( rows * ( 2 * s + 1 ) ) / ( 2 * SampleRows );
+                        sum += SumPixels<P>( pBits + (ptrdiff_t) y * stride + (ptrdiff_t) left * P::Bytes, (size_t) cols * P::Bytes );
+                    }
+
+                    cells[ gy ][ gx ] = sum * 65536 / ( (uint64_t) cols * 3 );
+                }
+            }
+
+            uint64_t hash = 0;
+
+            for ( int gy = 0; gy < GridH; gy++ )
+                for ( int gx = 0; gx < GridW - 1; gx++ )
+                    if ( cells[ gy ][ gx ] > cells[ gy ][ gx + 1 ] )
+                        hash |= ( 1ull << ( gy * 8 + gx ) );
+
+            return hash;
+        } //DHash
+
+        static int Distance( uint64_t a, uint64_t b )
+        {
+            uint64_t x = a ^ b;
+
+            // __popcnt64 needs a CPU with POPCNT, which x64 doesn't guarantee, so count bits in parallel instead
+
+            #ifdef __GNUC__
+                return __builtin_popcountll( x );
+            #else
+                x = x - ( ( x >> 1 ) & 0x5555555555555555ull );
+                x = ( x & 0x3333333333333333ull ) + ( ( x >> 2 ) & 0x3333333333333333ull );
+                x = ( x + ( x >> 4 ) ) & 0x0f0f0f0f0f0f0f0full;
+                return (int) ( ( x * 0x0101010101010101ull ) >> 56 );
+            #endif
+        } //Distance
+}; //CPerceptualHash
@@ -0,0 +1,53 @@
+#pragma once
+
+//
+// The pixel formats images and frames can be composed in, as types for templating kernels on. A kernel written
+// against P::Bytes gets the pixel size as a compile-time constant, so per-pixel loops over channels unroll and
+// row loops step by a constant the compiler can vectorize, instead of multiplying by a runtime bytes-per-pixel.
+// Both formats are in memory order B, G, R, like GDI+ PixelFormat24bppRGB and PixelFormat32bppRGB, WIC's 24bppBGR
+// and 32bppBGR, and Media Foundation's RGB24 and RGB32. The fourth byte of a 32bpp pixel is unused: kernels carry
+// it along like a channel, set it to 255 when they make pixels up, and never depend on what it holds.
+// 24bpp moves a quarter fewer bytes; 32bpp keeps every pixel in one aligned 4-byte word. Which is faster depends
+// on the CPU and the resolution, so it's chosen at run time and cvbench measures both.
+// Usage:
+//    template <typename P> void Kernel( uint8_t * p, int w ) { for ( int x = 0; x < w; x++, p += P::Bytes ) ... }
+//    DispatchPixel( bytesPerPixel, [&] ( auto pixel ) { Kernel<decltype( pixel )>( p, w ); } );
+//
+
+#include <stdint.h>
+#include <string.h>
+
+struct CPixelBgr24
+{
+    static const int Bytes = 3;
+
+    static void Set( uint8_t * p, uint8_t blue, uint8_t green, uint8_t red )
+    {
+        p[ 0 ] = blue;
+        p[ 1 ] = green;
+        p[ 2 ] = red;
+    } //Set
+}; //CPixelBgr24
+
+struct CPixelBgrx32
+{
+    static const int Bytes = 4;
+
+    static void Set( uint8_t * p, uint8_t blue, uint8_t green, uint8_t red )
+    {
+        p[ 0 ] = blue;
+        p[ 1 ] = green;
+        p[ 2 ] = red;
+        p[ 3 ] = 255;
+    } //Set
+}; //CPixelBgrx32
+
+// Calls f with a CPixelBgrx32 when bytesPerPixel is 4 and a CPixelBgr24 otherwise
+
+template <typename F> void DispatchPixel( int bytesPerPixel, F f )
+{
+    if ( 4 == bytesPerPixel )
+        f( CPixelBgrx32() );
+    else
+        f( CPixelBgr24() );
+} //DispatchPixel
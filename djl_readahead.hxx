@@ -0,0 +1,366 @@
+#pragma once
+
+//
+// Reads upcoming input files into memory ahead of the workers that decode them, so the CPUs don't sit idle
+// waiting on slow disks or network shares. Files are read in the order given, with overlapped I/O, keeping
+// at most maxFiles files and maxBytes bytes in flight or waiting to be consumed.
+// A background thread opens files and issues the reads (opens can be slow on network shares too); the reads
+// themselves complete in the kernel. A consumer that asks for a file the thread hasn't gotten to yet reads it
+// itself rather than waiting, so workers can never deadlock on the budget no matter the order they ask in.
+// If a file can't be read, Acquire returns false and the caller should open the file by path as before.
+// Buffers come from the arena (djl_arena.hxx). Windows only.
+// Usage:
+//    CReadAhead readAhead( 16, 256 * 1024 * 1024 );
+//    readAhead.Start( paths );                         // vector<const WCHAR *>; must stay valid until Stop()
+//    const byte * p; size_t cb;
+//    if ( readAhead.Acquire( i, p, cb ) ) { ...decode from p... }
+//    readAhead.Release( i );                           // after Acquire, whether it succeeded or not
+//    readAhead.Stop();
+//
+
+#include <windows.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <djltrace.hxx>
+#include <djl_arena.hxx>
+
+using namespace std;
+
+class CReadAhead
+{
+    public:
+        struct Stats
+        {
+            long long filesRead;        // read ahead by the background thread
+            long long filesOnDemand;    // read by a consumer because the background thread wasn't there yet
+            long long filesFailed;
+            long long bytesRead;        // both kinds
+            long long waitNS;           // consumers blocked waiting for reads to complete or files to open
+            long long readNS;           // consumers reading files themselves
+        };
+
+    private:
+        enum SlotState { slotIdle, slotOpening, slotIssued, slotOnDemand, slotFailed, slotReleased };
+
+        struct Slot
+        {
+            SlotState state;
+            HANDLE file;
+            OVERLAPPED ov;
+            byte * data;
+            size_t bytes;
+            bool counted;   // included in the in-flight budget
+        };
+
+        size_t maxFiles;
+        size_t maxBytes;
+        vector<const WCHAR *> paths;
+        vector<Slot> slots;
+        size_t next;              // the next file the background thread will issue
+        size_t inFlightFiles;
+        size_t inFlightBytes;
+        bool stopping;
+        Stats stats;
+
+        mutex mtx;
+        condition_variable cvIssue;   // the budget or stopping changed
+        condition_variable cvSlot;    // a slot left slotOpening
+        thread issuer;
+
+        static long long NowNS()
+        {
+            return chrono::duration_cast<chrono::nanoseconds>( chrono::steady_clock::now().time_since_epoch() ).count();
+        } //NowNS
+
+        static HANDLE OpenFile( const WCHAR * pwcPath, bool overlapped, size_t & bytes )
+        {
+            DWORD flags = FILE_FLAG_SEQUENTIAL_SCAN | ( overlapped ? FILE_FLAG_OVERLAPPED : 0 );
+            HANDLE h = CreateFileW( pwcPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, flags, NULL );
+
+            if ( INVALID_HANDLE_VALUE == h )
+                return h;
+
+            LARGE_INTEGER li;
+
+            // ReadFile takes a DWORD count. No photo gets near that; let the caller's decoder deal with anything that does.
+
+            if ( !GetFileSizeEx( h, &li ) || 0 == li.QuadPart || li.QuadPart > MAXDWORD )
+            {
+                CloseHandle( h );
+                return INVALID_HANDLE_VALUE;
+            }
+
+            bytes = (size_t) li.QuadPart;
+            return h;
+        } //OpenFile
+
+        bool BudgetAvailable()
+        {
+            // One file always fits, even if it's larger than the whole byte budget
+
+            return ( 0 == inFlightFiles ) || ( inFlightFiles < maxFiles && inFlightBytes < maxBytes );
+        } //BudgetAvailable
+
+        void Issue( size_t i )
+        {
+            size_t bytes = 0;
+            HANDLE h = OpenFile( paths[ i ], true, bytes );
+            byte * data = NULL;
+            bool ok = ( INVALID_HANDLE_VALUE != h );
+
+            if ( ok )
+            {
+                data = (byte *) arena.Alloc( bytes, memTagReadAhead );
+                ok = ( NULL != data );
+            }
+
+            Slot & slot = slots[ i ];
+            ZeroMemory( &slot.ov, sizeof slot.ov );
+
+            if ( ok )
+            {
+                slot.ov.hEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+                ok = ( NULL != slot.ov.hEvent );
+            }
+
+            if ( ok && !ReadFile( h, data, (DWORD) bytes, NULL, &slot.ov ) && ERROR_IO_PENDING != GetLastError() )
+            {
+                tracer.Trace( "read ahead of %ws failed, error %d\n", paths[ i ], GetLastError() );
+                ok = false;
+            }
+
+            lock_guard<mutex> lock( mtx );
+
+            if ( ok )
+            {
+                slot.file = h;
+                slot.data = data;
+                slot.bytes = bytes;
+                slot.state = slotIssued;
+                inFlightBytes += bytes;
+            }
+            else
+            {
+                if ( slot.ov.hEvent )
+                    CloseHandle( slot.ov.hEvent );
+
+                if ( INVALID_HANDLE_VALUE != h )
+                    CloseHandle( h );
+
+                arena.Free( data );
+                slot.state = slotFailed;
+                slot.counted = false;
+                inFlightFiles--;
+                stats.filesFailed++;
+                cvIssue.notify_one();
+            }
+
+            cvSlot.notify_all();
+        } //Issue
+
+        void IssueLoop()
+        {
+            unique_lock<mutex> lock( mtx );
+
+            do
+            {
+                cvIssue.wait( lock, [&] { return stopping || ( next < slots.size() && BudgetAvailable() ); } );
+
+                if ( stopping )
+                    break;
+
+                size_t i = next++;
+
+                if ( slotIdle != slots[ i ].state )
+                    continue;   // a consumer got there first
+
+                slots[ i ].state = slotOpening;
+                slots[ i ].counted = true;
+                inFlightFiles++;
+
+                lock.unlock();
+                Issue( i );
+                lock.lock();
+            } while ( next < slots.size() );
+        } //IssueLoop
+
+        // Reads a file synchronously when the background thread hasn't issued it yet
+
+        bool ReadOnDemand( size_t i, const byte * & data, size_t & bytes )
+        {
+            long long start = NowNS();
+            size_t cb = 0;
+            HANDLE h = OpenFile( paths[ i ], false, cb );
+
+            if ( INVALID_HANDLE_VALUE == h )
+                return false;
+
+            byte * p = (byte *) arena.Alloc( cb, memTagReadAhead );
+            DWORD read = 0;
+            bool ok = ( NULL != p ) && ReadFile( h, p, (DWORD) cb, &read, NULL ) && ( read == cb );
+            CloseHandle( h );
+
+            lock_guard<mutex> lock( mtx );
+
+            if ( !ok )
+            {
+                arena.Free( p );
+                stats.filesFailed++;
+                return false;
+            }
+
+            slots[ i ].data = p;
+            slots[ i ].bytes = cb;
+            stats.filesOnDemand++;
+            stats.bytesRead += cb;
+            stats.readNS += NowNS() - start;
+            data = p;
+            bytes = cb;
+            return true;
+        } //ReadOnDemand
+
+    public:
+        CReadAhead( size_t files, size_t bytes ) : maxFiles( files ), maxBytes( bytes ), next( 0 ), inFlightFiles( 0 ),
+                                                   inFlightBytes( 0 ), stopping( false )
+        {
+            memset( &stats, 0, sizeof stats );
+        }
+
+        ~CReadAhead() { Stop(); }
+
+        void Start( const vector<const WCHAR *> & p )
+        {
+            Stop();
+
+            paths = p;
+            slots.assign( paths.size(), Slot() );
+
+            for ( size_t i = 0; i < slots.size(); i++ )
+            {
+                slots[ i ].state = slotIdle;
+                slots[ i ].file = INVALID_HANDLE_VALUE;
+                slots[ i ].data = NULL;
+                slots[ i ].bytes = 0;
+                slots[ i ].counted = false;
+            }
+
+            next = 0;
+            inFlightFiles = 0;
+            inFlightBytes = 0;
+            stopping = false;
+            issuer = thread( [this] { IssueLoop(); } );
+        } //Start
+
+        // Waits for file i to be in memory. Returns false if it couldn't be read; the caller should open it by path.
+
+        bool Acquire( size_t i, const byte * & data, size_t & bytes )
+        {
+            unique_lock<mutex> lock( mtx );
+            Slot & slot = slots[ i ];
+
+            if ( slotIdle == slot.state )
+            {
+                slot.state = slotOnDemand;
+                lock.unlock();
+                return ReadOnDemand( i, data, bytes );
+            }
+
+            long long start = NowNS();
+            cvSlot.wait( lock, [&] { return slotOpening != slot.state; } );
+
+            if ( slotIssued != slot.state )
+            {
+                stats.waitNS += NowNS() - start;
+                return false;
+            }
+
+            lock.unlock();
+
+            DWORD read = 0;
+            bool ok = GetOverlappedResult( slot.file, &slot.ov, &read, TRUE ) && ( read == slot.bytes );
+
+            CloseHandle( slot.ov.hEvent );
+            CloseHandle( slot.file );
+            slot.ov.hEvent = NULL;
+            slot.file = INVALID_HANDLE_VALUE;
+
+            lock.lock();
+            stats.waitNS += NowNS() - start;
+
+            if ( !ok )
+            {
+                tracer.Trace( "read ahead of %ws didn't complete\n", paths[ i ] );
+                stats.filesFailed++;
+                return false;
+            }
+
+            stats.filesRead++;
+            stats.bytesRead += slot.bytes;
+            data = slot.data;
+            bytes = slot.bytes;
+            return true;
+        } //Acquire
+
+        // Frees file i's memory and lets the background thread read further ahead
+
+        void Release( size_t i )
+        {
+            lock_guard<mutex> lock( mtx );
+            Slot & slot = slots[ i ];
+
+            arena.Free( slot.data );
+            slot.data = NULL;
+            slot.state = slotReleased;
+
+            if ( slot.counted )
+            {
+                slot.counted = false;
+                inFlightFiles--;
+                inFlightBytes -= slot.bytes;
+                cvIssue.notify_one();
+            }
+        } //Release
+
+        // Call once consumers are done. Stops reading ahead and cancels reads nobody acquired.
+
+        void Stop()
+        {
+            {
+                lock_guard<mutex> lock( mtx );
+                stopping = true;
+                cvIssue.notify_all();
+            }
+
+            if ( issuer.joinable() )
+                issuer.join();
+
+            for ( size_t i = 0; i < slots.size(); i++ )
+            {
+                Slot & slot = slots[ i ];
+
+                if ( slotIssued == slot.state && INVALID_HANDLE_VALUE != slot.file )
+                {
+                    DWORD read;
+                    CancelIoEx( slot.file, &slot.ov );
+                    GetOverlappedResult( slot.file, &slot.ov, &read, TRUE );
+                    CloseHandle( slot.ov.hEvent );
+                    CloseHandle( slot.file );
+                    arena.Free( slot.data );
+                    slot.data = NULL;
+                    slot.file = INVALID_HANDLE_VALUE;
+                    slot.state = slotReleased;
+                }
+            }
+        } //Stop
+
+        Stats GetStats()
+        {
+            lock_guard<mutex> lock( mtx );
+            return stats;
+        } //GetStats
+}; //CReadAhead
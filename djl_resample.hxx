@@ -0,0 +1,578 @@
+#pragma once
+
+//
+// Separable resampler for 24bpp and 32bpp images, templated on the pixel format (djl_pixel.hxx). It takes no
+// locks while scaling and runs its rows on the scheduler.
+// Filter tables are built once per ( source size, destination size, filter ) and cached, since a slideshow scales
+// many images between the same few sizes. Weights are 14-bit fixed point.
+// Each destination row is a vertical pass (source rows -> one 16-bit intermediate row, AVX2 when available)
+// followed by a horizontal pass over the interleaved pixels. The vertical pass only sees bytes, so it's the same
+// for every format; the horizontal pass is unrolled over the pixel's channels. Memory beyond source and
+// destination is one intermediate row per task.
+//
+// In one source file, declare the CResampler named resampler like this:
+//    CResampler resampler;
+// Usage:
+//    resampler.Resample<CPixelBgr24>( pSrc, srcW, srcH, srcStride, pDst, dstW, dstH, dstStride, CResampler::filterLanczos3 );
+//
+// Viewport bilinearly samples a moving, fractional-pixel viewport of an image (pan and zoom effects).
+//    resampler.Viewport<CPixelBgr24>( pSrc, srcW, srcH, srcStride, x, y, viewW, viewH, pDst, dstW, dstH, dstStride );
+//
+// CStripeResampler does what Resample does for an image that arrives a stripe of rows at a time, e.g. from a decoder.
+// Source rows are scaled horizontally as they arrive and kept in a ring just deep enough for the vertical filter,
+// so memory doesn't depend on the source's height.
+//    CStripeResampler<CPixelBgr24> stripes( resampler, srcW, srcH, pDst, dstW, dstH, dstStride, filter, stripeRows );
+//    for each stripe, top to bottom: stripes.AddRows( pRows, rowStride, rowCount );
+//
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if defined( _M_X64 ) || defined( __x86_64__ )
+    #define DJL_RESAMPLE_X64
+    #include <immintrin.h>
+
+    #ifdef _MSC_VER
+        #include <intrin.h>
+        #define DJL_TARGET_AVX2
+    #else
+        #define DJL_TARGET_AVX2 __attribute__(( target( "avx2" ) ))
+    #endif
+#endif
+
+#include <djl_sched.hxx>
+#include <djl_pixel.hxx>
+
+using namespace std;
+
+template <typename P> class CStripeResampler;
+
+class CResampler
+{
+    template <typename P> friend class CStripeResampler;
+
+    public:
+        enum Filter { filterBilinear = 0, filterBicubic = 1, filterLanczos3 = 2 };
+
+    private:
+        static const int WeightBits = 14;
+        static const int IntermediateShift = 8;   // vertical pass output is ( pixel << 6 ); lanczos overshoot still fits in int16
+        static const int FinalShift = ( 2 * WeightBits ) - IntermediateShift;
+
+        // For each destination pixel, the first source pixel and the weights of count source pixels
+
+        struct Table
+        {
+            int taps;                // max weights per destination pixel; weights are padded with zeros to this
+            vector<int> start;
+            vector<int> count;
+            vector<int16_t> weights; // taps per destination pixel
+        };
+
+        std::mutex mtx;
+        map<uint64_t, shared_ptr<Table>> tables;
+        bool avx2;
+
+        static double Kernel( Filter f, double x )
+        {
+            x = fabs( x );
+
+            if ( filterBilinear == f )
+                return ( x < 1.0 ) ? 1.0 - x : 0.0;
+
+            if ( filterBicubic == f )
+            {
+                // Catmull-Rom, a = -0.5
+
+                const double a = -0.5;
+
+                if ( x < 1.0 )
+                    return ( ( a + 2.0 ) * x - ( a + 3.0 ) ) * x * x + 1.0;
+                if ( x < 2.0 )
+                    return ( ( ( x - 5.0 ) * x + 8.0 ) * x - 4.0 ) * a;
+                return 0.0;
+            }
+
+            if ( x < 1e-8 )
+                return 1.0;
+
+            if ( x < 3.0 )
+            {
+                const double pi = 3.14159265358979323846;
+                double px = pi * x;
+                return ( sin( px ) / px ) * ( sin( px / 3.0 ) / ( px / 3.0 ) );
+            }
+
+            return 0.0;
+        } //Kernel
+
+        static double Radius( Filter f )
+        {
+            return ( filterBilinear == f ) ? 1.0 : ( filterBicubic == f ) ? 2.0 : 3.0;
+        } //Radius
+
+        static shared_ptr<Table> BuildTable( int srcSize, int dstSize, Filter f )
+        {
+            shared_ptr<Table> t = make_shared<Table>();
+            double scale = (double) srcSize / (double) dstSize;
+            double filterScale = max( scale, 1.0 );          // widen the kernel when shrinking
+            double support = Radius( f ) * filterScale;
+
+            t->taps = min( srcSize, (int) ceil( support * 2.0 ) + 2 );
+            t->start.resize( dstSize );
+            t->count.resize( dstSize );
+            t->weights.assign( (size_t) dstSize * t->taps, 0 );
+            vector<double> w( t->taps );
+
+            for ( int i = 0; i < dstSize; i++ )
+            {
+                double center = ( i + 0.5 ) * scale;
+                int left = max( 0, (int) floor( center - support ) );
+                int right = min( srcSize - 1, (int) ceil( center + support ) );
+                int n = min( right - left + 1, t->taps );
+                double sum = 0.0;
+
+                for ( int j = 0; j < n; j++ )
+                {
+                    w[ j ] = Kernel( f, ( left + j + 0.5 - center ) / filterScale );
+                    sum += w[ j ];
+                }
+
+                // Trim zero weights from both ends so the passes don't touch pixels that don't contribute
+
+                int first = 0;
+                while ( first < ( n - 1 ) && 0.0 == w[ first ] )
+                    first++;
+
+                while ( n > ( first + 1 ) && 0.0 == w[ n - 1 ] )
+                    n--;
+
+                int16_t * pw = t->weights.data() + (size_t) i * t->taps;
+                int total = 0;
+                int biggest = 0;
+
+                for ( int j = first; j < n; j++ )
+                {
+                    pw[ j - first ] = (int16_t) lround( ( w[ j ] / sum ) * ( 1 << WeightBits ) );
+                    total += pw[ j - first ];
+
+                    if ( abs( pw[ j - first ] ) > abs( pw[ biggest ] ) )
+                        biggest = j - first;
+                }
+
+                // Rounding can leave the sum off by a little; fix it so flat areas stay flat
+
+                pw[ biggest ] += (int16_t) ( ( 1 << WeightBits ) - total );
+                t->start[ i ] = left + first;
+                t->count[ i ] = n - first;
+            }
+
+            return t;
+        } //BuildTable
+
+        shared_ptr<Table> GetTable( int srcSize, int dstSize, Filter f )
+        {
+            uint64_t key = ( (uint64_t) srcSize << 34 ) | ( (uint64_t) dstSize << 4 ) | (uint64_t) f;
+
+            lock_guard<mutex> lock( mtx );
+            auto it = tables.find( key );
+            if ( tables.end() != it )
+                return it->second;
+
+            shared_ptr<Table> t = BuildTable( srcSize, dstSize, f );
+            tables[ key ] = t;
+            return t;
+        } //GetTable
+
+        static bool DetectAVX2()
+        {
+#ifdef DJL_RESAMPLE_X64
+    #ifdef _MSC_VER
+            int info[ 4 ];
+            __cpuid( info, 0 );
+            if ( info[ 0 ] < 7 )
+                return false;
+
+            __cpuid( info, 1 );
+            bool osxsave = ( 0 != ( info[ 2 ] & ( 1 << 27 ) ) );
+            bool avx = ( 0 != ( info[ 2 ] & ( 1 << 28 ) ) );
+            if ( !osxsave || !avx || 6 != ( _xgetbv( 0 ) & 6 ) )
+                return false;
+
+            __cpuidex( info, 7, 0 );
+            return ( 0 != ( info[ 1 ] & ( 1 << 5 ) ) );
+    #else
+            return __builtin_cpu_supports( "avx2" );
+    #endif
+#else
+            return false;
+#endif
+        } //DetectAVX2
+
+        static void VerticalScalar( const uint8_t * src, int srcStride, int rowBytes, int first, int count, const int16_t * pw, int16_t * out )
+        {
+            const int round = 1 << ( IntermediateShift - 1 );
+
+            for ( int x = 0; x < rowBytes; x++ )
+            {
+                const uint8_t * p = src + (size_t) first * srcStride + x;
+                int sum = round;
+
+                for ( int j = 0; j < count; j++, p += srcStride )
+                    sum += pw[ j ] * (int) *p;
+
+                out[ x ] = (int16_t) ( sum >> IntermediateShift );
+            }
+        } //VerticalScalar
+
+#ifdef DJL_RESAMPLE_X64
+
+        // 16 bytes per iteration. Rows are taken in pairs so madd does two taps per instruction.
+
+        DJL_TARGET_AVX2 static void VerticalAVX2( const uint8_t * src, int srcStride, int rowBytes, int first, int count, const int16_t * pw, int16_t * out )
+        {
+            const __m256i round = _mm256_set1_epi32( 1 << ( IntermediateShift - 1 ) );
+            int x = 0;
+
+            for ( ; x + 16 <= rowBytes; x += 16 )
+            {
+                __m256i accLo = round;
+                __m256i accHi = round;
+                const uint8_t * p = src + (size_t) first * srcStride + x;
+
+                for ( int j = 0; j < count; j += 2 )
+                {
+                    bool pair = ( ( j + 1 ) < count );
+                    __m256i a = _mm256_cvtepu8_epi16( _mm_loadu_si128( (const __m128i *) p ) );
+                    __m256i b = pair ? _mm256_cvtepu8_epi16( _mm_loadu_si128( (const __m128i *) ( p + srcStride ) ) ) : _mm256_setzero_si256();
+                    uint32_t w2 = (uint16_t) pw[ j ] | ( (uint32_t) (uint16_t) ( pair ? pw[ j + 1 ] : 0 ) << 16 );
+                    __m256i weights = _mm256_set1_epi32( (int) w2 );
+
+                    accLo = _mm256_add_epi32( accLo, _mm256_madd_epi16( _mm256_unpacklo_epi16( a, b ), weights ) );
+                    accHi = _mm256_add_epi32( accHi, _mm256_madd_epi16( _mm256_unpackhi_epi16( a, b ), weights ) );
+                    p += 2 * (size_t) srcStride;
+                }
+
+                // unpack and pack both work within 128-bit lanes, so the packed result is back in pixel order
+
+                accLo = _mm256_srai_epi32( accLo, IntermediateShift );
+                accHi = _mm256_srai_epi32( accHi, IntermediateShift );
+                _mm256_storeu_si256( (__m256i *) ( out + x ), _mm256_packs_epi32( accLo, accHi ) );
+            }
+
+            if ( x < rowBytes )
+                VerticalScalar( src + x, srcStride, rowBytes - x, first, count, pw, out + x );
+        } //VerticalAVX2
+
+#endif
+
+        template <typename P> static void Horizontal( const int16_t * in, uint8_t * out, int dstW, const Table & t )
+        {
+            const int round = 1 << ( FinalShift - 1 );
+
+            for ( int x = 0; x < dstW; x++ )
+            {
+                const int16_t * pw = t.weights.data() + (size_t) x * t.taps;
+                const int16_t * p = in + P::Bytes * t.start[ x ];
+                int n = t.count[ x ];
+                int sum[ P::Bytes ];
+
+                for ( int c = 0; c < P::Bytes; c++ )
+                    sum[ c ] = round;
+
+                for ( int j = 0; j < n; j++, p += P::Bytes )
+                    for ( int c = 0; c < P::Bytes; c++ )
+                        sum[ c ] += pw[ j ] * p[ c ];
+
+                for ( int c = 0; c < P::Bytes; c++ )
+                    out[ c ] = Clamp( sum[ c ] >> FinalShift );
+
+                out += P::Bytes;
+            }
+        } //Horizontal
+
+        static uint8_t Clamp( int v )
+        {
+            return (uint8_t) ( ( v < 0 ) ? 0 : ( v > 255 ) ? 255 : v );
+        } //Clamp
+
+        // Horizontal-first helpers for CStripeResampler. Same fixed point scaling as the vertical-first passes.
+
+        template <typename P> static void HorizontalBytes( const uint8_t * in, int16_t * out, int dstW, const Table & t )
+        {
+            const int round = 1 << ( IntermediateShift - 1 );
+
+            for ( int x = 0; x < dstW; x++ )
+            {
+                const int16_t * pw = t.weights.data() + (size_t) x * t.taps;
+                const uint8_t * p = in + P::Bytes * t.start[ x ];
+                int n = t.count[ x ];
+                int sum[ P::Bytes ];
+
+                for ( int c = 0; c < P::Bytes; c++ )
+                    sum[ c ] = round;
+
+                for ( int j = 0; j < n; j++, p += P::Bytes )
+                    for ( int c = 0; c < P::Bytes; c++ )
+                        sum[ c ] += pw[ j ] * p[ c ];
+
+                for ( int c = 0; c < P::Bytes; c++ )
+                    out[ c ] = (int16_t) ( sum[ c ] >> IntermediateShift );
+
+                out += P::Bytes;
+            }
+        } //HorizontalBytes
+
+        static void VerticalRows( const int16_t * const * rows, int count, const int16_t * pw, int rowLen, uint8_t * out )
+        {
+            const int round = 1 << ( FinalShift - 1 );
+
+            for ( int x = 0; x < rowLen; x++ )
+            {
+                int sum = round;
+
+                for ( int j = 0; j < count; j++ )
+                    sum += pw[ j ] * rows[ j ][ x ];
+
+                out[ x ] = Clamp( sum >> FinalShift );
+            }
+        } //VerticalRows
+
+        // Helpers for Viewport. out = a * ( 256 - w ) + b * w; 8-bit weights, so the sums fit in 16 bits.
+
+        static void LerpRows( const uint8_t * a, const uint8_t * b, int w, int n, uint16_t * out )
+        {
+            int i = 0;
+
+#ifdef DJL_RESAMPLE_X64
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i wb = _mm_set1_epi16( (short) w );
+            const __m128i wa = _mm_set1_epi16( (short) ( 256 - w ) );
+
+            for ( ; i + 16 <= n; i += 16 )
+            {
+                __m128i va = _mm_loadu_si128( (const __m128i *) ( a + i ) );
+                __m128i vb = _mm_loadu_si128( (const __m128i *) ( b + i ) );
+
+                __m128i lo = _mm_add_epi16( _mm_mullo_epi16( _mm_unpacklo_epi8( va, zero ), wa ), _mm_mullo_epi16( _mm_unpacklo_epi8( vb, zero ), wb ) );
+                __m128i hi = _mm_add_epi16( _mm_mullo_epi16( _mm_unpackhi_epi8( va, zero ), wa ), _mm_mullo_epi16( _mm_unpackhi_epi8( vb, zero ), wb ) );
+
+                _mm_storeu_si128( (__m128i *) ( out + i ), lo );
+                _mm_storeu_si128( (__m128i *) ( out + i + 8 ), hi );
+            }
+#endif
+
+            for ( ; i < n; i++ )
+                out[ i ] = (uint16_t) ( a[ i ] * ( 256 - w ) + b[ i ] * w );
+        } //LerpRows
+
+        // Source position of destination sample i: the integer sample at or before it and an 8-bit weight for the next one
+
+        static void BilinearTaps( double origin, double scale, int count, int srcSize, vector<int> & index, vector<int> & weight )
+        {
+            index.resize( count );
+            weight.resize( count );
+
+            for ( int i = 0; i < count; i++ )
+            {
+                double s = origin + ( i + 0.5 ) * scale - 0.5;
+                s = ( s < 0.0 ) ? 0.0 : ( s > ( srcSize - 1 ) ) ? ( srcSize - 1 ) : s;
+
+                int is = (int) s;
+                int w = (int) ( ( s - is ) * 256.0 + 0.5 );
+
+                if ( is >= srcSize - 1 )
+                {
+                    is = max( 0, srcSize - 2 );
+                    w = ( srcSize > 1 ) ? 256 : 0;
+                }
+
+                index[ i ] = is;
+                weight[ i ] = w;
+            }
+        } //BilinearTaps
+
+    public:
+        CResampler() : avx2( DetectAVX2() ) {}
+
+        bool UsingAVX2() { return avx2; }
+
+        // Scales the srcW x srcH image to dstW x dstH. src and dst must not overlap. Strides are in bytes.
+
+        template <typename P> void Resample( const uint8_t * src, int srcW, int srcH, int srcStride,
+                                             uint8_t * dst, int dstW, int dstH, int dstStride, Filter f )
+        {
+            if ( srcW <= 0 || srcH <= 0 || dstW <= 0 || dstH <= 0 )
+                return;
+
+            shared_ptr<Table> horz = GetTable( srcW, dstW, f );
+            shared_ptr<Table> vert = GetTable( srcH, dstH, f );
+            int rowBytes = srcW * P::Bytes;
+
+            // A destination row costs about ( vertical taps * source row ) bytes of reading
+
+            int rowsPerBlock = CTaskScheduler::RowsPerBlock( rowBytes * vert->taps, dstH );
+
+            scheduler.ForRange( 0, dstH, rowsPerBlock, [&] ( int yBegin, int yEnd )
+            {
+                vector<int16_t> row( rowBytes );
+
+                for ( int y = yBegin; y < yEnd; y++ )
+                {
+                    const int16_t * pw = vert->weights.data() + (size_t) y * vert->taps;
+
+#ifdef DJL_RESAMPLE_X64
+                    if ( avx2 )
+                        VerticalAVX2( src, srcStride, rowBytes, vert->start[ y ], vert->count[ y ], pw, row.data() );
+                    else
+#endif
+                        VerticalScalar( src, srcStride, rowBytes, vert->start[ y ], vert->count[ y ], pw, row.data() );
+
+                    Horizontal<P>( row.data(), dst + (size_t) y * dstStride, dstW, *horz );
+                }
+            } );
+        } //Resample
+
+        // Bilinear sampling of the viewport ( x, y, vw, vh ) of src, in source pixels with subpixel precision, into dst.
+        // For per-frame pan and zoom, where the viewport moves a fraction of a pixel per frame and is within a small
+        // factor of the destination size. dstStride may be negative to write the frame bottom-up.
+
+        template <typename P> void Viewport( const uint8_t * src, int srcW, int srcH, int srcStride,
+                                             double x, double y, double vw, double vh,
+                                             uint8_t * dst, int dstW, int dstH, int dstStride )
+        {
+            if ( srcW <= 0 || srcH <= 0 || dstW <= 0 || dstH <= 0 )
+                return;
+
+            vector<int> col, colWeight, row, rowWeight;
+            BilinearTaps( x, vw / dstW, dstW, srcW, col, colWeight );
+            BilinearTaps( y, vh / dstH, dstH, srcH, row, rowWeight );
+
+            // Only the source columns the viewport touches are blended vertically
+
+            int first = col[ 0 ];
+            int last = min( srcW - 1, col[ dstW - 1 ] + 1 );
+            int spanBytes = ( last - first + 1 ) * P::Bytes;
+
+            for ( int i = 0; i < dstW; i++ )
+                col[ i ] = ( col[ i ] - first ) * P::Bytes;   // offset into the blended span
+            int nextRow = ( srcH > 1 ) ? srcStride : 0;
+
+            scheduler.ForRange( 0, dstH, CTaskScheduler::RowsPerBlock( spanBytes * 2, dstH ), [&] ( int yBegin, int yEnd )
+            {
+                vector<uint16_t> lerped( spanBytes + P::Bytes );
+
+                for ( int dy = yBegin; dy < yEnd; dy++ )
+                {
+                    const uint8_t * a = src + (size_t) row[ dy ] * srcStride + first * P::Bytes;
+                    LerpRows( a, a + nextRow, rowWeight[ dy ], spanBytes, lerped.data() );
+
+                    for ( int c = 0; c < P::Bytes; c++ )
+                        lerped[ spanBytes + c ] = lerped[ spanBytes - P::Bytes + c ];
+
+                    // locals, since stores through out could alias the vectors' internals as far as the compiler knows
+
+                    uint8_t * out = dst + (ptrdiff_t) dy * dstStride;
+                    const uint16_t * pl = lerped.data();
+                    const int * pcol = col.data();
+                    const int * pweight = colWeight.data();
+
+                    for ( int dx = 0; dx < dstW; dx++ )
+                    {
+                        const uint16_t * p = pl + pcol[ dx ];
+                        uint32_t wb = pweight[ dx ];
+                        uint32_t wa = 256 - wb;
+
+                        for ( int c = 0; c < P::Bytes; c++ )
+                            out[ c ] = (uint8_t) ( ( p[ c ] * wa + p[ c + P::Bytes ] * wb + 32768 ) >> 16 );
+
+                        out += P::Bytes;
+                    }
+                }
+            } );
+        } //Viewport
+}; //CResampler
+
+extern CResampler resampler;
+
+template <typename P> class CStripeResampler
+{
+    private:
+        CResampler & r;
+        shared_ptr<CResampler::Table> horz;
+        shared_ptr<CResampler::Table> vert;
+        int srcW, srcH;
+        uint8_t * dst;
+        int dstW, dstH, dstStride;
+        int ringRows;                 // holds the rows the next output row needs plus one incoming stripe
+        vector<int16_t> ring;
+        int rowsIn;                   // source rows received so far
+        int rowsOut;                  // destination rows written so far
+
+        int16_t * RingRow( int srcRow ) { return ring.data() + (size_t) ( srcRow % ringRows ) * dstW * P::Bytes; }
+
+    public:
+        CStripeResampler( CResampler & resampler, int sw, int sh, uint8_t * pDst, int dw, int dh, int stride,
+                          CResampler::Filter f, int stripeRows ) :
+            r( resampler ), srcW( sw ), srcH( sh ), dst( pDst ), dstW( dw ), dstH( dh ), dstStride( stride ),
+            rowsIn( 0 ), rowsOut( 0 )
+        {
+            horz = r.GetTable( srcW, dstW, f );
+            vert = r.GetTable( srcH, dstH, f );
+            ringRows = vert->taps + stripeRows;
+            ring.resize( (size_t) ringRows * dstW * P::Bytes );
+        }
+
+        size_t RingBytes() { return ring.size() * sizeof( int16_t ); }
+        bool Done() { return rowsOut == dstH; }
+
+        // rows must arrive top to bottom, at most stripeRows at a time
+
+        void AddRows( const uint8_t * rows, int rowStride, int count )
+        {
+            int first = rowsIn;
+
+            scheduler.ForRange( 0, count, CTaskScheduler::RowsPerBlock( srcW * P::Bytes, count ), [&] ( int begin, int end )
+            {
+                for ( int i = begin; i < end; i++ )
+                    CResampler::HorizontalBytes<P>( rows + (size_t) i * rowStride, RingRow( first + i ), dstW, *horz );
+            } );
+
+            rowsIn += count;
+
+            // Write every destination row whose source rows have all arrived
+
+            int ready = rowsOut;
+            while ( ready < dstH && ( vert->start[ ready ] + vert->count[ ready ] ) <= rowsIn )
+                ready++;
+
+            if ( ready == rowsOut )
+                return;
+
+            scheduler.ForRange( rowsOut, ready, CTaskScheduler::RowsPerBlock( dstW * P::Bytes * vert->taps, ready - rowsOut ), [&] ( int begin, int end )
+            {
+                vector<const int16_t *> taps( vert->taps );
+
+                for ( int y = begin; y < end; y++ )
+                {
+                    int n = vert->count[ y ];
+
+                    for ( int j = 0; j < n; j++ )
+                        taps[ j ] = RingRow( vert->start[ y ] + j );
+
+                    CResampler::VerticalRows( taps.data(), n, vert->weights.data() + (size_t) y * vert->taps, dstW * P::Bytes, dst + (size_t) y * dstStride );
+                }
+            } );
+
+            rowsOut = ready;
+        } //AddRows
+}; //CStripeResampler
+
@@ -0,0 +1,495 @@
+#pragma once
+
+// Work-stealing task scheduler shared by image-level tasks and the row-block subtasks they spawn.
+// Each worker owns a deque per task level. Owners pop the newest task (its data is likely in cache)
+// and thieves steal the oldest (likely the largest remaining piece of work).
+// A thread waiting for subtasks, or for its turn to write a frame, runs subtasks rather than blocking.
+// That way nested parallelism never oversubscribes the machine and idle cores help finish whatever
+// image the encoder is waiting on.
+// A thread already inside an image-level task never starts another image-level task. An image task
+// can block on frame ordering, so stacking a second one on top of it could deadlock.
+//
+// Optionally, workers can be pinned to NUMA nodes. Tasks can then be queued for a node, and workers prefer
+// stealing from their own node. Image-level tasks queued for a node only run on that node's workers (or on a
+// thread that isn't a worker), so an image is decoded next to its frame buffer.
+//
+// In one source file, declare the CTaskScheduler named scheduler like this:
+//    CTaskScheduler scheduler;
+// When the app starts:
+//    scheduler.PinToNodes( nodeCpus ); // optional
+//    scheduler.Start( 0 );   // 0 means one worker per hardware thread, less one for the calling thread
+// Usage:
+//    scheduler.ForRange( 0, count, 1, [&] ( int begin, int end ) { ... }, CTaskScheduler::levelImage );
+//    scheduler.ForRange( 0, height, CTaskScheduler::RowsPerBlock( stride, height ), [&] ( int begin, int end ) { ... } );
+//
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <djl_topo.hxx>
+
+using namespace std;
+
+class CTaskScheduler
+{
+    public:
+        enum TaskLevel { levelImage = 0, levelSubtask = 1, levelCount = 2 };
+
+    private:
+        struct TaskGroup
+        {
+            atomic<int> pending;
+            std::mutex mtx;
+            exception_ptr error;
+
+            TaskGroup( int count ) : pending( count ) {}
+        };
+
+        struct Task
+        {
+            function<void()> work;
+            TaskGroup * group;
+        };
+
+        struct TaskQueue
+        {
+            std::mutex mtx;
+            deque<Task> tasks;
+        };
+
+        struct Worker
+        {
+            TaskQueue queues[ levelCount ];
+            thread th;
+            int node;                            // index into nodeCpus or -1 if not pinned
+            vector<int> victims;                 // other workers to steal from, same node first
+        };
+
+        struct NodeQueues
+        {
+            TaskQueue queues[ levelCount ];
+        };
+
+        vector<unique_ptr<Worker>> workers;
+        TaskQueue injected[ levelCount ];        // work pushed by threads that aren't workers
+        vector<vector<int>> nodeCpus;            // CPUs of each node workers are pinned to. Empty if not pinned
+        vector<unique_ptr<NodeQueues>> nodeQueues;
+        atomic<bool> stopping;
+        atomic<uint64_t> workEpoch;              // bumped whenever work is pushed or a group completes
+        std::mutex mtxIdle;
+        condition_variable cvIdle;
+
+        // Target bytes touched per row-block subtask. Big enough to amortize a steal, small enough
+        // that a 4K frame splits into plenty of pieces for the idle workers.
+
+        static const int TargetBlockBytes = 64 * 1024;
+
+        static int & WorkerIndex()
+        {
+            static thread_local int index = -1;
+            return index;
+        } //WorkerIndex
+
+        static int & ImageDepth()
+        {
+            static thread_local int depth = 0;
+            return depth;
+        } //ImageDepth
+
+        static int & WorkerNode()
+        {
+            static thread_local int node = -1;
+            return node;
+        } //WorkerNode
+
+        static bool PopBack( TaskQueue & q, Task & task )
+        {
+            lock_guard<mutex> lock( q.mtx );
+
+            if ( q.tasks.empty() )
+                return false;
+
+            task = std::move( q.tasks.back() );
+            q.tasks.pop_back();
+            return true;
+        } //PopBack
+
+        static bool PopFront( TaskQueue & q, Task & task )
+        {
+            lock_guard<mutex> lock( q.mtx );
+
+            if ( q.tasks.empty() )
+                return false;
+
+            task = std::move( q.tasks.front() );
+            q.tasks.pop_front();
+            return true;
+        } //PopFront
+
+        bool FindTask( TaskLevel level, Task & task )
+        {
+            int self = WorkerIndex();
+            int node = WorkerNode();
+
+            if ( -1 != self && PopBack( workers[ self ]->queues[ level ], task ) )
+                return true;
+
+            if ( -1 != node && PopFront( nodeQueues[ node ]->queues[ level ], task ) )
+                return true;
+
+            if ( PopFront( injected[ level ], task ) )
+                return true;
+
+            if ( -1 != self )
+            {
+                vector<int> & victims = workers[ self ]->victims;
+
+                for ( size_t i = 0; i < victims.size(); i++ )
+                    if ( PopFront( workers[ victims[ i ] ]->queues[ level ], task ) )
+                        return true;
+            }
+            else
+            {
+                for ( size_t i = 0; i < workers.size(); i++ )
+                    if ( PopFront( workers[ i ]->queues[ level ], task ) )
+                        return true;
+            }
+
+            // Image tasks queued for another node stay there unless this thread isn't pinned. Subtasks go anywhere.
+
+            if ( levelSubtask == level || -1 == node )
+            {
+                for ( size_t n = 0; n < nodeQueues.size(); n++ )
+                    if ( (int) n != node && PopFront( nodeQueues[ n ]->queues[ level ], task ) )
+                        return true;
+            }
+
+            return false;
+        } //FindTask
+
+        void RunTask( Task & task, TaskLevel level )
+        {
+            if ( levelImage == level )
+                ImageDepth()++;
+
+            try
+            {
+                task.work();
+            }
+            catch( ... )
+            {
+                lock_guard<mutex> lock( task.group->mtx );
+
+                if ( !task.group->error )
+                    task.group->error = current_exception();
+            }
+
+            if ( levelImage == level )
+                ImageDepth()--;
+
+            if ( 1 == task.group->pending.fetch_sub( 1 ) )
+                Notify();
+        } //RunTask
+
+        // Runs one task if any is available. Subtasks are preferred so images in flight finish first.
+
+        bool TryRunOne()
+        {
+            Task task;
+
+            if ( FindTask( levelSubtask, task ) )
+            {
+                RunTask( task, levelSubtask );
+                return true;
+            }
+
+            if ( 0 == ImageDepth() && FindTask( levelImage, task ) )
+            {
+                RunTask( task, levelImage );
+                return true;
+            }
+
+            return false;
+        } //TryRunOne
+
+        void Push( TaskLevel level, Task & task, int node )
+        {
+            int self = WorkerIndex();
+            TaskQueue & q = ( -1 != node ) ? nodeQueues[ node ]->queues[ level ] :
+                            ( -1 == self ) ? injected[ level ] : workers[ self ]->queues[ level ];
+
+            {
+                lock_guard<mutex> lock( q.mtx );
+                q.tasks.push_back( std::move( task ) );
+            }
+        } //Push
+
+        void WorkerLoop( int index )
+        {
+            WorkerIndex() = index;
+            WorkerNode() = workers[ index ]->node;
+
+            if ( -1 != WorkerNode() )
+                CTopology::PinCurrentThread( nodeCpus[ WorkerNode() ] );
+
+            while ( !stopping )
+            {
+                uint64_t epoch = workEpoch;
+
+                if ( TryRunOne() )
+                    continue;
+
+                unique_lock<mutex> lock( mtxIdle );
+                cvIdle.wait( lock, [&] { return stopping || ( epoch != workEpoch ); } );
+            }
+        } //WorkerLoop
+
+    public:
+        CTaskScheduler() : stopping( false ), workEpoch( 0 ) {}
+
+        ~CTaskScheduler()
+        {
+            // Normally Shutdown() was already called. If not, the process is exiting (perhaps via exit() on a worker
+            // thread) and a worker may be blocked mid-task, so don't wait for them.
+
+            {
+                lock_guard<mutex> lock( mtxIdle );
+                stopping = true;
+            }
+
+            cvIdle.notify_all();
+
+            for ( size_t i = 0; i < workers.size(); i++ )
+            {
+                if ( workers[ i ]->th.joinable() )
+                {
+                    workers[ i ]->th.detach();
+                    workers[ i ].release(); // the detached thread may still reference it
+                }
+            }
+        }
+
+        // Call before Start(). cpus[ n ] are the CPUs of the n'th node to use. Workers are spread round-robin across the nodes.
+
+        void PinToNodes( const vector<vector<int>> & cpus )
+        {
+            if ( 0 != workers.size() )
+                return;
+
+            nodeCpus = cpus;
+            nodeQueues.clear();
+
+            for ( size_t n = 0; n < nodeCpus.size(); n++ )
+                nodeQueues.push_back( unique_ptr<NodeQueues>( new NodeQueues() ) );
+        } //PinToNodes
+
+        // threads: count of worker threads. 0 to use one per hardware thread (or pinned CPU) less one for the caller
+
+        void Start( int threads )
+        {
+            if ( 0 != workers.size() )
+                return;
+
+            if ( threads <= 0 )
+            {
+                threads = (int) thread::hardware_concurrency();
+
+                if ( 0 != nodeCpus.size() )
+                {
+                    threads = 0;
+                    for ( size_t n = 0; n < nodeCpus.size(); n++ )
+                        threads += (int) nodeCpus[ n ].size();
+                }
+
+                threads--;
+                if ( threads < 1 )
+                    threads = 1;
+            }
+
+            stopping = false;
+
+            for ( int i = 0; i < threads; i++ )
+            {
+                workers.push_back( unique_ptr<Worker>( new Worker() ) );
+                workers[ i ]->node = ( 0 == nodeCpus.size() ) ? -1 : ( i % (int) nodeCpus.size() );
+            }
+
+            for ( int i = 0; i < threads; i++ )
+            {
+                for ( int pass = 0; pass < 2; pass++ )
+                {
+                    for ( int j = 1; j < threads; j++ )
+                    {
+                        int victim = ( i + j ) % threads;
+                        bool sameNode = ( workers[ victim ]->node == workers[ i ]->node );
+
+                        if ( sameNode == ( 0 == pass ) )
+                            workers[ i ]->victims.push_back( victim );
+                    }
+                }
+            }
+
+            for ( int i = 0; i < threads; i++ )
+                workers[ i ]->th = thread( &CTaskScheduler::WorkerLoop, this, i );
+        } //Start
+
+        void Shutdown()
+        {
+            {
+                lock_guard<mutex> lock( mtxIdle );
+                stopping = true;
+            }
+
+            cvIdle.notify_all();
+
+            for ( size_t i = 0; i < workers.size(); i++ )
+                if ( workers[ i ]->th.joinable() )
+                    workers[ i ]->th.join();
+
+            workers.clear();
+        } //Shutdown
+
+        int WorkerCount() { return (int) workers.size(); }
+
+        // Count of nodes workers are pinned to, or 0 if they aren't pinned
+
+        int NodeCount() { return (int) nodeCpus.size(); }
+
+        // Node index of the calling thread, or -1 if it's not a pinned worker
+
+        static int CurrentNode() { return WorkerNode(); }
+
+        // Wakes idle workers and waiters. Call this after changing state that a HelpUntil() predicate checks.
+
+        void Notify()
+        {
+            {
+                lock_guard<mutex> lock( mtxIdle );
+                workEpoch++;
+            }
+
+            cvIdle.notify_all();
+        } //Notify
+
+        // Runs other work until done() returns true. done() must be cheap; it's called often.
+
+        template <class T> void HelpUntil( T done )
+        {
+            while ( !done() )
+            {
+                uint64_t epoch = workEpoch;
+
+                if ( TryRunOne() )
+                    continue;
+
+                if ( done() )
+                    break;
+
+                // Something outside the scheduler (e.g. the encoder) may be what we're waiting on, so don't sleep forever
+
+                unique_lock<mutex> lock( mtxIdle );
+                cvIdle.wait_for( lock, std::chrono::milliseconds( 2 ), [&] { return epoch != workEpoch; } );
+            }
+        } //HelpUntil
+
+        // Calls fn( b, e ) for consecutive ranges of at most grain items covering [ begin, end ).
+        // The calling thread runs the first range and helps with the rest. Returns when all ranges are done.
+        // If nodeOf is provided and workers are pinned, nodeOf( b ) picks the node that runs the range starting at b,
+        // and the calling thread only helps.
+
+        void ForRange( int begin, int end, int grain, const function<void( int, int )> & fn, TaskLevel level = levelSubtask,
+                       const function<int( int )> & nodeOf = function<int( int )>() )
+        {
+            if ( end <= begin )
+                return;
+
+            if ( grain < 1 )
+                grain = 1;
+
+            int chunks = ( ( end - begin ) + grain - 1 ) / grain;
+
+            if ( 1 == chunks || 0 == workers.size() )
+            {
+                fn( begin, end );
+                return;
+            }
+
+            bool placed = ( nodeOf && ( 0 != nodeCpus.size() ) );
+            int firstQueued = placed ? 0 : 1;
+            TaskGroup group( chunks - firstQueued );
+
+            // Thieves take the oldest task, so ascending order starts low-numbered images (the next to be written) first
+
+            for ( int c = firstQueued; c < chunks; c++ )
+            {
+                int b = begin + c * grain;
+                int e = ( b + grain > end ) ? end : b + grain;
+
+                Task task;
+                task.group = &group;
+                task.work = [&fn, b, e] () { fn( b, e ); };
+                Push( level, task, placed ? ( nodeOf( b ) % (int) nodeCpus.size() ) : -1 );
+            }
+
+            Notify();
+
+            exception_ptr firstError;
+
+            if ( !placed )
+            {
+                try
+                {
+                    if ( levelImage == level )
+                        ImageDepth()++;
+    
+                    fn( begin, ( begin + grain > end ) ? end : begin + grain );
+    
+                    if ( levelImage == level )
+                        ImageDepth()--;
+                }
+                catch( ... )
+                {
+                    if ( levelImage == level )
+                        ImageDepth()--;
+    
+                    firstError = current_exception();
+                }
+            }
+
+            HelpUntil( [&] { return 0 == group.pending; } );
+
+            if ( firstError )
+                rethrow_exception( firstError );
+
+            if ( group.error )
+                rethrow_exception( group.error );
+        } //ForRange
+
+        // Chooses a row count per subtask so each one touches about TargetBlockBytes.
+
+        static int RowsPerBlock( int rowBytes, int rows )
+        {
+            if ( rowBytes <= 0 || rows <= 0 )
+                return 1;
+
+            int perBlock = TargetBlockBytes / rowBytes;
+
+            if ( perBlock < 1 )
+                perBlock = 1;
+
+            return ( perBlock > rows ) ? rows : perBlock;
+        } //RowsPerBlock
+}; //CTaskScheduler
+
+extern CTaskScheduler scheduler;
+
@@ -0,0 +1,188 @@
+#pragma once
+
+//
+// Stable sorts for arrays with millions of entries, split across threads when there's enough work.
+// RadixSort orders 64-bit keys (each carrying a 32-bit index) with an LSD radix sort, one byte per pass.
+// Passes over bytes that are the same in every key are skipped; file times in one collection usually share
+// their top two bytes. MergeSort orders anything with a comparator: each thread sorts one run, then runs are
+// merged in pairs until one is left.
+// Both build anywhere; arrays under minParallel entries are sorted on the calling thread.
+// Usage:
+//    vector<CParallelSort::KeyIndex> keys( n );         // fill in key and index for each element
+//    CParallelSort::RadixSort( keys );
+//    CParallelSort::MergeSort( order, [&] ( uint32_t a, uint32_t b ) { return wcscmp( p[ a ], p[ b ] ) < 0; } );
+//
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+class CParallelSort
+{
+    public:
+        struct KeyIndex
+        {
+            uint64_t key;
+            uint32_t index;
+        };
+
+    private:
+        static const size_t minParallel = 64 * 1024;
+        static const size_t minPerThread = 32 * 1024;
+        static const size_t maxThreads = 64;
+
+        static size_t Threads( size_t n )
+        {
+            if ( n < minParallel )
+                return 1;
+
+            size_t cpus = (std::max)( (size_t) 1, (size_t) thread::hardware_concurrency() );
+            return (std::max)( (size_t) 1, (std::min)( (std::min)( cpus, (size_t) maxThreads ), n / minPerThread ) );
+        } //Threads
+
+        // Calls work( t, lo, hi ) for each of threads equal slices of [0, n), one slice on the calling thread
+
+        template <typename Work> static void ForSlices( size_t n, size_t threads, Work work )
+        {
+            vector<thread> helpers;
+
+            for ( size_t t = 1; t < threads; t++ )
+                helpers.emplace_back( [&, t] { work( t, n * t / threads, n * ( t + 1 ) / threads ); } );
+
+            work( 0, 0, n / threads );
+
+            for ( size_t t = 0; t < helpers.size(); t++ )
+                helpers[ t ].join();
+        } //ForSlices
+
+    public:
+        static void RadixSort( vector<KeyIndex> & items )
+        {
+            size_t n = items.size();
+
+            if ( n < 2 )
+                return;
+
+            size_t threads = Threads( n );
+            vector<uint64_t> ors( threads, 0 ), ands( threads, ~0ull );
+
+            ForSlices( n, threads, [&] ( size_t t, size_t lo, size_t hi )
+            {
+                uint64_t o = 0, a = ~0ull;
+
+                for ( size_t i = lo; i < hi; i++ )
+                {
+                    o |= items[ i ].key;
+                    a &= items[ i ].key;
+                }
+
+                ors[ t ] = o;
+                ands[ t ] = a;
+            } );
+
+            uint64_t differing = 0;
+            for ( size_t t = 0; t < threads; t++ )
+                differing |= ( ors[ t ] ^ ands[ t ] );
+
+            if ( 0 == differing )
+                return;
+
+            vector<KeyIndex> scratch( n );
+            vector<size_t> offsets( threads * 256 );
+            KeyIndex * src = items.data();
+            KeyIndex * dst = scratch.data();
+
+            for ( int shift = 0; shift < 64; shift += 8 )
+            {
+                if ( 0 == ( ( differing >> shift ) & 0xff ) )
+                    continue;
+
+                ForSlices( n, threads, [&] ( size_t t, size_t lo, size_t hi )
+                {
+                    size_t * counts = offsets.data() + t * 256;
+                    memset( counts, 0, 256 * sizeof( size_t ) );
+
+                    for ( size_t i = lo; i < hi; i++ )
+                        counts[ ( src[ i ].key >> shift ) & 0xff ]++;
+                } );
+
+                // Each thread's share of a digit follows the previous thread's, which keeps the sort stable
+
+                size_t total = 0;
+
+                for ( size_t d = 0; d < 256; d++ )
+                {
+                    for ( size_t t = 0; t < threads; t++ )
+                    {
+                        size_t count = offsets[ t * 256 + d ];
+                        offsets[ t * 256 + d ] = total;
+                        total += count;
+                    }
+                }
+
+                ForSlices( n, threads, [&] ( size_t t, size_t lo, size_t hi )
+                {
+                    size_t * next = offsets.data() + t * 256;
+
+                    for ( size_t i = lo; i < hi; i++ )
+                        dst[ next[ ( src[ i ].key >> shift ) & 0xff ]++ ] = src[ i ];
+                } );
+
+                swap( src, dst );
+            }
+
+            if ( src != items.data() )
+                memcpy( items.data(), src, n * sizeof( KeyIndex ) );
+        } //RadixSort
+
+        template <typename T, typename Less> static void MergeSort( vector<T> & items, Less less )
+        {
+            size_t n = items.size();
+
+            if ( n < 2 )
+                return;
+
+            size_t threads = Threads( n );
+            vector<size_t> bounds( threads + 1 );
+
+            for ( size_t t = 0; t <= threads; t++ )
+                bounds[ t ] = n * t / threads;
+
+            ForSlices( n, threads, [&] ( size_t /*t*/, size_t lo, size_t hi )
+            {
+                stable_sort( items.begin() + lo, items.begin() + hi, less );
+            } );
+
+            if ( 1 == threads )
+                return;
+
+            // Merge neighboring runs in rounds; each round halves the number of runs and merges its pairs in parallel
+
+            vector<T> scratch( n );
+            T * src = items.data();
+            T * dst = scratch.data();
+
+            for ( size_t width = 1; width < threads; width *= 2 )
+            {
+                size_t merges = ( threads + 2 * width - 1 ) / ( 2 * width );
+
+                ForSlices( merges, merges, [&] ( size_t m, size_t, size_t )
+                {
+                    size_t lo = bounds[ m * 2 * width ];
+                    size_t mid = bounds[ (std::min)( m * 2 * width + width, threads ) ];
+                    size_t hi = bounds[ (std::min)( ( m + 1 ) * 2 * width, threads ) ];
+                    merge( src + lo, src + mid, src + mid, src + hi, dst + lo, less );
+                } );
+
+                swap( src, dst );
+            }
+
+            if ( src != items.data() )
+                copy( src, src + n, items.data() );
+        } //MergeSort
+}; //CParallelSort
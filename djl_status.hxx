@@ -0,0 +1,208 @@
+#pragma once
+
+//
+// Live status of a long run for whatever is supervising it: a small JSON file rewritten every interval by a
+// background thread. Each update is written to a temporary file next to the target, which then replaces the
+// target with MoveFileEx, so readers never see a partial file. The thread only samples counters the app already
+// keeps; the threads doing the work don't know it's there.
+// Rates are items per second over the last interval and an exponentially weighted moving average with a 30 second
+// time constant, which the ETA is based on. A reader holding the file open without FILE_SHARE_DELETE makes the
+// replace fail; that update is skipped and the next one tries again.
+// Windows only.
+// Usage:
+//    CStatusFile status( L"status.json", 1000 );
+//    status.Start( [&] ( string & fields ) -> CStatusFile::Progress
+//    {
+//        CStatusFile::Field( fields, "queued", queued );
+//        CStatusFile::Progress p = { done, total };
+//        return p;
+//    } );
+//    ...
+//    status.Stop();    // writes the final status, with state "done"
+//
+
+#include <windows.h>
+#include <math.h>
+#include <stdio.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <djltrace.hxx>
+
+using namespace std;
+
+class CStatusFile
+{
+    public:
+        struct Progress
+        {
+            long long done;
+            long long total;
+        };
+
+        // Appends the caller's own fields with Field(), FieldReal() and FieldRaw(), and returns the progress
+
+        typedef function<Progress ( string & fields )> Provider;
+
+    private:
+        static const int EwmaSeconds = 30;
+
+        wstring path;
+        wstring tempPath;
+        int intervalMS;
+        Provider provider;
+        bool stopping;
+        long long startNS;
+        long long lastNS;
+        long long lastDone;
+        double rate;          // items per second over the last sampled interval
+        double ewma;          // items per second, or -1 before the first interval with progress
+        long long failures;
+
+        mutex mtx;
+        condition_variable cvStop;
+        thread writer;
+
+        static long long NowNS()
+        {
+            return chrono::duration_cast<chrono::nanoseconds>( chrono::steady_clock::now().time_since_epoch() ).count();
+        } //NowNS
+
+        bool Replace( const string & json )
+        {
+            HANDLE h = CreateFileW( tempPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+
+            if ( INVALID_HANDLE_VALUE == h )
+                return false;
+
+            DWORD written = 0;
+            bool ok = WriteFile( h, json.data(), (DWORD) json.size(), &written, NULL ) && ( written == json.size() );
+            CloseHandle( h );
+
+            if ( ok )
+                ok = ( 0 != MoveFileExW( tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING ) );
+
+            if ( !ok )
+                DeleteFileW( tempPath.c_str() );
+
+            return ok;
+        } //Replace
+
+        void Write( const char * state )
+        {
+            string fields;
+            Progress p = provider( fields );
+            long long now = NowNS();
+            double seconds = (double) ( now - lastNS ) / 1000000000.0;
+
+            // A sample needs progress, or (once rates are known) most of an interval. Otherwise the first write, right
+            // after Start, and the start-up before the first item finishes would seed the average with 0 and the ETA
+            // would take several time constants to recover. Until then the interval keeps growing from the last sample.
+
+            bool progressed = ( p.done > lastDone );
+            bool fullInterval = ( ( now - lastNS ) >= (long long) intervalMS * 900000 );
+
+            if ( seconds > 0.0 && ( progressed || ( fullInterval && ewma >= 0.0 ) ) )
+            {
+                rate = (double) ( p.done - lastDone ) / seconds;
+                double alpha = 1.0 - exp( -seconds / EwmaSeconds );
+                ewma = ( ewma < 0.0 ) ? rate : ( ewma + alpha * ( rate - ewma ) );
+                lastNS = now;
+                lastDone = p.done;
+            }
+
+            char eta[ 32 ] = "null";
+
+            if ( ewma > 0.0 && p.total >= p.done )
+                snprintf( eta, sizeof eta, "%.0f", (double) ( p.total - p.done ) / ewma );
+
+            char head[ 512 ];
+            snprintf( head, sizeof head, "{\n  \"state\": \"%s\",\n  \"elapsedMS\": %lld,\n  \"done\": %lld,\n  \"total\": %lld,\n"
+                                         "  \"perSecond\": %.3f,\n  \"perSecondEWMA\": %.3f,\n  \"etaSeconds\": %s",
+                      state, ( now - startNS ) / 1000000, p.done, p.total, rate, ( ewma < 0.0 ) ? 0.0 : ewma, eta );
+
+            string json( head );
+            json += fields;
+            json += "\n}\n";
+
+            if ( !Replace( json ) )
+            {
+                tracer.Trace( "can't update status file %ws, error %d\n", path.c_str(), GetLastError() );
+                failures++;
+            }
+        } //Write
+
+        void WriteLoop()
+        {
+            unique_lock<mutex> lock( mtx );
+
+            do
+            {
+                lock.unlock();
+                Write( "running" );
+                lock.lock();
+            } while ( !cvStop.wait_for( lock, chrono::milliseconds( intervalMS ), [&] { return stopping; } ) );
+        } //WriteLoop
+
+    public:
+        CStatusFile( const WCHAR * pwcPath, int ms ) : path( pwcPath ), tempPath( path + L".tmp" ), intervalMS( ms ), stopping( false ),
+                                                      startNS( 0 ), lastNS( 0 ), lastDone( 0 ), rate( 0.0 ), ewma( -1.0 ), failures( 0 ) {}
+
+        ~CStatusFile() { Stop(); }
+
+        void Start( Provider p )
+        {
+            provider = p;
+            startNS = NowNS();
+            lastNS = startNS;
+            writer = thread( [this] { WriteLoop(); } );
+        } //Start
+
+        // Stops the thread and writes a last update with the final counts
+
+        void Stop()
+        {
+            if ( !writer.joinable() )
+                return;
+
+            {
+                lock_guard<mutex> lock( mtx );
+                stopping = true;
+                cvStop.notify_all();
+            }
+
+            writer.join();
+            Write( "done" );
+        } //Stop
+
+        long long Failures() { return failures; }
+
+        static void Field( string & s, const char * name, long long value )
+        {
+            char ac[ 128 ];
+            snprintf( ac, sizeof ac, ",\n  \"%s\": %lld", name, value );
+            s += ac;
+        } //Field
+
+        static void FieldReal( string & s, const char * name, double value )
+        {
+            char ac[ 128 ];
+            snprintf( ac, sizeof ac, ",\n  \"%s\": %.3f", name, value );
+            s += ac;
+        } //FieldReal
+
+        // json is written as is: an object, array, string with its quotes, or literal
+
+        static void FieldRaw( string & s, const char * name, const char * json )
+        {
+            s += ",\n  \"";
+            s += name;
+            s += "\": ";
+            s += json;
+        } //FieldRaw
+}; //CStatusFile
@@ -1,20 +1,79 @@
 #pragma once
 
 //
-// Stream over a file or subset of a file
+// Stream over a file or subset of a file, or over a file already in memory.
+// File-backed streams issue a ReadFile (and a SetFilePointerEx after each Seek) for every Read, which adds up
+// to thousands of calls for metadata parsers reading 2 and 4 bytes at a time. Memory-backed streams just copy.
+// CMappedFile opens a file once and maps a read-only view of it, so a parser and a decoder can both read the
+// file through memory-backed streams.
+// IOCounts tallies the calls made by file-backed streams and mappings, for comparing the two approaches.
 //
 
+#include <atomic>
+
 class CStream
 {
+    public:
+        struct IOCounts
+        {
+            std::atomic<long long> opens;   // CreateFile
+            std::atomic<long long> reads;   // ReadFile
+            std::atomic<long long> seeks;   // SetFilePointerEx
+            std::atomic<long long> maps;    // files mapped by CMappedFile (each also counts as an open)
+        };
+
+        static IOCounts & Counts()
+        {
+            static IOCounts counts;   // zero-initialized as a static
+            return counts;
+        } //Counts
+
     private:
         __int64 length;
         __int64 offset;
         __int64 embedOffset;
         HANDLE hFile;
+        const byte * pMemory;
+
+        // Memory may be a mapped view, and a page of the file that can't be read in raises an in-page exception.
+        // That's caught here and turned into a short read, like a failed ReadFile. This function must not have
+        // C++ objects with destructors, or the __try won't compile.
+
+        static bool CopyFromMemory( void * pv, const byte * p, ULONG cb )
+        {
+            __try
+            {
+                memcpy( pv, p, cb );
+            }
+            __except ( EXCEPTION_IN_PAGE_ERROR == GetExceptionCode() ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH )
+            {
+                return false;
+            }
+
+            return true;
+        } //CopyFromMemory
         bool handleOwned;
         bool seekCalled;
         bool forWrite;
 
+        HANDLE OpenFile( WCHAR const * pwcFile, DWORD access, DWORD share, DWORD disposition )
+        {
+            Counts().opens++;
+            return CreateFile( pwcFile, access, share, NULL, disposition, 0, 0 );
+        } //OpenFile
+
+        void SyncFilePointer()
+        {
+            if ( seekCalled )
+            {
+                LARGE_INTEGER li;
+                li.QuadPart = offset + embedOffset;
+                SetFilePointerEx( hFile, li, NULL, FILE_BEGIN );
+                Counts().seeks++;
+                seekCalled = false;
+            }
+        } //SyncFilePointer
+
     public:
         CStream()
         {
@@ -22,6 +81,7 @@ class CStream
             offset = 0;
             embedOffset = 0;
             hFile = INVALID_HANDLE_VALUE;
+            pMemory = NULL;
             handleOwned = false;
             seekCalled = false;
             forWrite = false;
@@ -35,12 +95,13 @@ class CStream
             seekCalled = false;
             handleOwned = true;
             forWrite = write;
+            pMemory = NULL;
 
             if ( forWrite )
-                hFile = CreateFile( pwcFile, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, CREATE_ALWAYS, 0, 0 );
+                hFile = OpenFile( pwcFile, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, CREATE_ALWAYS );
             else
             {
-                hFile = CreateFile( pwcFile, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, 0 );
+                hFile = OpenFile( pwcFile, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, OPEN_EXISTING );
 
                 if ( INVALID_HANDLE_VALUE != hFile )
                 {
@@ -59,6 +120,7 @@ class CStream
             seekCalled = true; // don't trust where this handle has been
             handleOwned = false;
             hFile = h;
+            pMemory = NULL;
             forWrite = false;
 
             LARGE_INTEGER liSize;
@@ -81,7 +143,8 @@ class CStream
             seekCalled = true; // need to get to virtual 0 on first read
             handleOwned = true;
             forWrite = false;
-            hFile = CreateFile( pwcFile, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, 0 );
+            pMemory = NULL;
+            hFile = OpenFile( pwcFile, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, OPEN_EXISTING );
 
             if ( INVALID_HANDLE_VALUE == hFile )
                 length = 0;
@@ -109,6 +172,29 @@ class CStream
              }
         } //CStream
 
+        // Read-only stream over cb bytes at p, or a subset of them. p must stay valid for the life of the stream.
+
+        CStream( const void * p, __int64 cb, __int64 embeddedOffset = 0, __int64 embeddedLength = -1 )
+        {
+            if ( embeddedLength < 0 )
+                embeddedLength = cb;
+
+            if ( NULL == p || embeddedOffset < 0 || embeddedOffset > cb )
+            {
+                embeddedOffset = 0;
+                embeddedLength = 0;
+            }
+
+            embedOffset = embeddedOffset;
+            length = __min( cb - embeddedOffset, embeddedLength );
+            offset = 0;
+            seekCalled = false;
+            handleOwned = false;
+            forWrite = false;
+            hFile = INVALID_HANDLE_VALUE;
+            pMemory = (const byte *) p;
+        } //CStream
+
         void CloseFile()
         {
             if ( handleOwned && INVALID_HANDLE_VALUE != hFile )
@@ -128,14 +214,6 @@ class CStream
             if ( 0 == length )
                 return 0;
 
-            if ( seekCalled )
-            {
-                LARGE_INTEGER li;
-                li.QuadPart = offset + embedOffset;
-                SetFilePointerEx( hFile, li, NULL, FILE_BEGIN );
-                seekCalled = false;
-            }
-
             if ( ( offset + cb ) > length )
             {
                 if ( length > offset )
@@ -144,6 +222,18 @@ class CStream
                     cb = 0;
             }
 
+            if ( pMemory )
+            {
+                if ( !CopyFromMemory( pv, pMemory + embedOffset + offset, cb ) )
+                    return 0;
+
+                offset += cb;
+                return cb;
+            }
+
+            SyncFilePointer();
+            Counts().reads++;
+
             DWORD dwRead = 0;
             BOOL ok = ReadFile( hFile, pv, cb, &dwRead, NULL );
 
@@ -169,7 +259,7 @@ class CStream
             return true;
         } //Seek
 
-        bool Ok() { return ( INVALID_HANDLE_VALUE != hFile ); }
+        bool Ok() { return ( NULL != pMemory || INVALID_HANDLE_VALUE != hFile ); }
         __int64 Tell() { return offset; }
         __int64 Length() { return length; }
         bool AtEOF() { return ( offset >= length ); }
@@ -184,13 +274,10 @@ class CStream
 
         ULONG Write( void *pv, ULONG cb )
         {
-            if ( seekCalled )
-            {
-                LARGE_INTEGER li;
-                li.QuadPart = offset + embedOffset;
-                SetFilePointerEx( hFile, li, NULL, FILE_BEGIN );
-                seekCalled = false;
-            }
+            if ( pMemory )
+                return 0;
+
+            SyncFilePointer();
 
             DWORD dwWritten = 0;
             BOOL ok = WriteFile( hFile, pv, cb, &dwWritten, NULL );
@@ -209,3 +296,81 @@ class CStream
         } //Write
 };
 
+// A read-only view of a whole file. The file is opened once; its handles are closed as soon as the view exists.
+// Mapping can be turned off process-wide with Enable( false ), in which case Ok() is always false and callers
+// fall back to file-backed streams. Reading a view of a file that becomes unavailable (a network share that
+// goes away, a card that's pulled) raises an in-page exception rather than returning an error. CStream catches
+// that, but WIC decoders reading the view through a memory stream can't, so only files on local fixed drives are
+// mapped; others get Ok() false and are read with ReadFile.
+
+class CMappedFile
+{
+    private:
+        const byte * pView;
+        __int64 size;
+
+    public:
+        static bool & Enabled()
+        {
+            static bool enabled = true;
+            return enabled;
+        } //Enabled
+
+        static void Enable( bool enable ) { Enabled() = enable; }
+
+        static bool OnFixedDrive( WCHAR const * pwcFile )
+        {
+            WCHAR awcVolume[ MAX_PATH + 1 ];
+
+            if ( !GetVolumePathNameW( pwcFile, awcVolume, _countof( awcVolume ) ) )
+                return false;
+
+            return ( DRIVE_FIXED == GetDriveTypeW( awcVolume ) );
+        } //OnFixedDrive
+
+        CMappedFile( WCHAR const * pwcFile ) : pView( NULL ), size( 0 )
+        {
+            if ( !Enabled() || !OnFixedDrive( pwcFile ) )
+                return;
+
+            CStream::Counts().opens++;
+            HANDLE hFile = CreateFile( pwcFile, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, 0 );
+
+            if ( INVALID_HANDLE_VALUE == hFile )
+                return;
+
+            LARGE_INTEGER liSize;
+
+            // Empty files can't be mapped, and a view of more than the address space can't be made
+
+            if ( GetFileSizeEx( hFile, &liSize ) && 0 != liSize.QuadPart && (unsigned __int64) liSize.QuadPart <= (size_t) -1 )
+            {
+                HANDLE hMapping = CreateFileMapping( hFile, NULL, PAGE_READONLY, 0, 0, NULL );
+
+                if ( NULL != hMapping )
+                {
+                    pView = (const byte *) MapViewOfFile( hMapping, FILE_MAP_READ, 0, 0, 0 );
+
+                    if ( NULL != pView )
+                    {
+                        size = liSize.QuadPart;
+                        CStream::Counts().maps++;
+                    }
+
+                    CloseHandle( hMapping );
+                }
+            }
+
+            CloseHandle( hFile );
+        } //CMappedFile
+
+        ~CMappedFile()
+        {
+            if ( NULL != pView )
+                UnmapViewOfFile( pView );
+        }
+
+        bool Ok() { return ( NULL != pView ); }
+        const byte * Data() { return pView; }
+        __int64 Size() { return size; }
+}; //CMappedFile
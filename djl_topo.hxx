@@ -0,0 +1,322 @@
+#pragma once
+
+//
+// Processor topology: NUMA nodes and the CPUs sharing each L3 cache, plus helpers to pin threads
+// and allocate memory on a given node.
+// Windows uses GetLogicalProcessorInformationEx. Linux parses sysfs, so libnuma isn't needed.
+// CPU numbers are global: on Windows that's ( processor group * 64 ) + index within the group.
+// Usage:
+//      CTopology topo;
+//      topo.Detect();
+//      CTopology::PinCurrentThread( topo.Nodes()[ 0 ].cpus );
+//      byte * p = (byte *) CTopology::AllocOnNode( cb, topo.Nodes()[ 0 ].id );
+//      CTopology::FreeOnNode( p, cb );
+//
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <dirent.h>
+    #include <sched.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+#endif
+
+using namespace std;
+
+class CTopology
+{
+    public:
+        struct Node
+        {
+            int id;                // OS node number
+            vector<int> cpus;
+        };
+
+    private:
+        vector<Node> nodes;
+        vector<vector<int>> l3Domains;
+
+        static void AddUnique( vector<vector<int>> & sets, vector<int> & cpus )
+        {
+            if ( 0 == cpus.size() )
+                return;
+
+            sort( cpus.begin(), cpus.end() );
+
+            for ( size_t i = 0; i < sets.size(); i++ )
+                if ( sets[ i ] == cpus )
+                    return;
+
+            sets.push_back( cpus );
+        } //AddUnique
+
+#ifdef _WIN32
+
+        static void AddGroupMask( const GROUP_AFFINITY & ga, vector<int> & cpus )
+        {
+            for ( int bit = 0; bit < 64; bit++ )
+                if ( 0 != ( ga.Mask & ( (KAFFINITY) 1 << bit ) ) )
+                    cpus.push_back( ( ga.Group * 64 ) + bit );
+        } //AddGroupMask
+
+        void DetectPlatform()
+        {
+            DWORD cb = 0;
+            GetLogicalProcessorInformationEx( RelationAll, NULL, &cb );
+
+            if ( 0 == cb )
+                return;
+
+            vector<byte> buf( cb );
+
+            if ( !GetLogicalProcessorInformationEx( RelationAll, (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX) buf.data(), &cb ) )
+                return;
+
+            byte * p = buf.data();
+            byte * pend = p + cb;
+
+            while ( p < pend )
+            {
+                PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX info = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX) p;
+
+                if ( RelationNumaNode == info->Relationship )
+                {
+                    Node node;
+                    node.id = (int) info->NumaNode.NodeNumber;
+                    AddGroupMask( info->NumaNode.GroupMask, node.cpus );
+                    nodes.push_back( node );
+                }
+                else if ( RelationCache == info->Relationship && 3 == info->Cache.Level )
+                {
+                    vector<int> cpus;
+                    AddGroupMask( info->Cache.GroupMask, cpus );
+                    AddUnique( l3Domains, cpus );
+                }
+
+                p += info->Size;
+            }
+        } //DetectPlatform
+
+#else
+
+        static bool ReadLine( const char * path, char * buf, int cb )
+        {
+            FILE * fp = fopen( path, "r" );
+            if ( 0 == fp )
+                return false;
+
+            bool ok = ( 0 != fgets( buf, cb, fp ) );
+            fclose( fp );
+            return ok;
+        } //ReadLine
+
+        void DetectPlatform()
+        {
+            char path[ 300 ];
+            char line[ 4096 ];
+
+            DIR * dir = opendir( "/sys/devices/system/node" );
+
+            if ( 0 != dir )
+            {
+                struct dirent * entry;
+
+                while ( 0 != ( entry = readdir( dir ) ) )
+                {
+                    if ( strncmp( entry->d_name, "node", 4 ) || !isdigit( entry->d_name[ 4 ] ) )
+                        continue;
+
+                    snprintf( path, sizeof path, "/sys/devices/system/node/%s/cpulist", entry->d_name );
+
+                    Node node;
+                    node.id = atoi( entry->d_name + 4 );
+
+                    if ( ReadLine( path, line, sizeof line ) && ParseCpuList( line, node.cpus ) && 0 != node.cpus.size() )
+                        nodes.push_back( node );
+                }
+
+                closedir( dir );
+            }
+
+            sort( nodes.begin(), nodes.end(), [] ( const Node & a, const Node & b ) { return a.id < b.id; } );
+
+            int cpuCount = (int) thread::hardware_concurrency();
+
+            for ( int cpu = 0; cpu < cpuCount; cpu++ )
+            {
+                for ( int index = 0; index < 10; index++ )
+                {
+                    snprintf( path, sizeof path, "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, index );
+                    if ( !ReadLine( path, line, sizeof line ) )
+                        break;
+
+                    if ( 3 != atoi( line ) )
+                        continue;
+
+                    snprintf( path, sizeof path, "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, index );
+
+                    vector<int> cpus;
+                    if ( ReadLine( path, line, sizeof line ) && ParseCpuList( line, cpus ) )
+                        AddUnique( l3Domains, cpus );
+                }
+            }
+        } //DetectPlatform
+
+#endif
+
+    public:
+        CTopology() {}
+
+        // Parses lists like "0-3,8-11" as used by Linux sysfs and the cv /n: argument
+
+        static bool ParseCpuList( const char * pc, vector<int> & result )
+        {
+            while ( *pc && '\n' != *pc )
+            {
+                if ( !isdigit( *pc ) )
+                    return false;
+
+                int first = atoi( pc );
+                while ( isdigit( *pc ) )
+                    pc++;
+
+                int last = first;
+
+                if ( '-' == *pc )
+                {
+                    pc++;
+                    if ( !isdigit( *pc ) )
+                        return false;
+
+                    last = atoi( pc );
+                    while ( isdigit( *pc ) )
+                        pc++;
+                }
+
+                for ( int i = first; i <= last; i++ )
+                    result.push_back( i );
+
+                if ( ',' == *pc )
+                    pc++;
+            }
+
+            return true;
+        } //ParseCpuList
+
+        void Detect()
+        {
+            nodes.clear();
+            l3Domains.clear();
+
+            DetectPlatform();
+
+            // Machines (and VMs) that don't report nodes get one node with every CPU
+
+            if ( 0 == nodes.size() )
+            {
+                Node node;
+                node.id = 0;
+
+                for ( int i = 0; i < (int) thread::hardware_concurrency(); i++ )
+                    node.cpus.push_back( i );
+
+                nodes.push_back( node );
+            }
+        } //Detect
+
+        vector<Node> & Nodes() { return nodes; }
+        vector<vector<int>> & L3Domains() { return l3Domains; }
+
+        int FindNode( int id )
+        {
+            for ( size_t i = 0; i < nodes.size(); i++ )
+                if ( id == nodes[ i ].id )
+                    return (int) i;
+
+            return -1;
+        } //FindNode
+
+        static bool PinCurrentThread( const vector<int> & cpus )
+        {
+            if ( 0 == cpus.size() )
+                return false;
+
+#ifdef _WIN32
+            // A thread can only be affinitized within one processor group. Use the group of the first CPU.
+
+            GROUP_AFFINITY ga = {};
+            ga.Group = (WORD) ( cpus[ 0 ] / 64 );
+
+            for ( size_t i = 0; i < cpus.size(); i++ )
+                if ( ga.Group == ( cpus[ i ] / 64 ) )
+                    ga.Mask |= ( (KAFFINITY) 1 << ( cpus[ i ] % 64 ) );
+
+            return !! SetThreadGroupAffinity( GetCurrentThread(), &ga, NULL );
+#else
+            cpu_set_t mask;
+            CPU_ZERO( &mask );
+
+            for ( size_t i = 0; i < cpus.size(); i++ )
+                if ( cpus[ i ] < CPU_SETSIZE )
+                    CPU_SET( cpus[ i ], &mask );
+
+            return ( 0 == sched_setaffinity( 0, sizeof mask, &mask ) ); // 0 is the calling thread
+#endif
+        } //PinCurrentThread
+
+        // Page-granular allocation preferring physical memory on node id. -1 means no preference.
+
+        static void * AllocOnNode( size_t cb, int id )
+        {
+#ifdef _WIN32
+            if ( -1 == id )
+                return VirtualAlloc( NULL, cb, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE );
+
+            return VirtualAllocExNuma( GetCurrentProcess(), NULL, cb, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, (DWORD) id );
+#else
+            void * p = mmap( NULL, cb, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+
+            if ( MAP_FAILED == p )
+                return NULL;
+
+    #ifdef SYS_mbind
+            if ( -1 != id )
+            {
+                // MPOL_PREFERRED == 1. Falls back to other nodes rather than failing when the node is full.
+
+                const int bitsPerLong = 8 * sizeof( unsigned long );
+                vector<unsigned long> nodemask( 1 + ( id / bitsPerLong ) );
+                nodemask[ id / bitsPerLong ] |= ( 1ul << ( id % bitsPerLong ) );
+                syscall( SYS_mbind, p, cb, 1, nodemask.data(), (unsigned long) ( nodemask.size() * bitsPerLong ), 0 );
+            }
+    #endif
+
+            return p;
+#endif
+        } //AllocOnNode
+
+        static void FreeOnNode( void * p, size_t cb )
+        {
+            if ( NULL == p )
+                return;
+
+#ifdef _WIN32
+            VirtualFree( p, 0, MEM_RELEASE );
+#else
+            munmap( p, cb );
+#endif
+        } //FreeOnNode
+}; //CTopology
+
@@ -0,0 +1,311 @@
+#pragma once
+
+//
+// Video sinks consume pooled frames (djl_framepool.hxx) without copying them.
+// CMFVideoSink wraps each frame in an IMFMediaBuffer that references the frame's memory and hands it to a
+// Media Foundation sink writer. The frame returns to its pool once the encoder releases the sample.
+// CNullVideoSink holds frames for a while the way an encoder pipeline does, then drops them. It builds
+// anywhere, so the pool's lifecycle can be exercised without Media Foundation, and it checks that timestamps
+// only move forward so a pipeline can be benchmarked without an encoder while still being held to ordering.
+// Times and durations are in 100ns units.
+// With UseFragments, a new fragment of a fragmented MP4 starts at least every interval: CMFVideoSink asks the
+// encoder for a key frame there, and the fragmented MP4 sink starts a fragment at each key frame. CNullVideoSink
+// counts the same boundaries, so fragment scheduling can be checked anywhere without an encoder or a muxer.
+// Usage:
+//    CMFVideoSink sink( pSinkWriter, streamIndex );
+//    sink.UseFragments( 2 * 10000000 );   // optional, for sink writers made with MFTranscodeContainerType_FMPEG4
+//    HRESULT hr = sink.WriteFrame( frame, start, duration );
+//    hr = sink.Finalize();
+//
+
+#include <deque>
+
+#include <djl_framepool.hxx>
+
+#ifdef _WIN32
+    #include <windows.h>
+    #include <mfapi.h>
+    #include <mfidl.h>
+    #include <Mfreadwrite.h>
+    #include <codecapi.h>
+    #include <strmif.h>
+#else
+    typedef int32_t HRESULT;
+    #define S_OK ( (HRESULT) 0 )
+    #define E_FAIL ( (HRESULT) 0x80004005 )
+    #define E_OUTOFMEMORY ( (HRESULT) 0x8007000e )
+    #define SUCCEEDED( hr ) ( ( (HRESULT) ( hr ) ) >= 0 )
+    #define FAILED( hr ) ( ( (HRESULT) ( hr ) ) < 0 )
+#endif
+
+using namespace std;
+
+class CVideoSink
+{
+    public:
+        struct Stats
+        {
+            long long framesSubmitted;  // includes repeats of the same frame
+            long long bytesSubmitted;
+            long long bytesCopied;      // frame bytes the sink had to copy
+            long long outOfOrder;       // frames that started before the previous one ended (only checked by CNullVideoSink)
+            long long fragments;        // fragments started, with UseFragments
+        };
+
+    protected:
+        Stats stats;
+        long long fragmentInterval;     // 0 unless the output is fragmented
+        long long nextFragment;
+
+        // True when a frame starting at start begins a new fragment. The first frame always does.
+
+        bool FragmentDue( long long start )
+        {
+            if ( 0 == fragmentInterval || start < nextFragment )
+                return false;
+
+            nextFragment = ( ( start / fragmentInterval ) + 1 ) * fragmentInterval;
+            stats.fragments++;
+            return true;
+        } //FragmentDue
+
+        void CountSubmission( CFrame * frame, bool copied )
+        {
+            stats.framesSubmitted++;
+            stats.bytesSubmitted += frame->Bytes();
+
+            if ( copied )
+                stats.bytesCopied += frame->Bytes();
+        } //CountSubmission
+
+    public:
+        CVideoSink() : fragmentInterval( 0 ), nextFragment( 0 ) { memset( &stats, 0, sizeof stats ); }
+        virtual ~CVideoSink() {}
+
+        // Call before the first frame. interval is the longest a fragment runs, in 100ns units.
+
+        void UseFragments( long long interval )
+        {
+            fragmentInterval = interval;
+            nextFragment = 0;
+        } //UseFragments
+
+        // Callers serialize writes; frames must be submitted in presentation order.
+        // The sink takes its own references to frame; the caller keeps (and later releases) its reference.
+
+        virtual HRESULT WriteFrame( CFrame * frame, long long start, long long duration ) = 0;
+        virtual HRESULT Finalize() = 0;
+
+        Stats GetStats() { return stats; }
+}; //CVideoSink
+
+class CNullVideoSink : public CVideoSink
+{
+    private:
+        deque<CFrame *> inFlight;
+        size_t latency;
+        long long lastEnd;
+
+        void Drain( size_t keep )
+        {
+            while ( inFlight.size() > keep )
+            {
+                inFlight.front()->Release();
+                inFlight.pop_front();
+            }
+        } //Drain
+
+    public:
+        // latency: how many submissions are held before being released, like frames queued in an encoder
+
+        CNullVideoSink( size_t l = 8 ) : latency( l ), lastEnd( 0 ) {}
+        ~CNullVideoSink() { Drain( 0 ); }
+
+        HRESULT WriteFrame( CFrame * frame, long long start, long long duration )
+        {
+            if ( start < lastEnd )
+                stats.outOfOrder++;
+
+            lastEnd = start + duration;
+            FragmentDue( start );
+            frame->AddRef();
+            inFlight.push_back( frame );
+            CountSubmission( frame, false );
+            Drain( latency );
+            return S_OK;
+        } //WriteFrame
+
+        HRESULT Finalize()
+        {
+            Drain( 0 );
+            return S_OK;
+        } //Finalize
+}; //CNullVideoSink
+
+#ifdef _WIN32
+
+// IMFMediaBuffer over a pooled frame. Holds a frame reference for as long as Media Foundation holds the buffer.
+
+class CPooledMediaBuffer : public IMFMediaBuffer
+{
+    private:
+        long refs;
+        CFrame * frame;
+        DWORD currentLength;
+
+        ~CPooledMediaBuffer() { frame->Release(); }
+
+    public:
+        CPooledMediaBuffer( CFrame * f ) : refs( 1 ), frame( f ), currentLength( 0 )
+        {
+            frame->AddRef();
+        }
+
+        STDMETHODIMP QueryInterface( REFIID riid, void ** ppv )
+        {
+            if ( NULL == ppv )
+                return E_POINTER;
+
+            if ( __uuidof( IUnknown ) == riid || __uuidof( IMFMediaBuffer ) == riid )
+            {
+                *ppv = static_cast<IMFMediaBuffer *>( this );
+                AddRef();
+                return S_OK;
+            }
+
+            *ppv = NULL;
+            return E_NOINTERFACE;
+        } //QueryInterface
+
+        STDMETHODIMP_(ULONG) AddRef() { return InterlockedIncrement( &refs ); }
+
+        STDMETHODIMP_(ULONG) Release()
+        {
+            ULONG r = InterlockedDecrement( &refs );
+            if ( 0 == r )
+                delete this;
+            return r;
+        } //Release
+
+        STDMETHODIMP Lock( BYTE ** ppbBuffer, DWORD * pcbMaxLength, DWORD * pcbCurrentLength )
+        {
+            if ( NULL == ppbBuffer )
+                return E_POINTER;
+
+            *ppbBuffer = frame->Bits();
+
+            if ( pcbMaxLength )
+                *pcbMaxLength = (DWORD) frame->Bytes();
+
+            if ( pcbCurrentLength )
+                *pcbCurrentLength = currentLength;
+
+            return S_OK;
+        } //Lock
+
+        STDMETHODIMP Unlock() { return S_OK; }
+
+        STDMETHODIMP GetCurrentLength( DWORD * pcbCurrentLength )
+        {
+            if ( NULL == pcbCurrentLength )
+                return E_POINTER;
+
+            *pcbCurrentLength = currentLength;
+            return S_OK;
+        } //GetCurrentLength
+
+        STDMETHODIMP SetCurrentLength( DWORD cbCurrentLength )
+        {
+            if ( cbCurrentLength > frame->Bytes() )
+                return E_INVALIDARG;
+
+            currentLength = cbCurrentLength;
+            return S_OK;
+        } //SetCurrentLength
+
+        STDMETHODIMP GetMaxLength( DWORD * pcbMaxLength )
+        {
+            if ( NULL == pcbMaxLength )
+                return E_POINTER;
+
+            *pcbMaxLength = (DWORD) frame->Bytes();
+            return S_OK;
+        } //GetMaxLength
+}; //CPooledMediaBuffer
+
+class CMFVideoSink : public CVideoSink
+{
+    private:
+        IMFSinkWriter * pWriter;
+        DWORD streamIndex;
+        ICodecAPI * pCodec;     // the encoder, for forcing key frames at fragment boundaries. NULL if it isn't exposed
+
+    public:
+        CMFVideoSink( IMFSinkWriter * pW, DWORD s ) : pWriter( pW ), streamIndex( s ), pCodec( NULL )
+        {
+            pWriter->AddRef();
+
+            if ( FAILED( pWriter->GetServiceForStream( streamIndex, GUID_NULL, IID_PPV_ARGS( &pCodec ) ) ) )
+                pCodec = NULL;
+        }
+
+        ~CMFVideoSink()
+        {
+            if ( pCodec )
+                pCodec->Release();
+
+            pWriter->Release();
+        }
+
+        HRESULT WriteFrame( CFrame * frame, long long start, long long duration )
+        {
+            // The sample is a small wrapper. The pixels stay in the frame; repeated frames just get another sample.
+
+            CPooledMediaBuffer * pBuffer = new CPooledMediaBuffer( frame );
+            HRESULT hr = pBuffer->SetCurrentLength( (DWORD) frame->Bytes() );
+
+            IMFSample *pSample = NULL;
+
+            if ( SUCCEEDED( hr ) )
+                hr = MFCreateSample( &pSample );
+
+            if ( SUCCEEDED( hr ) )
+                hr = pSample->AddBuffer( pBuffer );
+
+            if ( SUCCEEDED( hr ) )
+                hr = pSample->SetSampleTime( start );
+
+            if ( SUCCEEDED( hr ) )
+                hr = pSample->SetSampleDuration( duration );
+
+            // Without the encoder's ICodecAPI, fragments follow the key frames the encoder picks on its own
+
+            if ( SUCCEEDED( hr ) && FragmentDue( start ) && pCodec )
+            {
+                VARIANT v;
+                v.vt = VT_UI4;
+                v.ulVal = 1;
+                pCodec->SetValue( &CODECAPI_AVEncVideoForceKeyFrame, &v );
+            }
+
+            if ( SUCCEEDED( hr ) )
+                hr = pWriter->WriteSample( streamIndex, pSample );
+
+            if ( SUCCEEDED( hr ) )
+                hr = pWriter->NotifyEndOfSegment( streamIndex );
+
+            if ( SUCCEEDED( hr ) )
+                CountSubmission( frame, false );
+
+            if ( pSample )
+                pSample->Release();
+
+            pBuffer->Release();
+            return hr;
+        } //WriteFrame
+
+        HRESULT Finalize() { return pWriter->Finalize(); }
+}; //CMFVideoSink
+
+#endif // _WIN32
+
@@ -15,12 +15,20 @@
 #include <wincodec.h>
 
 #include <djltrace.hxx>
+#include <djl_sched.hxx>
+#include <djl_arena.hxx>
+#include <djl_resample.hxx>
+#include <djl_compose.hxx>
+#include <djl_pixel.hxx>
 
 class CWic2Gdi
 {
     private:
 
         IWICImagingFactory * pIWICFactory;
+        int resampleFilter;   // -1 to scale with WIC, otherwise a CResampler::Filter
+        bool cropToFill;      // scale to cover the target and keep only the centered part that's visible
+        bool coverTarget;     // scale to cover the target but keep the whole image, so it can be cropped more than one way
 
         template <typename T> static inline void SafeRelease( T *&p )
         {
@@ -70,7 +78,9 @@ class CWic2Gdi
                     cbStride = RoundUpTo4( 3 * width );
 
                 UINT cbBufferSize = cbStride * height;
-                BYTE *pbBuffer  = new BYTE[ cbBufferSize ];
+                BYTE *pbBuffer  = (BYTE *) arena.Alloc( cbBufferSize, memTagBitmaps );
+                if ( NULL == pbBuffer )
+                    return E_OUTOFMEMORY;
         
                 // The WIC plugin decoder is invoked in CopyPixels(), which means many failure modes are inevitable.
                 // For example, Canon .HIF files fail at CopyPixels(). The transforms happen here as well.
@@ -86,7 +96,7 @@ class CWic2Gdi
                 else
                 {
                     tracer.Trace( "  CreateBitmapFromBitmapSource failed in CopyPixels; likely a codec failure, hr %#x\n", hr );
-                    delete pbBuffer;
+                    arena.Free( pbBuffer );
                     pbBuffer = NULL;
                 }
         
@@ -96,7 +106,11 @@ class CWic2Gdi
             return hr;
         } //CreateBitmapFromBitmapSource
         
-        HRESULT ScaleAndConvertBitmapToTarget( IWICBitmapSource * pIn, IWICBitmapSource ** ppOut, int targetW, int targetH, WICPixelFormatGUID & targetPixelFormat )
+        // crop: scale to cover targetW x targetH, then clip to exactly that. The clipper only asks the scaler (and it
+        //       the decoder) for the visible region, and the decoder's own downscaling still applies.
+
+        HRESULT ScaleAndConvertBitmapToTarget( IWICBitmapSource * pIn, IWICBitmapSource ** ppOut, int targetW, int targetH, WICPixelFormatGUID & targetPixelFormat,
+                                               bool crop = false )
         {
             *ppOut = NULL;
         
@@ -113,6 +127,7 @@ class CWic2Gdi
                 return hr;
         
             IWICBitmapScaler *pScaler = NULL;
+            IWICBitmapClipper *pClipper = NULL;
         
             if ( 0 != targetW && 0 != targetH )
             {
@@ -121,7 +136,11 @@ class CWic2Gdi
                 pIn->GetSize( &width, &height );
         
                 UINT w, h;
-                AdjustSizeToFit( width, height, targetW, targetH, w, h );
+
+                if ( crop )
+                    AdjustSizeToCover( width, height, targetW, targetH, w, h );
+                else
+                    AdjustSizeToFit( width, height, targetW, targetH, w, h );
         
                 //tracer.Trace( "img %d %d, target %d %d, final %d %d\n", width, height, targetW, targetH, w, h );
             
@@ -129,16 +148,26 @@ class CWic2Gdi
         
                 if (SUCCEEDED(hr))
                     hr = pScaler->Initialize( pIn, w, h, WICBitmapInterpolationModeHighQualityCubic );
+
+                if ( SUCCEEDED( hr ) && crop )
+                {
+                    WICRect rect = { (INT) ( w - targetW ) / 2, (INT) ( h - targetH ) / 2, targetW, targetH };
+                    hr = pIWICFactory->CreateBitmapClipper( &pClipper );
+
+                    if ( SUCCEEDED( hr ) )
+                        hr = pClipper->Initialize( pScaler, &rect );
+                }
             }
         
             if (SUCCEEDED(hr))
             {
                 IWICFormatConverter *pConverter = NULL;
                 hr = pIWICFactory->CreateFormatConverter( &pConverter );
+                IWICBitmapSource * pScaled = pClipper ? (IWICBitmapSource *) pClipper : pScaler ? (IWICBitmapSource *) pScaler : pIn;
         
                 if (SUCCEEDED(hr))
                 {
-                    hr = pConverter->Initialize( pScaler ? pScaler : pIn, targetPixelFormat, WICBitmapDitherTypeNone, NULL, 0.f, WICBitmapPaletteTypeCustom );
+                    hr = pConverter->Initialize( pScaled, targetPixelFormat, WICBitmapDitherTypeNone, NULL, 0.f, WICBitmapPaletteTypeCustom );
         
                     if (SUCCEEDED(hr))
                         hr = pConverter->QueryInterface( IID_PPV_ARGS( ppOut ) );
@@ -147,6 +176,7 @@ class CWic2Gdi
                 SafeRelease( pConverter );
             }
         
+            SafeRelease( pClipper );
             SafeRelease( pScaler );
         
             return hr;
@@ -174,6 +204,25 @@ class CWic2Gdi
             }
         } //AdjustSizeToFit
 
+        // Like AdjustSizeToFit, but the result covers the target, overflowing it in one dimension
+
+        static void AdjustSizeToCover( UINT wImg, UINT hImg, int targetW, int targetH, UINT & wOut, UINT & hOut )
+        {
+            double winAR = (double) targetW / (double) targetH;
+            double imgAR = (double) wImg / (double) hImg;
+
+            if ( winAR > imgAR )
+            {
+                wOut = targetW;
+                hOut = max( (UINT) targetH, (UINT) round( (double) targetW / (double) wImg * (double) hImg ) );
+            }
+            else
+            {
+                hOut = targetH;
+                wOut = max( (UINT) targetW, (UINT) round( (double) targetH / (double) hImg * (double) wImg ) );
+            }
+        } //AdjustSizeToCover
+
         static Bitmap * ResizeBitmapQuality( Bitmap * pb, int targetW, int targetH, PixelFormat pf )
         {
             Rect rectT( 0, 0, targetW, targetH );
@@ -244,30 +293,42 @@ class CWic2Gdi
             return (((width * bytesPerPixel) + (AlignmentForStride - 1)) / AlignmentForStride) * AlignmentForStride;
         } //StrideInBytes
 
-        static Bitmap * Rotate90( Bitmap & before )
+        // Bytes per pixel of the GDI+ formats the loader's own kernels handle, or 0 for any other format
+
+        static int PixelBytes( DWORD gdipPixelFormat )
         {
-            Bitmap * after = new Bitmap( before.GetHeight(), before.GetWidth(), PixelFormat24bppRGB );
-        
-            Rect rectAfter( 0, 0, after->GetWidth(), after->GetHeight() );
-            BitmapData bdAfter;
-            after->LockBits( &rectAfter, ImageLockModeWrite, PixelFormat24bppRGB, &bdAfter );
-            int strideAfter = abs( bdAfter.Stride );
-        
-            if ( strideAfter != StrideInBytes( after->GetWidth(), 24 ) )
-                wprintf( L"stride After not expected\n" );
+            return ( PixelFormat24bppRGB == gdipPixelFormat ) ? 3 : ( PixelFormat32bppRGB == gdipPixelFormat ) ? 4 : 0;
+        } //PixelBytes
+
+        template <typename P> static PixelFormat GdipPixelFormat()
+        {
+            return ( 4 == P::Bytes ) ? PixelFormat32bppRGB : PixelFormat24bppRGB;
+        } //GdipPixelFormat
+
+        // The rotated bits live in an arena buffer returned in ppBuffer, just like CreateBitmapFromBitmapSource
+
+        template <typename P> static Bitmap * Rotate90( Bitmap & before, byte ** ppBuffer )
+        {
+            *ppBuffer = NULL;
+            int strideAfter = StrideInBytes( before.GetHeight(), 8 * P::Bytes );
+            byte * pAfter = (byte *) arena.Alloc( (size_t) strideAfter * before.GetWidth(), memTagRotate );
+            if ( NULL == pAfter )
+                return NULL;
+
+            Bitmap * after = new Bitmap( before.GetHeight(), before.GetWidth(), strideAfter, GdipPixelFormat<P>(), pAfter );
         
             Rect rectBefore( 0, 0, before.GetWidth(), before.GetHeight() );
             BitmapData bdBefore;
         
-            // The native pixel format is 24bppRGB. Reading anything else is much slower.
+            // Read in the bitmap's own format. Reading anything else makes GDI+ convert it and is much slower.
         
-            before.LockBits( &rectBefore, ImageLockModeRead, PixelFormat24bppRGB, &bdBefore );
+            before.LockBits( &rectBefore, ImageLockModeRead, GdipPixelFormat<P>(), &bdBefore );
             int strideBefore = abs( bdBefore.Stride );
         
-            if ( strideBefore != StrideInBytes( before.GetWidth(), 24 ) )
+            if ( strideBefore != StrideInBytes( before.GetWidth(), 8 * P::Bytes ) )
                 wprintf( L"stride Before not expected\n" );
         
-            const int blockSize = 128; // in pixels, which are 3 bytes long. 64 and 256 are each a little slower
+            const int blockSize = 128; // in pixels. 64 and 256 are each a little slower
             int afterHorRem = after->GetWidth() % blockSize;
             int afterVerRem = after->GetHeight() % blockSize;
             int afterBlocksHor = ( after->GetWidth() / blockSize ) + ( ( 0 == afterHorRem ) ? 0 : 1 );
@@ -275,62 +336,191 @@ class CWic2Gdi
             int afterLastH = afterBlocksHor - 1;
             int afterLastV = afterBlocksVer - 1;
             byte *pBefore = (byte *) bdBefore.Scan0;
-            byte *pAfter = (byte *) bdAfter.Scan0;
             int bhm1 = before.GetHeight() - 1;
         
+            // Each column block of After is ( blockSize * height of After ) pixels. Size the subtasks from that.
+
+            int blocksPerTask = CTaskScheduler::RowsPerBlock( blockSize * P::Bytes * after->GetHeight(), afterBlocksHor );
+
             //for ( int x = 0; x < afterBlocksHor; x++ )
-            parallel_for( 0, afterBlocksHor, [&] ( int x )
+            scheduler.ForRange( 0, afterBlocksHor, blocksPerTask, [&] ( int xBegin, int xEnd )
             {
-                int xp = ( ( x == afterLastH ) && ( 0 != afterHorRem ) ) ? afterHorRem : blockSize;
-                int xBlock = x * blockSize;
-        
-                for ( int y = 0; y < afterBlocksVer; y++ )
+                for ( int x = xBegin; x < xEnd; x++ )
                 {
-                    int yp = ( ( y == afterLastV ) && ( 0 != afterVerRem ) ) ? afterVerRem : blockSize;
-                    int yp3 = yp * 3;
-                    int yBlock = y * blockSize;
-                    int yoA = yBlock * strideAfter;
-                    byte * pAfterBase = pAfter + yoA;
-                    byte * pBeforeBase = pBefore + 3 * yBlock;
-        
-                    //wprintf( L"  xp: %d, yp: %d\n", xp, yp );
+                    int xp = ( ( x == afterLastH ) && ( 0 != afterHorRem ) ) ? afterHorRem : blockSize;
+                    int xBlock = x * blockSize;
         
-                    for ( int xc = 0; xc < xp; xc++ )
+                    for ( int y = 0; y < afterBlocksVer; y++ )
                     {
-                        int xoA = xBlock + xc;
-                        byte * pa = pAfterBase + ( 3 * xoA );
-                        int yoB = ( bhm1 - xoA ) * strideBefore;
-                        byte * pb = pBeforeBase + yoB;
-                        byte * pbend = pb + yp3;
+                        int yp = ( ( y == afterLastV ) && ( 0 != afterVerRem ) ) ? afterVerRem : blockSize;
+                        int ypBytes = yp * P::Bytes;
+                        int yBlock = y * blockSize;
+                        int yoA = yBlock * strideAfter;
+                        byte * pAfterBase = pAfter + yoA;
+                        byte * pBeforeBase = pBefore + P::Bytes * yBlock;
         
-                        do
+                        //wprintf( L"  xp: %d, yp: %d\n", xp, yp );
+        
+                        for ( int xc = 0; xc < xp; xc++ )
                         {
-                            // This code gets generated inline. Note the potentially unaligned word copy, but it's fast
-                            //    movzx   eax,word ptr [rdi]
-                            //    mov     word ptr [rsi],ax
-                            //    movzx   eax,byte ptr [rdi+2]
-                            //    mov     byte ptr [rsi+2],al
-                            //    add     rdi,3
-                            //    mov     qword ptr [rsp+0B8h],rdi
-                            //    add     rsi,rbx
-                            //    mov     qword ptr [rsp+0C0h],rsi
-                            //    cmp     rdi,r15
-                            //    jb      cv!Rotate90+0x540 (00007ff7`787fb350)
-        
-                            memcpy( pa, pb, 3 );
-                            pb += 3;
-                            pa += strideAfter;
-                        } while ( pb < pbend );
+                            int xoA = xBlock + xc;
+                            byte * pa = pAfterBase + ( P::Bytes * xoA );
+                            int yoB = ( bhm1 - xoA ) * strideBefore;
+                            byte * pb = pBeforeBase + yoB;
+                            byte * pbend = pb + ypBytes;
+        
+                            do
+                            {
+                                // This code gets generated inline. For 24bpp, note the potentially unaligned word copy, but it's fast.
+                                // For 32bpp it's a single dword move.
+                                //    movzx   eax,word ptr [rdi]
+                                //    mov     word ptr [rsi],ax
+                                //    movzx   eax,byte ptr [rdi+2]
+                                //    mov     byte ptr [rsi+2],al
+                                //    add     rdi,3
+                                //    mov     qword ptr [rsp+0B8h],rdi
+                                //    add     rsi,rbx
+                                //    mov     qword ptr [rsp+0C0h],rsi
+                                //    cmp     rdi,r15
+                                //    jb      cv!Rotate90+0x540 (00007ff7`787fb350)
+        
+                                memcpy( pa, pb, P::Bytes );
+                                pb += P::Bytes;
+                                pa += strideAfter;
+                            } while ( pb < pbend );
+                        }
                     }
                 }
             } );
         
             before.UnlockBits( &bdBefore );
-            after->UnlockBits( &bdAfter );
         
+            *ppBuffer = pAfter;
             return after;
         } //Rotate90
 
+    public:
+
+        // A frame the loader can decode straight into, in the pixel format asked of GDIPBitmapFromWIC. If the image needs
+        // no rotation and fits, the scaled pixels are written centered in the frame and placed is set to true. The caller
+        // then fills around the image rect.
+
+        struct DecodeTarget
+        {
+            byte * pFrame;
+            int frameW, frameH, stride;
+            bool placed;                       // out: the image is in the frame; no bitmap is returned
+            int imageX, imageY, imageW, imageH; // out: where the image landed
+            long long bytesCopied;             // out: image bytes copied after decoding, e.g. for rotation
+
+            DecodeTarget( byte * p, int w, int h, int s ) : pFrame( p ), frameW( w ), frameH( h ), stride( s ), placed( false ),
+                                                            imageX( 0 ), imageY( 0 ), imageW( 0 ), imageH( 0 ), bytesCopied( 0 ) {}
+        };
+
+    private:
+
+        // The size with the image's aspect ratio that just covers targetW x targetH. Never larger than the image.
+
+        static void CoverSize( UINT wImg, UINT hImg, int & targetW, int & targetH )
+        {
+            double scale = __max( (double) targetW / (double) wImg, (double) targetH / (double) hImg );
+
+            if ( scale >= 1.0 )
+            {
+                targetW = (int) wImg;
+                targetH = (int) hImg;
+            }
+            else
+            {
+                targetW = __max( 1, (int) ( (double) wImg * scale + 0.5 ) );
+                targetH = __max( 1, (int) ( (double) hImg * scale + 0.5 ) );
+            }
+        } //CoverSize
+
+        void ResampledSize( UINT w, UINT h, int targetW, int targetH, UINT & outW, UINT & outH )
+        {
+            if ( cropToFill )
+            {
+                // The source was already clipped to the target's aspect ratio
+
+                outW = targetW;
+                outH = targetH;
+            }
+            else
+                AdjustSizeToFit( w, h, targetW, targetH, outW, outH );
+        } //ResampledSize
+
+        // Decodes a stripe of rows at a time and scales each as it arrives, so the full-size image never exists in memory.
+        // Peak memory is about one 1MB stripe plus CStripeResampler's ring, whatever the size of the source.
+
+        template <typename P> HRESULT DecodeStriped( IWICBitmapSource * pSource, UINT w, UINT h, byte * pDst, UINT outW, UINT outH, int dstStride )
+        {
+            int cbStride = StrideInBytes( w, 8 * P::Bytes );
+            int stripeRows = __max( 16, ( 1024 * 1024 ) / cbStride );
+            stripeRows = __min( stripeRows, (int) h );
+
+            unique_ptr<byte, ArenaDeleter> stripe( (byte *) arena.Alloc( (size_t) cbStride * stripeRows, memTagDecode ) );
+            if ( NULL == stripe.get() )
+                return E_OUTOFMEMORY;
+
+            CStripeResampler<P> stripes( resampler, w, h, pDst, outW, outH, dstStride, (CResampler::Filter) resampleFilter, stripeRows );
+            HRESULT hr = S_OK;
+
+            for ( int y = 0; SUCCEEDED( hr ) && y < (int) h; y += stripeRows )
+            {
+                int rows = __min( stripeRows, (int) h - y );
+                WICRect rect = { 0, y, (INT) w, rows };
+                hr = pSource->CopyPixels( &rect, cbStride, cbStride * rows, stripe.get() );
+
+                if ( SUCCEEDED( hr ) )
+                    stripes.AddRows( stripe.get(), cbStride, rows );
+            }
+
+            return hr;
+        } //DecodeStriped
+
+        template <typename P> HRESULT DecodeIntoTarget( IWICBitmapSource * pSource, bool resample, int targetW, int targetH, DecodeTarget & t )
+        {
+            UINT w = 0, h = 0;
+            HRESULT hr = pSource->GetSize( &w, &h );
+            if ( FAILED( hr ) )
+                return hr;
+
+            UINT outW = w, outH = h;
+
+            if ( resample )
+                ResampledSize( w, h, targetW, targetH, outW, outH );
+
+            if ( (int) outW > t.frameW || (int) outH > t.frameH )
+                return S_OK; // doesn't fit; the caller gets a bitmap instead
+
+            int x = ( t.frameW - (int) outW ) / 2;
+            int y = ( t.frameH - (int) outH ) / 2;
+            byte * pDst = t.pFrame + ( (size_t) y * t.stride ) + ( x * P::Bytes );
+
+            if ( outW == w && outH == h )
+            {
+                // The last row needn't be a full stride since the image may not reach the frame's edge
+
+                hr = pSource->CopyPixels( NULL, t.stride, ( t.stride * ( outH - 1 ) ) + ( outW * P::Bytes ), pDst );
+            }
+            else
+                hr = DecodeStriped<P>( pSource, w, h, pDst, outW, outH, t.stride );
+
+            if ( SUCCEEDED( hr ) )
+            {
+                t.placed = true;
+                t.imageX = x;
+                t.imageY = y;
+                t.imageW = outW;
+                t.imageH = outH;
+            }
+            else
+                tracer.Trace( "  DecodeIntoTarget failed in CopyPixels; likely a codec failure, hr %#x\n", hr );
+
+            return hr;
+        } //DecodeIntoTarget
+
     public:
 
         static Bitmap * ResizeGDIPBitmap( Bitmap * pb, int targetW, int targetH, PixelFormat pf )
@@ -343,13 +533,15 @@ class CWic2Gdi
 
         // pwcPath: path of input file or NULL to use pStream
         // pStream: stream of input or NULL to use pwcPath
-        // ppBuffer: returns a byte array of the bits held in the returned bitmap or NULL if not needed
+        // ppBuffer: returns the bits held in the returned bitmap or NULL if not needed. Free with arena.Free().
         // targetW / targetH: size of the intended window, so the image can be rescaled or 0 to indicate no scaling
         // availableWidth / availableHeight: full original dimensions of the bitmap
         // gdipPixelFormat: pixel format of the GDI+ bitmap created.
+        // pTarget: optional frame to decode directly into. If pTarget->placed is true on return, no bitmap is returned.
 
         Bitmap * GDIPBitmapFromWIC( WCHAR * pwcPath, IStream * pStream, byte **ppBuffer, int targetW, int targetH,
-                                    int * availableWidth, int * availableHeight, DWORD gdipPixelFormat = PixelFormat32bppRGB )
+                                    int * availableWidth, int * availableHeight, DWORD gdipPixelFormat = PixelFormat32bppRGB,
+                                    DecodeTarget * pTarget = NULL )
         {
         
             //tracer.Trace( "opening %ws\n", pwcPath );
@@ -491,10 +683,49 @@ class CWic2Gdi
                     *availableHeight = (int) height;
                 }
             }
+
+            // From here on the image is fit in the target, which for cover is enlarged to the target's covering size
+
+            if ( SUCCEEDED( hr ) && coverTarget && !cropToFill && ( 0 != targetW ) && ( 0 != targetH ) )
+                CoverSize( width, height, targetW, targetH );
         
+            // CResampler handles 24bpp and 32bpp. When it's used, WIC just converts and the scaling happens below.
+
+            int pixelBytes = PixelBytes( gdipPixelFormat );
+            bool resample = ( -1 != resampleFilter ) && ( 0 != pixelBytes ) && ( 0 != targetW ) && ( 0 != targetH );
+
+            bool crop = cropToFill && ( 0 != targetW ) && ( 0 != targetH );
+
+            // For CResampler, clip the source to the visible region up front so CopyPixels only produces that region.
+            // The WIC scaler path clips after scaling instead, in ScaleAndConvertBitmapToTarget.
+
+            if ( SUCCEEDED( hr ) && crop && resample )
+            {
+                int x, y, cw, ch;
+                CCompositor::CropRect( width, height, targetW, targetH, x, y, cw, ch );
+                WICRect rect = { x, y, cw, ch };
+
+                IWICBitmapClipper * pClipper = NULL;
+                hr = pIWICFactory->CreateBitmapClipper( &pClipper );
+
+                if ( SUCCEEDED( hr ) )
+                    hr = pClipper->Initialize( pBitmapSource, &rect );
+
+                if ( SUCCEEDED( hr ) )
+                {
+                    SafeRelease( pBitmapSource );
+                    pBitmapSource = pClipper;
+                    pClipper = NULL;
+                    width = cw;
+                    height = ch;
+                }
+
+                SafeRelease( pClipper );
+            }
+
             IWICBitmapSource *pConverted = NULL;
             if ( SUCCEEDED( hr ) )
-                hr = ScaleAndConvertBitmapToTarget( pBitmapSource, &pConverted, targetW, targetH, wicPixelFormat );
+                hr = ScaleAndConvertBitmapToTarget( pBitmapSource, &pConverted, resample ? 0 : targetW, resample ? 0 : targetH, wicPixelFormat, crop && !resample );
         
             if ( S_FALSE == hr )
             {
@@ -506,9 +737,53 @@ class CWic2Gdi
             }
         
             SafeRelease( pBitmapSource );
+
+            // With no rotation, the pixels can go straight to their final place in the caller's frame
+
+            bool rotates = ( orientation >= 2 && orientation <= 8 );
+
+            if ( SUCCEEDED( hr ) && pTarget && !rotates && ( 0 != pixelBytes ) )
+            {
+                DispatchPixel( pixelBytes, [&] ( auto pixel ) { hr = DecodeIntoTarget<decltype( pixel )>( pConverted, resample, targetW, targetH, *pTarget ); } );
+
+                if ( FAILED( hr ) || pTarget->placed )
+                {
+                    SafeRelease( pConverted );
+                    SafeRelease( pDecoder );
+                    SafeRelease( pFrame );
+                    return NULL;
+                }
+            }
         
             Bitmap * pBitmap = 0;
-            if ( SUCCEEDED( hr ) )
+            UINT outW = width, outH = height;
+
+            if ( resample )
+                ResampledSize( width, height, targetW, targetH, outW, outH );
+
+            if ( SUCCEEDED( hr ) && resample && ( outW != width || outH != height ) )
+            {
+                // Only the scaled image is allocated; the source streams through in stripes
+
+                int strideAfter = StrideInBytes( outW, 8 * pixelBytes );
+                byte * pScaled = (byte *) arena.Alloc( (size_t) strideAfter * outH, memTagBitmaps );
+
+                if ( NULL == pScaled )
+                    hr = E_OUTOFMEMORY;
+                else
+                {
+                    DispatchPixel( pixelBytes, [&] ( auto pixel ) { hr = DecodeStriped<decltype( pixel )>( pConverted, width, height, pScaled, outW, outH, strideAfter ); } );
+
+                    if ( SUCCEEDED( hr ) )
+                    {
+                        pBitmap = new Bitmap( outW, outH, strideAfter, gdipPixelFormat, pScaled );
+                        *ppBuffer = pScaled;
+                    }
+                    else
+                        arena.Free( pScaled );
+                }
+            }
+            else if ( SUCCEEDED( hr ) )
                 hr = CreateBitmapFromBitmapSource( pConverted, & pBitmap, ppBuffer, wicPixelFormat, gdipPixelFormat );
         
             SafeRelease( pConverted );
@@ -519,13 +794,26 @@ class CWic2Gdi
 
             if ( pBitmap && orientation )
             {
-                if ( ( 6 == orientation ) && ( PixelFormat24bppRGB == gdipPixelFormat ) )
+                if ( ( 6 == orientation ) && ( 0 != pixelBytes ) )
                 {
                     // 4.7 times faster than ExifRotate
 
-                    Bitmap * pRotated = Rotate90( *pBitmap );
-                    delete pBitmap;
-                    pBitmap = pRotated;
+                    byte * pRotatedBuffer = NULL;
+                    Bitmap * pRotated = NULL;
+                    DispatchPixel( pixelBytes, [&] ( auto pixel ) { pRotated = Rotate90<decltype( pixel )>( *pBitmap, &pRotatedBuffer ); } );
+
+                    if ( pRotated )
+                    {
+                        if ( pTarget )
+                            pTarget->bytesCopied += (long long) pRotated->GetWidth() * pRotated->GetHeight() * pixelBytes;
+
+                        delete pBitmap;
+                        arena.Free( *ppBuffer );
+                        pBitmap = pRotated;
+                        *ppBuffer = pRotatedBuffer;
+                    }
+                    else
+                        ExifRotate( *pBitmap, orientation, FALSE );
                 }
                 else
                 {
@@ -539,6 +827,9 @@ class CWic2Gdi
         CWic2Gdi()
         {
             pIWICFactory = 0;
+            resampleFilter = -1;
+            cropToFill = false;
+            coverTarget = false;
 
             HRESULT hr = CoCreateInstance( CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_PPV_ARGS( &pIWICFactory ) );
 
@@ -548,6 +839,38 @@ class CWic2Gdi
 
         bool Ok() { return ( 0 != pIWICFactory ); }
 
+        // -1 (the default) scales with WIC's high quality cubic scaler. A CResampler::Filter scales with CResampler.
+
+        void UseResampler( int filter ) { resampleFilter = filter; }
+
+        // true: scale images to cover the target size and crop the rest. false (the default): letterbox.
+
+        void UseCrop( bool crop ) { cropToFill = crop; }
+
+        // true: scale images to just cover the target size, but return all of the image so the caller can crop it
+        // to more than one aspect ratio. Ignored when cropping.
+
+        void UseCover( bool cover ) { coverTarget = cover; }
+
+        // A stream over a file already in memory, for GDIPBitmapFromWIC. p must stay valid until the stream is released.
+
+        IStream * CreateMemoryStream( byte * p, DWORD cb )
+        {
+            IWICStream * pStream = NULL;
+            HRESULT hr = pIWICFactory->CreateStream( &pStream );
+
+            if ( SUCCEEDED( hr ) )
+                hr = pStream->InitializeFromMemory( p, cb );
+
+            if ( FAILED( hr ) )
+            {
+                tracer.Trace( "can't create a WIC memory stream, hr %#x\n", hr );
+                SafeRelease( pStream );
+            }
+
+            return pStream;
+        } //CreateMemoryStream
+
         void ShutdownWic()
         {
             SafeRelease( pIWICFactory );
@@ -7,6 +7,9 @@
 // Multi-threaded runtime is:   48% in ReadFile,   28% in CreateFile, 4% in CloseHandle, 1.0% in SetFilePointerEx, 0.6% in GetFileSizeEx.
 //
 // This code reduces the calls to ReadFile at the expense of some clarity.
+// Files are now mapped (CMappedFile) and parsed through memory-backed streams: one CreateFile per file, no ReadFile
+// or SetFilePointerEx calls, and embedded images are parsed from the same view rather than by reopening the file.
+// Callers that already have the file in memory can pass it in and the file isn't opened at all.
 
 #include <windows.h>
 #include <shlwapi.h>
@@ -121,6 +124,8 @@ private:
     std::mutex g_mtx;
     CCropFactor g_factor;
     CStream * g_pStream = NULL;
+    const byte * g_pData = NULL;        // the file in memory while it's being enumerated, or NULL to read it by handle
+    __int64 g_cbData = 0;
     const double InvalidCoordinate = 1000.0;
     static const WORD MaxIFDHeaders = 200; // assume anything more than this is a corrupt or badly parsed file.
                                            // panasonic makernotes sometimes have 133 entries.
@@ -2558,9 +2563,19 @@ private:
         return pwcPath + len;
     } //FindExtension
 
+    // Streams over the embedded image come from the same memory as the outer file when there is any
+
+    CStream * OpenEmbedded( const WCHAR * pwc, __int64 offset, __int64 length )
+    {
+        if ( NULL != g_pData )
+            return new CStream( g_pData, g_cbData, offset, length );
+
+        return new CStream( pwc, offset, length );
+    } //OpenEmbedded
+
     void EnumerateImageData( HANDLE hFile, const WCHAR * pwc )
     {
-        g_pStream = new CStream( hFile );
+        g_pStream = ( NULL != g_pData ) ? new CStream( g_pData, g_cbData ) : new CStream( hFile );
         unique_ptr<CStream> stream( g_pStream );
     
         if ( !g_pStream->Ok() )
@@ -2639,7 +2654,7 @@ private:
 
             if ( 0 != g_Embedded_Image_Offset && 0 != g_Embedded_Image_Length )
             {
-                CStream * embeddedImage = new CStream( pwc, g_Embedded_Image_Offset, g_Embedded_Image_Length );
+                CStream * embeddedImage = OpenEmbedded( pwc, g_Embedded_Image_Offset, g_Embedded_Image_Length );
     
                 embeddedImage->Read( &header, sizeof header );
                 stream.reset( embeddedImage );
@@ -2658,7 +2673,7 @@ private:
     
             if ( 0 != g_Embedded_Image_Offset && 0 != g_Embedded_Image_Length )
             {
-                CStream * embeddedImage = new CStream( pwc, g_Embedded_Image_Offset, g_Embedded_Image_Length );
+                CStream * embeddedImage = OpenEmbedded( pwc, g_Embedded_Image_Offset, g_Embedded_Image_Length );
     
                 embeddedImage->Read( &header, sizeof header );
                 stream.reset( embeddedImage );
@@ -2820,7 +2835,7 @@ private:
             // Panasonic raw files sometimes have embedded JPGs with metadata not in the actual RW2 file.
             // Specifically, Serial Number, Lens Model, and Lens Serial Number can only be retrieved in this way.
     
-            g_pStream = new CStream( pwc, g_Embedded_Image_Offset, g_Embedded_Image_Length );
+            g_pStream = OpenEmbedded( pwc, g_Embedded_Image_Offset, g_Embedded_Image_Length );
             stream.reset( g_pStream );
     
             if ( !g_pStream->Ok() )
@@ -2892,7 +2907,7 @@ private:
             }
             else
             {
-                CStream * embeddedImage = new CStream( pwc, g_Embedded_Image_Offset, g_Embedded_Image_Length );
+                CStream * embeddedImage = OpenEmbedded( pwc, g_Embedded_Image_Offset, g_Embedded_Image_Length );
                 unsigned long long head;
                 embeddedImage->Read( &head, sizeof head );
                 stream.reset( embeddedImage );
@@ -3009,7 +3024,9 @@ private:
         g_RatingInXMP = 0;        // integer 0..5 only valid if g_RatingInXMP_Offset isn't 0
     } //InitializeGlobals
     
-    void UpdateCache( const WCHAR * pwcPath )
+    // pData/cbData: the file's contents if the caller already has them in memory
+
+    void UpdateCache( const WCHAR * pwcPath, const byte * pData = NULL, size_t cbData = 0 )
     {
         // protect against multiple threads updating Image Data at the same time.
         // note that this doesn't help if they are opening different files since the globals will be trashed.
@@ -3043,12 +3060,45 @@ private:
                 cached = true;
         }
     
+        if ( !cached && ( NULL != pData || INVALID_HANDLE_VALUE == hFile ) )
+        {
+            // Parse from memory: either what the caller has or a view of the file
+
+            unique_ptr<CMappedFile> mapped;
+
+            if ( NULL == pData )
+            {
+                mapped.reset( new CMappedFile( pwcPath ) );
+
+                if ( mapped->Ok() )
+                {
+                    pData = mapped->Data();
+                    cbData = (size_t) mapped->Size();
+                }
+            }
+
+            if ( NULL != pData )
+            {
+                InitializeGlobals();
+                wcscpy_s( g_awcPath, _countof( g_awcPath ), pwcPath );
+                g_pData = pData;
+                g_cbData = cbData;
+                EnumerateImageData( INVALID_HANDLE_VALUE, pwcPath );
+                g_pData = NULL;
+                g_cbData = 0;
+                cached = true;
+            }
+        }
+
         if ( !cached )
         {
             InitializeGlobals();
     
             if ( INVALID_HANDLE_VALUE == hFile )
+            {
                 hFile = CreateFile( pwcPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL );
+                CStream::Counts().opens++;
+            }
     
             if ( INVALID_HANDLE_VALUE != hFile )
             {
@@ -3234,7 +3284,14 @@ public:
 
     bool FindDateTime( const WCHAR * pwcPath, char * pcDateTime, int buflen )
     {
-        UpdateCache( pwcPath );
+        return FindDateTime( pwcPath, NULL, 0, pcDateTime, buflen );
+    } //FindDateTime
+
+    // For callers that already have the file in memory, e.g. to decode it too
+
+    bool FindDateTime( const WCHAR * pwcPath, const byte * pData, size_t cbData, char * pcDateTime, int buflen )
+    {
+        UpdateCache( pwcPath, pData, cbData );
     
         char * p = NULL;
     
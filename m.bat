@@ -1,6 +1,9 @@
 @echo off
 del cv.exe
 del cv.pdb
+del cvbench.exe
+del cvbench.pdb
 cl /nologo cv.cxx /I.\ /O2it /EHac /Zi /Gy /D_AMD64_ /link ntdll.lib /OPT:REF
+cl /nologo cvbench.cxx /I.\ /O2it /EHac /Zi /Gy /D_AMD64_ /link /OPT:REF
 
 